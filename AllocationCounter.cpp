@@ -0,0 +1,45 @@
+// The replaceable global allocation functions, counting into the calling thread's AllocationCounter (see ImportArena.h).
+// Only built with PIANO_COUNT_ALLOCATIONS defined for the whole program: every allocation of the process, the libraries'
+// included, goes through them.
+#include "ImportArena.h"
+
+#ifdef PIANO_COUNT_ALLOCATIONS
+void* operator new(size_t size)
+{
+	AllocationCounter *counter = AllocationCounter::current();
+	if (counter)
+	{
+		counter->allocations.fetch_add(1, std::memory_order_relaxed);
+		counter->bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+	void *p = std::malloc(size > 0 ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return ::operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	std::free(p);
+}
+#endif
@@ -0,0 +1,505 @@
+#ifndef ASSET_ARCHIVE_H
+#define ASSET_ARCHIVE_H
+
+#include "MappedFile.h"
+#include "BlockCompression.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <climits>
+#include <cstdlib>
+using namespace std;
+
+// Single-file archive of pre-processed scene assets (mesh caches, baked texture containers, shader sources), written
+// by `bake archive` and mounted read-only through a memory mapping, so a cold start is one sequential read instead of
+// hundreds of small opens. Layout (all little-endian):
+//   header : AssetArchiveHeader
+//   data   : the blocks of every entry in order, each entry starting on a 16 byte boundary
+//   toc    : AssetArchiveEntry[entryCount], AssetArchiveBlock[blockCount], names (nameBytes, not terminated)
+// Entries are cut into 64 KiB blocks compressed independently (see BlockCompression.h), so any range of an entry can
+// be read without decompressing what comes before it. Blocks that don't compress are stored as is; an entry made
+// only of stored blocks is handed out straight from the mapping without a copy.
+// Entry names are lexically normalized paths relative to the directory the scene runs from.
+
+const uint32_t ASSET_ARCHIVE_MAGIC = 0x314b4150; // "PAK1"
+const uint32_t ASSET_ARCHIVE_VERSION = 1;
+const uint32_t ASSET_ARCHIVE_BLOCK_SIZE = 64 * 1024;
+const uint32_t ASSET_ARCHIVE_ALIGNMENT = 16;
+
+struct AssetArchiveHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t blockSize;
+	uint32_t entryCount;
+	uint32_t blockCount;
+	uint32_t nameBytes;
+	uint64_t tocOffset;
+};
+
+struct AssetArchiveEntry {
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	uint64_t size;
+	uint32_t firstBlock;
+	uint32_t blockCount;
+};
+
+struct AssetArchiveBlock {
+	uint64_t offset;
+	uint32_t storedSize;	// equal to rawSize if the block is stored uncompressed
+	uint32_t rawSize;
+};
+
+// resolves "." and ".." and unifies separators without touching the file system, so "obj/stage/../../textures/a.png"
+// and "textures/a.png" name the same entry
+inline string NormalizeAssetPath(const string &path)
+{
+	bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\');
+	vector<string> parts;
+	size_t pos = 0;
+	while (pos <= path.size())
+	{
+		size_t end = path.find_first_of("/\\", pos);
+		if (end == string::npos)
+			end = path.size();
+		string part = path.substr(pos, end - pos);
+		if (part == "..")
+		{
+			if (!parts.empty() && parts.back() != "..")
+				parts.pop_back();
+			else if (!absolute)
+				parts.push_back(part);
+		}
+		else if (!part.empty() && part != ".")
+			parts.push_back(part);
+		pos = end + 1;
+	}
+	string result = absolute ? "/" : "";
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		if (i > 0)
+			result += '/';
+		result += parts[i];
+	}
+	return result;
+}
+
+// absolute path with symlinks resolved, or the lexically normalized path if the file doesn't exist on disk
+// (files that only exist in the asset archive still have to meet under one name)
+inline string CanonicalPath(const string &path)
+{
+#ifdef _WIN32
+	char buffer[_MAX_PATH];
+	if (!_fullpath(buffer, path.c_str(), _MAX_PATH))
+		return NormalizeAssetPath(path);
+	string result = buffer;
+	for (size_t i = 0; i < result.size(); i++)
+		if (result[i] == '\\')
+			result[i] = '/';
+	return result;
+#else
+	char buffer[PATH_MAX];
+	return realpath(path.c_str(), buffer) ? string(buffer) : NormalizeAssetPath(path);
+#endif
+}
+
+class AssetArchive
+{
+public:
+	AssetArchive() : header(), entries(nullptr), blocks(nullptr), names(nullptr) {}
+
+	~AssetArchive()
+	{
+		if (current() == this)
+			current() = nullptr;
+	}
+
+	AssetArchive(const AssetArchive&) = delete;
+	AssetArchive& operator=(const AssetArchive&) = delete;
+
+	// the mounted archive every loader looks in first, null if the scene runs from loose files
+	static AssetArchive*& current()
+	{
+		static AssetArchive *archive = nullptr;
+		return archive;
+	}
+
+	// maps the archive at path and makes it current. Returns false, leaving the loose files in charge,
+	// if it doesn't exist or is damaged.
+	bool mount(const string &path)
+	{
+		if (!file.open(path))
+			return false;
+		const unsigned char *data = file.data();
+		size_t size = file.size();
+		if (size < sizeof(AssetArchiveHeader))
+			return fail(path);
+		memcpy(&header, data, sizeof(header));
+		if (header.magic != ASSET_ARCHIVE_MAGIC || header.version != ASSET_ARCHIVE_VERSION || header.blockSize == 0 ||
+			header.tocOffset > size)
+			return fail(path);
+		uint64_t tocSize = (uint64_t)header.entryCount * sizeof(AssetArchiveEntry) +
+			(uint64_t)header.blockCount * sizeof(AssetArchiveBlock) + header.nameBytes;
+		if (size - header.tocOffset < tocSize || header.tocOffset % ASSET_ARCHIVE_ALIGNMENT != 0)
+			return fail(path);
+		entries = (const AssetArchiveEntry*)(data + header.tocOffset);
+		blocks = (const AssetArchiveBlock*)(entries + header.entryCount);
+		names = (const char*)(blocks + header.blockCount);
+
+		toc.clear();
+		toc.reserve(header.entryCount);
+		for (uint32_t i = 0; i < header.entryCount; i++)
+		{
+			const AssetArchiveEntry &entry = entries[i];
+			if ((uint64_t)entry.nameOffset + entry.nameLength > header.nameBytes ||
+				(uint64_t)entry.firstBlock + entry.blockCount > header.blockCount)
+				return fail(path);
+			uint64_t total = 0;
+			for (uint32_t b = entry.firstBlock; b < entry.firstBlock + entry.blockCount; b++)
+			{
+				if (blocks[b].offset > size || size - blocks[b].offset < blocks[b].storedSize ||
+					blocks[b].rawSize > header.blockSize || blocks[b].storedSize > blocks[b].rawSize)
+					return fail(path);
+				total += blocks[b].rawSize;
+			}
+			if (total != entry.size)
+				return fail(path);
+			toc[string(names + entry.nameOffset, entry.nameLength)] = i;
+		}
+		root = NormalizeAssetPath(currentDirectory());
+		current() = this;
+		cout << "ASSET_ARCHIVE:: mounted " << path << " (" << header.entryCount << " entries, " << size / 1024 << " KiB)" << endl;
+		return true;
+	}
+
+	bool isMounted() const { return entries != nullptr; }
+	size_t entryCount() const { return toc.size(); }
+
+	bool contains(const string &path) const
+	{
+		return find(path) != nullptr;
+	}
+
+	// uncompressed size of an entry, 0 if there is none
+	size_t entrySize(const string &path) const
+	{
+		const AssetArchiveEntry *entry = find(path);
+		return entry ? (size_t)entry->size : 0;
+	}
+
+	// the entry's bytes straight from the mapping if all of its blocks are stored uncompressed, null otherwise
+	const unsigned char* view(const string &path, size_t &size) const
+	{
+		const AssetArchiveEntry *entry = find(path);
+		if (!entry)
+			return nullptr;
+		for (uint32_t b = entry->firstBlock; b < entry->firstBlock + entry->blockCount; b++)
+			if (blocks[b].storedSize != blocks[b].rawSize ||
+				(b > entry->firstBlock && blocks[b].offset != blocks[b - 1].offset + blocks[b - 1].rawSize))
+				return nullptr;
+		size = (size_t)entry->size;
+		return entry->blockCount > 0 ? file.data() + blocks[entry->firstBlock].offset : file.data();
+	}
+
+	// decompresses a whole entry into out
+	bool read(const string &path, vector<unsigned char> &out) const
+	{
+		const AssetArchiveEntry *entry = find(path);
+		if (!entry)
+			return false;
+		out.resize((size_t)entry->size);
+		return readRange(*entry, 0, out.size(), out.data());
+	}
+
+	// decompresses size bytes starting at offset of an entry into dst, touching only the blocks that overlap the range
+	bool readRange(const string &path, uint64_t offset, size_t size, unsigned char *dst) const
+	{
+		const AssetArchiveEntry *entry = find(path);
+		return entry && readRange(*entry, offset, size, dst);
+	}
+
+private:
+	MappedFile file;
+	AssetArchiveHeader header;
+	const AssetArchiveEntry *entries;
+	const AssetArchiveBlock *blocks;
+	const char *names;
+	unordered_map<string, uint32_t> toc;
+	string root;	// absolute paths under the working directory are looked up relative to it
+
+	bool fail(const string &path)
+	{
+		cout << "ERROR::ASSET_ARCHIVE:: " << path << " is damaged or from another version, using loose files" << endl;
+		file.close();
+		entries = nullptr;
+		blocks = nullptr;
+		names = nullptr;
+		toc.clear();
+		return false;
+	}
+
+	const AssetArchiveEntry* find(const string &path) const
+	{
+		if (!isMounted())
+			return nullptr;
+		string name = NormalizeAssetPath(path);
+		if (!root.empty() && name.size() > root.size() && name.compare(0, root.size(), root) == 0 && name[root.size()] == '/')
+			name.erase(0, root.size() + 1);
+		auto it = toc.find(name);
+		return it != toc.end() ? &entries[it->second] : nullptr;
+	}
+
+	bool readRange(const AssetArchiveEntry &entry, uint64_t offset, size_t size, unsigned char *dst) const
+	{
+		if (offset > entry.size || entry.size - offset < size)
+			return false;
+		vector<unsigned char> scratch;
+		uint64_t blockStart = 0;
+		for (uint32_t b = entry.firstBlock; b < entry.firstBlock + entry.blockCount && size > 0; b++)
+		{
+			const AssetArchiveBlock &block = blocks[b];
+			uint64_t blockEnd = blockStart + block.rawSize;
+			if (blockEnd > offset)
+			{
+				size_t skip = (size_t)(offset - blockStart);
+				size_t count = block.rawSize - skip < size ? block.rawSize - skip : size;
+				const unsigned char *stored = file.data() + block.offset;
+				if (block.storedSize == block.rawSize)
+					memcpy(dst, stored + skip, count);
+				else if (skip == 0 && count == block.rawSize)
+				{
+					if (!DecompressBlock(stored, block.storedSize, dst, block.rawSize))
+						return false;
+				}
+				else
+				{
+					// partial block, decompress it aside and copy the part asked for
+					scratch.resize(block.rawSize);
+					if (!DecompressBlock(stored, block.storedSize, scratch.data(), block.rawSize))
+						return false;
+					memcpy(dst, scratch.data() + skip, count);
+				}
+				dst += count;
+				offset += count;
+				size -= count;
+			}
+			blockStart = blockEnd;
+		}
+		return size == 0;
+	}
+
+	static string currentDirectory()
+	{
+		char buffer[4096];
+#ifdef _WIN32
+		return _getcwd(buffer, sizeof(buffer)) ? buffer : "";
+#else
+		return getcwd(buffer, sizeof(buffer)) ? buffer : "";
+#endif
+	}
+};
+
+// Read-only view of one asset, served from the mounted archive if it holds the file and from disk otherwise.
+// data() stays valid as long as the AssetFile does.
+class AssetFile
+{
+public:
+	AssetFile() : ptr(nullptr), length(0), archived(false) {}
+
+	AssetFile(const AssetFile&) = delete;
+	AssetFile& operator=(const AssetFile&) = delete;
+
+	bool open(const string &path)
+	{
+		close();
+		AssetArchive *archive = AssetArchive::current();
+		if (archive && archive->contains(path))
+		{
+			ptr = archive->view(path, length);
+			if (!ptr)
+			{
+				if (!archive->read(path, buffer))
+				{
+					cout << "ERROR::ASSET_ARCHIVE:: could not decompress " << path << endl;
+					close();
+					return false;
+				}
+				ptr = buffer.data();
+				length = buffer.size();
+			}
+			archived = true;
+			return true;
+		}
+		if (!file.open(path))
+			return false;
+		ptr = file.data();
+		length = file.size();
+		return true;
+	}
+
+	void close()
+	{
+		file.close();
+		vector<unsigned char>().swap(buffer);
+		ptr = nullptr;
+		length = 0;
+		archived = false;
+	}
+
+	bool isOpen() const { return ptr != nullptr; }
+	bool isArchived() const { return archived; }
+	const unsigned char* data() const { return ptr; }
+	size_t size() const { return length; }
+
+private:
+	MappedFile file;
+	vector<unsigned char> buffer;
+	const unsigned char *ptr;
+	size_t length;
+	bool archived;
+};
+
+// Collects files in memory and writes them out as an archive (bake tool side).
+class AssetArchiveWriter
+{
+public:
+	AssetArchiveWriter() : rawBytes(0), storedBytes(0) {}
+
+	bool contains(const string &name) const
+	{
+		return indices.count(NormalizeAssetPath(name)) != 0;
+	}
+
+	// adds (or replaces) an entry
+	void add(const string &name, const unsigned char *data, size_t size)
+	{
+		string normalized = NormalizeAssetPath(name);
+		auto it = indices.find(normalized);
+		if (it == indices.end())
+		{
+			indices[normalized] = files.size();
+			files.push_back(PendingFile{ normalized, vector<unsigned char>(data, data + size) });
+		}
+		else
+			files[it->second].bytes.assign(data, data + size);
+	}
+
+	// adds a file from disk under its own path
+	bool addFile(const string &path)
+	{
+		MappedFile source;
+		if (!source.open(path))
+			return false;
+		add(path, source.data(), source.size());
+		return true;
+	}
+
+	size_t entryCount() const { return files.size(); }
+
+	// compresses everything and writes the archive, under a temporary name first
+	bool write(const string &path)
+	{
+		string tmpPath = path + ".tmp";
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+
+		AssetArchiveHeader header;
+		memset(&header, 0, sizeof(header));
+		out.write((const char*)&header, sizeof(header));
+		uint64_t position = sizeof(header);
+
+		vector<AssetArchiveEntry> entries;
+		vector<AssetArchiveBlock> blocks;
+		string names;
+		vector<unsigned char> compressed;
+		rawBytes = storedBytes = 0;
+		for (const PendingFile &pending : files)
+		{
+			position += writePadding(out, position);
+			AssetArchiveEntry entry;
+			entry.nameOffset = (uint32_t)names.size();
+			entry.nameLength = (uint32_t)pending.name.size();
+			entry.size = pending.bytes.size();
+			entry.firstBlock = (uint32_t)blocks.size();
+			names += pending.name;
+			for (size_t offset = 0; offset < pending.bytes.size(); offset += ASSET_ARCHIVE_BLOCK_SIZE)
+			{
+				size_t rawSize = pending.bytes.size() - offset < ASSET_ARCHIVE_BLOCK_SIZE ? pending.bytes.size() - offset : ASSET_ARCHIVE_BLOCK_SIZE;
+				const unsigned char *raw = pending.bytes.data() + offset;
+				CompressBlock(raw, rawSize, compressed);
+				AssetArchiveBlock block;
+				block.offset = position;
+				block.rawSize = (uint32_t)rawSize;
+				if (compressed.size() < rawSize)
+				{
+					block.storedSize = (uint32_t)compressed.size();
+					out.write((const char*)compressed.data(), compressed.size());
+				}
+				else
+				{
+					block.storedSize = (uint32_t)rawSize;
+					out.write((const char*)raw, rawSize);
+				}
+				position += block.storedSize;
+				rawBytes += rawSize;
+				storedBytes += block.storedSize;
+				blocks.push_back(block);
+			}
+			entry.blockCount = (uint32_t)blocks.size() - entry.firstBlock;
+			entries.push_back(entry);
+		}
+
+		position += writePadding(out, position);
+		header.magic = ASSET_ARCHIVE_MAGIC;
+		header.version = ASSET_ARCHIVE_VERSION;
+		header.blockSize = ASSET_ARCHIVE_BLOCK_SIZE;
+		header.entryCount = (uint32_t)entries.size();
+		header.blockCount = (uint32_t)blocks.size();
+		header.nameBytes = (uint32_t)names.size();
+		header.tocOffset = position;
+		out.write((const char*)entries.data(), entries.size() * sizeof(AssetArchiveEntry));
+		out.write((const char*)blocks.data(), blocks.size() * sizeof(AssetArchiveBlock));
+		out.write(names.data(), names.size());
+		out.seekp(0);
+		out.write((const char*)&header, sizeof(header));
+		out.close();
+		if (!out)
+			return false;
+		std::remove(path.c_str());
+		return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+	}
+
+	// totals of the last write
+	uint64_t rawBytes;
+	uint64_t storedBytes;
+
+private:
+	struct PendingFile {
+		string name;
+		vector<unsigned char> bytes;
+	};
+	vector<PendingFile> files;
+	unordered_map<string, size_t> indices;
+
+	static uint64_t writePadding(std::ofstream &out, uint64_t position)
+	{
+		static const char padding[ASSET_ARCHIVE_ALIGNMENT] = {};
+		uint64_t count = (ASSET_ARCHIVE_ALIGNMENT - position % ASSET_ARCHIVE_ALIGNMENT) % ASSET_ARCHIVE_ALIGNMENT;
+		out.write(padding, count);
+		return count;
+	}
+};
+#endif
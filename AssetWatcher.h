@@ -0,0 +1,261 @@
+#ifndef ASSET_WATCHER_H
+#define ASSET_WATCHER_H
+
+#include "AssetArchive.h"
+#include "ThreadPool.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+using namespace std;
+
+// Live reloading of edited assets. A background thread watches the directories of every registered file (inotify on
+// Linux, polling the modification times of the registered files elsewhere). Once a changed file has been quiet for
+// ASSET_WATCH_SETTLE_MS, because editors tend to write in several steps, only the handlers registered for that file
+// run, on a worker thread, and do all the CPU work of re-importing it. Each returns the GL side of the change, which
+// update() applies on the GL thread between two frames, so a frame never sees half of an update.
+
+const unsigned int ASSET_WATCH_SETTLE_MS = 150;
+const unsigned int ASSET_WATCH_POLL_MS = 500;	// fallback without inotify
+
+typedef function<void()> ApplyChange;						// GL thread
+typedef function<ApplyChange(const string &path)> ReloadAsset;	// worker thread, returns nothing to skip the change
+
+class AssetWatcher
+{
+public:
+	AssetWatcher() : stopping(false),
+#ifdef __linux__
+		notifyFd(-1),
+#endif
+		pool(2)
+	{
+	}
+
+	~AssetWatcher()
+	{
+		stop();
+	}
+
+	AssetWatcher(const AssetWatcher&) = delete;
+	AssetWatcher& operator=(const AssetWatcher&) = delete;
+
+	// reload runs whenever the file at path changes
+	void watch(const string &path, const ReloadAsset &reload)
+	{
+		string canonical = CanonicalPath(path);
+		std::lock_guard<std::mutex> lock(mutex);
+		files[canonical].push_back(reload);
+		addDirectory(directoryOf(canonical));
+	}
+
+	void watch(const vector<string> &paths, const ReloadAsset &reload)
+	{
+		for (const string &path : paths)
+			watch(path, reload);
+	}
+
+	// reload runs for changes to any file in directory that has no handler of its own. Only supported with inotify.
+	void watchDirectory(const string &directory, const ReloadAsset &reload)
+	{
+		string canonical = CanonicalPath(directory);
+		std::lock_guard<std::mutex> lock(mutex);
+		directories[canonical] = reload;
+		addDirectory(canonical);
+	}
+
+	void start()
+	{
+		if (thread.joinable())
+			return;
+		stopping = false;
+		thread = std::thread(&AssetWatcher::watchLoop, this);
+	}
+
+	void stop()
+	{
+		stopping = true;
+		if (thread.joinable())
+			thread.join();
+		pool.wait();
+#ifdef __linux__
+		if (notifyFd >= 0)
+			::close(notifyFd);
+		notifyFd = -1;
+#endif
+	}
+
+	// GL thread, once per frame before rendering: applies every reload that finished since the last call
+	void update()
+	{
+		vector<ApplyChange> changes;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			changes.swap(ready);
+		}
+		for (ApplyChange &change : changes)
+			change();
+	}
+
+private:
+	std::thread thread;
+	std::atomic<bool> stopping;
+	std::mutex mutex;
+	unordered_map<string, vector<ReloadAsset> > files;
+	unordered_map<string, ReloadAsset> directories;
+	unordered_map<string, uint64_t> generations;	// bumped per change, so a slow stale reload never overrides a newer one
+	unordered_map<string, int64_t> modified;		// polling fallback: last seen modification time per file
+	vector<ApplyChange> ready;
+#ifdef __linux__
+	int notifyFd;
+	unordered_map<int, string> watchDirectories;	// inotify watch descriptor -> canonical directory
+#endif
+	vector<string> watchedDirectories;
+	ThreadPool pool;	// last, so its workers are gone before anything they use
+
+	static string directoryOf(const string &path)
+	{
+		size_t slash = path.find_last_of('/');
+		return slash == string::npos ? "." : path.substr(0, slash);
+	}
+
+	static int64_t modificationTime(const string &path)
+	{
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 ? (int64_t)st.st_mtime : -1;
+	}
+
+	// called with mutex held
+	void addDirectory(const string &directory)
+	{
+		for (const string &watched : watchedDirectories)
+			if (watched == directory)
+				return;
+		watchedDirectories.push_back(directory);
+#ifdef __linux__
+		if (notifyFd < 0)
+			notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (notifyFd >= 0)
+		{
+			// writes in place end with a close, atomic saves with a rename into the directory
+			int wd = inotify_add_watch(notifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+			if (wd >= 0)
+				watchDirectories[wd] = directory;
+			else
+				cout << "WARNING::ASSET_WATCHER:: cannot watch " << directory << endl;
+		}
+#endif
+	}
+
+	void watchLoop()
+	{
+		typedef std::chrono::steady_clock Clock;
+		unordered_map<string, Clock::time_point> pending;	// changed files waiting to settle
+		while (!stopping)
+		{
+			collectChanges(pending);
+			Clock::time_point now = Clock::now();
+			for (auto it = pending.begin(); it != pending.end(); )
+			{
+				if (now - it->second >= std::chrono::milliseconds(ASSET_WATCH_SETTLE_MS))
+				{
+					dispatch(it->first);
+					it = pending.erase(it);
+				}
+				else
+					++it;
+			}
+		}
+	}
+
+	// waits up to a poll interval and records the files that changed meanwhile
+	void collectChanges(unordered_map<string, std::chrono::steady_clock::time_point> &pending)
+	{
+#ifdef __linux__
+		if (notifyFd >= 0)
+		{
+			pollfd descriptor = { notifyFd, POLLIN, 0 };
+			if (poll(&descriptor, 1, 50) <= 0)
+				return;
+			alignas(inotify_event) char buffer[4096];
+			ssize_t length;
+			while ((length = read(notifyFd, buffer, sizeof(buffer))) > 0)
+			{
+				for (char *p = buffer; p < buffer + length; )
+				{
+					const inotify_event *event = (const inotify_event*)p;
+					p += sizeof(inotify_event) + event->len;
+					if (event->len == 0)
+						continue;
+					std::lock_guard<std::mutex> lock(mutex);
+					auto directory = watchDirectories.find(event->wd);
+					if (directory != watchDirectories.end())
+						pending[directory->second + '/' + event->name] = std::chrono::steady_clock::now();
+				}
+			}
+			return;
+		}
+#endif
+		std::this_thread::sleep_for(std::chrono::milliseconds(ASSET_WATCH_POLL_MS));
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto it = files.begin(); it != files.end(); ++it)
+		{
+			int64_t time = modificationTime(it->first);
+			auto last = modified.find(it->first);
+			if (last == modified.end())
+				modified[it->first] = time;
+			else if (last->second != time)
+			{
+				last->second = time;
+				// already settled for a whole poll interval
+				pending[it->first] = std::chrono::steady_clock::time_point();
+			}
+		}
+	}
+
+	// runs the handlers of a changed file on the workers
+	void dispatch(const string &path)
+	{
+		vector<ReloadAsset> handlers;
+		uint64_t generation;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto file = files.find(path);
+			if (file != files.end())
+				handlers = file->second;
+			else
+			{
+				auto directory = directories.find(directoryOf(path));
+				if (directory != directories.end())
+					handlers.push_back(directory->second);
+			}
+			generation = ++generations[path];
+		}
+		for (const ReloadAsset &reload : handlers)
+		{
+			pool.enqueue([this, reload, path, generation]() {
+				ApplyChange change = reload(path);
+				if (!change)
+					return;
+				std::lock_guard<std::mutex> lock(mutex);
+				if (generations[path] == generation)
+					ready.push_back(change);
+			});
+		}
+	}
+};
+#endif
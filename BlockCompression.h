@@ -0,0 +1,142 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+using namespace std;
+
+// Byte-oriented LZ77 compression in the LZ4 block format: a sequence of [token][literal length][literals][offset]
+// [match length] records with a 64 KiB window. Decoding is a tight copy loop, a few GB/s, which is what matters for
+// assets read at startup; the greedy single-probe compressor runs offline in the bake tool.
+
+const unsigned int LZ_HASH_BITS = 14;
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_LAST_LITERALS = 5;		// the format requires the last 5 bytes to be literals
+const size_t LZ_MATCH_LIMIT = 12;		// and the last match to start at least 12 bytes before the end
+
+inline uint32_t ReadLE32(const unsigned char *p)
+{
+	uint32_t value;
+	memcpy(&value, p, 4);
+	return value;
+}
+
+inline void WriteLength(vector<unsigned char> &out, size_t length)
+{
+	for (; length >= 255; length -= 255)
+		out.push_back(255);
+	out.push_back((unsigned char)length);
+}
+
+// compresses size bytes into out (replacing its contents)
+inline void CompressBlock(const unsigned char *src, size_t size, vector<unsigned char> &out)
+{
+	out.clear();
+	out.reserve(size + size / 255 + 16);
+	vector<uint32_t> table(1u << LZ_HASH_BITS, 0);	// position + 1 of the last occurrence of a 4 byte sequence
+	size_t anchor = 0, ip = 0;
+	size_t matchStartLimit = size > LZ_MATCH_LIMIT ? size - LZ_MATCH_LIMIT : 0;
+	size_t matchEndLimit = size > LZ_LAST_LITERALS ? size - LZ_LAST_LITERALS : 0;
+	while (ip < matchStartLimit)
+	{
+		uint32_t sequence = ReadLE32(src + ip);
+		uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+		size_t candidate = table[hash];
+		table[hash] = (uint32_t)(ip + 1);
+		if (candidate == 0 || ip - (candidate - 1) > 0xffff || ReadLE32(src + candidate - 1) != sequence)
+		{
+			ip++;
+			continue;
+		}
+		size_t match = candidate - 1;
+		size_t length = LZ_MIN_MATCH;
+		while (ip + length < matchEndLimit && src[match + length] == src[ip + length])
+			length++;
+
+		size_t literals = ip - anchor;
+		size_t extra = length - LZ_MIN_MATCH;
+		out.push_back((unsigned char)(((literals < 15 ? literals : 15) << 4) | (extra < 15 ? extra : 15)));
+		if (literals >= 15)
+			WriteLength(out, literals - 15);
+		out.insert(out.end(), src + anchor, src + ip);
+		size_t offset = ip - match;
+		out.push_back((unsigned char)(offset & 0xff));
+		out.push_back((unsigned char)(offset >> 8));
+		if (extra >= 15)
+			WriteLength(out, extra - 15);
+		ip += length;
+		anchor = ip;
+	}
+
+	// the rest goes out as literals
+	size_t literals = size - anchor;
+	out.push_back((unsigned char)((literals < 15 ? literals : 15) << 4));
+	if (literals >= 15)
+		WriteLength(out, literals - 15);
+	out.insert(out.end(), src + anchor, src + size);
+}
+
+// decompresses exactly dstSize bytes. Fails on malformed input instead of reading or writing out of bounds.
+inline bool DecompressBlock(const unsigned char *src, size_t srcSize, unsigned char *dst, size_t dstSize)
+{
+	size_t ip = 0, op = 0;
+	while (ip < srcSize)
+	{
+		unsigned int token = src[ip++];
+		size_t literals = token >> 4;
+		if (literals == 15)
+		{
+			unsigned char byte;
+			do
+			{
+				if (ip >= srcSize)
+					return false;
+				byte = src[ip++];
+				literals += byte;
+			} while (byte == 255);
+		}
+		if (literals > srcSize - ip || literals > dstSize - op)
+			return false;
+		memcpy(dst + op, src + ip, literals);
+		ip += literals;
+		op += literals;
+		if (ip == srcSize)
+			break;	// the last sequence has no match
+
+		if (srcSize - ip < 2)
+			return false;
+		size_t offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op)
+			return false;
+		size_t length = token & 15;
+		if (length == 15)
+		{
+			unsigned char byte;
+			do
+			{
+				if (ip >= srcSize)
+					return false;
+				byte = src[ip++];
+				length += byte;
+			} while (byte == 255);
+		}
+		length += LZ_MIN_MATCH;
+		if (length > dstSize - op)
+			return false;
+		const unsigned char *match = dst + op - offset;
+		if (offset >= length)
+			memcpy(dst + op, match, length);
+		else
+		{
+			// overlapping copy repeats the last offset bytes
+			for (size_t i = 0; i < length; i++)
+				dst[op + i] = match[i];
+		}
+		op += length;
+	}
+	return op == dstSize;
+}
+#endif
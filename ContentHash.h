@@ -0,0 +1,20 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstdint>
+#include <cstddef>
+
+const uint64_t CONTENT_HASH_SEED = 14695981039346656037ULL;
+
+// 64-bit FNV-1a, used to tell whether two files (or a file and the cache baked from it) hold the same bytes.
+// Chain calls by passing the previous result as hash.
+inline uint64_t HashBytes(const unsigned char *data, size_t size, uint64_t hash = CONTENT_HASH_SEED)
+{
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+#endif
@@ -0,0 +1,187 @@
+#ifndef CUBEMAP_LOADER_H
+#define CUBEMAP_LOADER_H
+
+#include <glad/glad.h>
+
+#include "GLExtensions.h"
+#include "TextureContainer.h"
+#include "TextureLoader.h"
+
+#include <string>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <thread>
+using namespace std;
+
+// Skybox cubemaps. A baked container holding all six pre-filtered mip chains (`bake cubemap`) is preferred; otherwise
+// the six face images are decoded at the same time, one thread each, since they are independent and decoding is most
+// of the cost. Either way the texture is allocated once with immutable storage (glTexStorage2D, where the driver has
+// it) and filled with glTexSubImage2D, which spares the driver from re-validating the texture after every face.
+// Faces larger than the TEXTURE_SKYBOX budget are halved while decoding, or skip the top levels of the baked chains.
+// Block compressed containers are uploaded as they are where the driver has the format and decoded otherwise.
+
+const unsigned int CUBEMAP_FACES = 6;
+
+// where the baked container for a set of faces lives, next to the first (+X) face
+inline string CubemapContainerPath(const vector<string> &faces)
+{
+	return faces[0] + ".cube.ktx";
+}
+
+// allocates every level of the bound cubemap. Without immutable storage, compressed levels are only specified by
+// UploadCubemapLevel.
+inline void AllocateCubemap(GLenum internalFormat, GLenum format, int size, int levels)
+{
+	if (GLExt().textureStorage)
+		GLExt().TexStorage2D(GL_TEXTURE_CUBE_MAP, levels, internalFormat, size, size);
+	else if (!IsCompressedFormat(internalFormat))
+	{
+		for (int level = 0; level < levels; level++)
+		{
+			int levelSize = size >> level > 0 ? size >> level : 1;
+			for (unsigned int face = 0; face < CUBEMAP_FACES; face++)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, internalFormat, levelSize, levelSize, 0, format, GL_UNSIGNED_BYTE, nullptr);
+		}
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levels - 1);
+}
+
+// fills one face of one level of the bound cubemap allocated by AllocateCubemap
+inline void UploadCubemapLevel(unsigned int face, int level, GLenum internalFormat, GLenum format, int size, size_t bytes,
+	const void *data)
+{
+	GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + face;
+	if (!IsCompressedFormat(internalFormat))
+		glTexSubImage2D(target, level, 0, 0, size, size, format, GL_UNSIGNED_BYTE, data);
+	else if (GLExt().textureStorage)
+		glCompressedTexSubImage2D(target, level, 0, 0, size, size, internalFormat, (GLsizei)bytes, data);
+	else
+		glCompressedTexImage2D(target, level, internalFormat, size, size, 0, (GLsizei)bytes, data);
+}
+
+// fills the bound cubemap from a baked container, false if there is no up to date one
+inline bool UploadCubemapContainer(const vector<string> &faces, int &levelCount)
+{
+	string containerPath = CubemapContainerPath(faces);
+	AssetArchive *archive = AssetArchive::current();
+	if (!(archive && archive->contains(containerPath)))
+		for (const string &face : faces)
+			if (!IsTextureContainerFresh(face, containerPath))
+				return false;
+
+	AssetFile file;
+	TextureContainer container;
+	if (!file.open(containerPath) || !ReadTextureContainer(file.data(), file.size(), container) ||
+		container.faces != (int)CUBEMAP_FACES || container.levels[0].width != container.levels[0].height)
+		return false;
+
+	int maxSize = TextureBudget::get().maxSize(TEXTURE_SKYBOX);
+	unsigned int first = 0;
+	while (maxSize > 0 && first + 1 < container.levels.size() && container.levels[first].width > maxSize)
+		first++;
+	levelCount = (int)(container.levels.size() - first);
+	GLenum internalFormat = container.glInternalFormat, format = container.glFormat;
+	bool decode = container.compressed() && !CompressedFormatSupported(internalFormat);
+	int channels = container.channels;
+	if (decode)
+	{
+		channels = ChannelsForCompressedFormat(internalFormat);
+		format = FormatForChannels(channels);
+	}
+	AllocateCubemap(decode ? SizedFormatForChannels(channels) : internalFormat, format, container.levels[first].width, levelCount);
+	// decoded rows are tightly packed
+	glPixelStorei(GL_UNPACK_ALIGNMENT, decode ? 1 : 4);
+	vector<unsigned char> pixels;
+	for (unsigned int level = first; level < container.levels.size(); level++)
+	{
+		const TextureLevelView &view = container.levels[level];
+		for (unsigned int face = 0; face < CUBEMAP_FACES; face++)
+		{
+			if (!decode)
+			{
+				UploadCubemapLevel(face, level - first, internalFormat, format, view.width, view.size, view.faces[face]);
+				continue;
+			}
+			pixels.resize((size_t)view.width * view.height * channels);
+			DecodeTextureBlocks(view.faces[face], view.width, view.height, internalFormat, pixels.data());
+			UploadCubemapLevel(face, level - first, SizedFormatForChannels(channels), format, view.width, pixels.size(), pixels.data());
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	return true;
+}
+
+// decodes the face images concurrently and fills the bound cubemap with their base level
+inline bool UploadCubemapFaces(const vector<string> &faces)
+{
+	ImageData images[CUBEMAP_FACES];
+	int maxSize = TextureBudget::get().maxSize(TEXTURE_SKYBOX);
+	vector<std::thread> decoders;
+	for (unsigned int face = 0; face < CUBEMAP_FACES; face++)
+	{
+		decoders.push_back(std::thread([&faces, &images, face, maxSize]() {
+			StartupTracer::get().nameThread("cubemap decoder");
+			TRACE_SCOPE("texture", faces[face]);
+			ImageData &image = images[face];
+			image.path = faces[face];
+			image.pixels = DecodeImageFile(faces[face], &image.width, &image.height, &image.channels);
+			FitImageToBudget(image, maxSize, true);
+		}));
+	}
+	for (std::thread &decoder : decoders)
+		decoder.join();
+
+	for (unsigned int face = 0; face < CUBEMAP_FACES; face++)
+	{
+		if (!images[face].pixels)
+		{
+			std::cout << "Cubemap texture failed to load at path: " << faces[face] << std::endl;
+			return false;
+		}
+		if (images[face].width != images[0].width || images[face].height != images[0].height ||
+			images[face].channels != images[0].channels || images[face].width != images[face].height)
+		{
+			std::cout << "ERROR::CUBEMAP:: " << faces[face] << " is " << images[face].width << "x" << images[face].height << "x"
+				<< images[face].channels << ", faces have to be square and all alike" << std::endl;
+			return false;
+		}
+	}
+
+	for (unsigned int face = 0; face < CUBEMAP_FACES; face++)
+		ReportTextureMemory(images[face], false);
+	TRACE_SCOPE("upload", "cubemap faces");
+	GLenum format = FormatForChannels(images[0].channels);
+	AllocateCubemap(SizedFormatForChannels(images[0].channels), format, images[0].width, 1);
+	// decoded rows are tightly packed, which breaks the default 4 byte alignment for RGB faces of odd widths
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (unsigned int face = 0; face < CUBEMAP_FACES; face++)
+		glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, 0, 0, images[face].width, images[face].height,
+			format, GL_UNSIGNED_BYTE, images[face].pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	return true;
+}
+
+// loads a cubemap from 6 individual texture faces, in the order +X, -X, +Y, -Y, +Z, -Z
+inline unsigned int LoadCubemap(const vector<string> &faces)
+{
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+
+	int levelCount = 1;
+	if (faces.size() != CUBEMAP_FACES)
+		std::cout << "ERROR::CUBEMAP:: expected " << CUBEMAP_FACES << " faces, got " << faces.size() << std::endl;
+	else if (!UploadCubemapContainer(faces, levelCount))
+		UploadCubemapFaces(faces);
+
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, levelCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+	return textureID;
+}
+#endif
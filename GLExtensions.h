@@ -0,0 +1,124 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <cstring>
+
+// The bundled glad loader only covers core 3.3, so everything newer that we use opportunistically is
+// declared and loaded here. Each feature has a flag that is only true when the driver exposes it,
+// callers are expected to keep a 3.3 fallback.
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+#ifndef APIENTRYP
+#define APIENTRYP APIENTRY *
+#endif
+
+typedef void (APIENTRYP PFN_glBufferStorage)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+typedef void (APIENTRYP PFN_glGetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFN_glProgramBinary)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP PFN_glProgramParameteri)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFN_glTexStorage2D)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP PFN_glCopyImageSubData)(GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ,
+	GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth);
+
+struct GLExtensions {
+	bool bufferStorage;		// GL 4.4 / ARB_buffer_storage
+	bool programBinary;		// GL 4.1 / ARB_get_program_binary, with at least one binary format
+	bool textureStorage;	// GL 4.2 / ARB_texture_storage
+	bool copyImage;			// GL 4.3 / ARB_copy_image
+	bool textureCompressionS3tc;		// EXT_texture_compression_s3tc, the DXT1/DXT5 (BC1/BC3) formats
+	bool textureCompressionS3tcSrgb;	// their sRGB variants, EXT_texture_sRGB or EXT_texture_compression_s3tc_srgb
+
+	PFN_glBufferStorage BufferStorage;
+	PFN_glGetProgramBinary GetProgramBinary;
+	PFN_glProgramBinary ProgramBinary;
+	PFN_glProgramParameteri ProgramParameteri;
+	PFN_glTexStorage2D TexStorage2D;
+	PFN_glCopyImageSubData CopyImageSubData;
+
+	GLExtensions() : bufferStorage(false), programBinary(false), textureStorage(false), copyImage(false), textureCompressionS3tc(false),
+		textureCompressionS3tcSrgb(false), BufferStorage(nullptr),
+		GetProgramBinary(nullptr), ProgramBinary(nullptr), ProgramParameteri(nullptr), TexStorage2D(nullptr), CopyImageSubData(nullptr) {}
+};
+
+// process-wide feature table, filled by LoadGLExtensions once a context is current
+inline GLExtensions& GLExt()
+{
+	static GLExtensions extensions;
+	return extensions;
+}
+
+inline bool HasGLExtension(const char *name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char *extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && std::strcmp(extension, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+inline bool HasGLVersion(int major, int minor)
+{
+	GLint contextMajor = 0, contextMinor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+	glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+	return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+// call right after gladLoadGLLoader with the same loader function
+inline void LoadGLExtensions(GLADloadproc load)
+{
+	GLExtensions &ext = GLExt();
+
+	if (HasGLVersion(4, 4) || HasGLExtension("GL_ARB_buffer_storage"))
+		ext.BufferStorage = (PFN_glBufferStorage)load("glBufferStorage");
+	ext.bufferStorage = ext.BufferStorage != nullptr;
+
+	if (HasGLVersion(4, 1) || HasGLExtension("GL_ARB_get_program_binary"))
+	{
+		ext.GetProgramBinary = (PFN_glGetProgramBinary)load("glGetProgramBinary");
+		ext.ProgramBinary = (PFN_glProgramBinary)load("glProgramBinary");
+		ext.ProgramParameteri = (PFN_glProgramParameteri)load("glProgramParameteri");
+	}
+	// drivers may expose the entry points without supporting a single format to save to
+	GLint binaryFormats = 0;
+	if (ext.GetProgramBinary && ext.ProgramBinary && ext.ProgramParameteri)
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormats);
+	ext.programBinary = binaryFormats > 0;
+
+	if (HasGLVersion(4, 2) || HasGLExtension("GL_ARB_texture_storage"))
+		ext.TexStorage2D = (PFN_glTexStorage2D)load("glTexStorage2D");
+	ext.textureStorage = ext.TexStorage2D != nullptr;
+
+	if (HasGLVersion(4, 3) || HasGLExtension("GL_ARB_copy_image"))
+		ext.CopyImageSubData = (PFN_glCopyImageSubData)load("glCopyImageSubData");
+	ext.copyImage = ext.CopyImageSubData != nullptr;
+
+	// compressed uploads are core, only the formats need the extensions
+	ext.textureCompressionS3tc = HasGLExtension("GL_EXT_texture_compression_s3tc");
+	ext.textureCompressionS3tcSrgb = ext.textureCompressionS3tc &&
+		(HasGLExtension("GL_EXT_texture_sRGB") || HasGLExtension("GL_EXT_texture_compression_s3tc_srgb"));
+}
+#endif
@@ -0,0 +1,235 @@
+#ifndef GEOMETRY_POOL_H
+#define GEOMETRY_POOL_H
+
+#include <glad/glad.h>
+
+#include "VertexFormat.h"
+
+#include <map>
+#include <memory>
+#include <vector>
+#include <cstddef>
+using namespace std;
+
+// Shared vertex/index buffers for static meshes. Every vertex layout gets one arena: a single VBO, EBO and VAO that all
+// meshes of that layout are suballocated from, drawn with glDrawElementsBaseVertex so their indices stay relative to
+// their own first vertex. Drawing the whole scene then switches VAOs once or twice instead of once per mesh, and all
+// the geometry sits in a few buffers ready for multi-draw submission.
+// Arenas start at GEOMETRY_ARENA_INITIAL_BYTES per buffer and double when full, copying on the GPU.
+const bool MESH_GEOMETRY_POOL = true;
+const size_t GEOMETRY_ARENA_INITIAL_BYTES = 4 * 1024 * 1024;
+
+// binds a VAO unless it is bound already. Everything binding VAOs has to go through this to keep the cache right.
+inline void BindVertexArray(unsigned int vao)
+{
+	static unsigned int bound = 0;
+	if (vao != bound)
+	{
+		glBindVertexArray(vao);
+		bound = vao;
+	}
+}
+
+// first-fit allocator of ranges in [0, capacity), coalescing freed neighbours
+class RangeAllocator
+{
+public:
+	RangeAllocator() : total(0) {}
+
+	size_t capacity() const { return total; }
+
+	bool allocate(size_t size, size_t alignment, size_t &offset)
+	{
+		for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it)
+		{
+			size_t start = (it->first + alignment - 1) / alignment * alignment;
+			size_t end = it->first + it->second;
+			if (start + size > end)
+				continue;
+			size_t rangeStart = it->first;
+			freeRanges.erase(it);
+			if (start > rangeStart)
+				freeRanges[rangeStart] = start - rangeStart;
+			if (end > start + size)
+				freeRanges[start + size] = end - start - size;
+			offset = start;
+			return true;
+		}
+		return false;
+	}
+
+	void free(size_t offset, size_t size)
+	{
+		if (size == 0)
+			return;
+		auto next = freeRanges.lower_bound(offset);
+		if (next != freeRanges.end() && offset + size == next->first)
+		{
+			size += next->second;
+			next = freeRanges.erase(next);
+		}
+		if (next != freeRanges.begin())
+		{
+			auto previous = std::prev(next);
+			if (previous->first + previous->second == offset)
+			{
+				previous->second += size;
+				return;
+			}
+		}
+		freeRanges[offset] = size;
+	}
+
+	void grow(size_t capacity)
+	{
+		if (capacity <= total)
+			return;
+		size_t added = capacity - total;
+		size_t offset = total;
+		total = capacity;
+		free(offset, added);
+	}
+
+private:
+	map<size_t, size_t> freeRanges;	// offset -> size
+	size_t total;
+};
+
+class GeometryArena;
+
+// where one mesh lives inside an arena
+struct GeometryRange {
+	GeometryArena *arena;
+	size_t firstVertex;		// base vertex of the mesh's draws
+	size_t vertexCount;
+	size_t indexOffset;		// in bytes
+	size_t indexBytes;
+
+	GeometryRange() : arena(nullptr), firstVertex(0), vertexCount(0), indexOffset(0), indexBytes(0) {}
+};
+
+class GeometryArena
+{
+public:
+	VertexLayout layout;
+	unsigned int VAO;
+
+	explicit GeometryArena(const VertexLayout &layout) : layout(layout), VAO(0), VBO(0), EBO(0)
+	{
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+		BindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, GEOMETRY_ARENA_INITIAL_BYTES / layout.stride * layout.stride, nullptr, GL_STATIC_DRAW);
+		vertices.grow(GEOMETRY_ARENA_INITIAL_BYTES / layout.stride);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, GEOMETRY_ARENA_INITIAL_BYTES, nullptr, GL_STATIC_DRAW);
+		indices.grow(GEOMETRY_ARENA_INITIAL_BYTES);
+		SetVertexAttributes(layout);
+	}
+
+	// copies a mesh's vertices (already in this arena's layout) and indices into the arena
+	bool upload(const void *vertexData, size_t vertexCount, const void *indexData, size_t indexBytes, size_t indexSize, GeometryRange &range)
+	{
+		size_t firstVertex, indexOffset;
+		while (!vertices.allocate(vertexCount, 1, firstVertex))
+			growVertices(vertexCount);
+		while (!indices.allocate(indexBytes, indexSize, indexOffset))
+			growIndices(indexBytes);
+
+		// uploads go through the copy targets so the currently bound VAO keeps its element buffer
+		glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, firstVertex * layout.stride, vertexCount * layout.stride, vertexData);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset, indexBytes, indexData);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		range.arena = this;
+		range.firstVertex = firstVertex;
+		range.vertexCount = vertexCount;
+		range.indexOffset = indexOffset;
+		range.indexBytes = indexBytes;
+		return true;
+	}
+
+	void release(const GeometryRange &range)
+	{
+		vertices.free(range.firstVertex, range.vertexCount);
+		indices.free(range.indexOffset, range.indexBytes);
+	}
+
+private:
+	unsigned int VBO, EBO;
+	RangeAllocator vertices;	// in vertices
+	RangeAllocator indices;		// in bytes
+
+	// replaces buffer with one of newSize bytes holding the same first oldSize bytes
+	static unsigned int resizeBuffer(unsigned int buffer, size_t oldSize, size_t newSize)
+	{
+		unsigned int resized;
+		glGenBuffers(1, &resized);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, resized);
+		glBufferData(GL_COPY_WRITE_BUFFER, newSize, nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &buffer);
+		return resized;
+	}
+
+	void growVertices(size_t needed)
+	{
+		size_t capacity = vertices.capacity();
+		size_t grown = capacity * 2 > capacity + needed ? capacity * 2 : capacity + needed;
+		VBO = resizeBuffer(VBO, capacity * layout.stride, grown * layout.stride);
+		vertices.grow(grown);
+		// the attribute pointers captured the old buffer
+		BindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		SetVertexAttributes(layout);
+	}
+
+	void growIndices(size_t needed)
+	{
+		size_t capacity = indices.capacity();
+		size_t grown = capacity * 2 > capacity + needed ? capacity * 2 : capacity + needed;
+		EBO = resizeBuffer(EBO, capacity, grown);
+		indices.grow(grown);
+		BindVertexArray(VAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	}
+};
+
+// the arenas of every vertex layout in use (GL thread only)
+class GeometryPool
+{
+public:
+	static GeometryPool& get()
+	{
+		static GeometryPool pool;
+		return pool;
+	}
+
+	GeometryArena& arena(const VertexLayout &layout)
+	{
+		for (const unique_ptr<GeometryArena> &arena : arenas)
+		{
+			const VertexLayout &other = arena->layout;
+			if (other.format == layout.format && other.halfTexCoords == layout.halfTexCoords && other.tangents == layout.tangents &&
+				other.occlusion == layout.occlusion)
+				return *arena;
+		}
+		arenas.push_back(unique_ptr<GeometryArena>(new GeometryArena(layout)));
+		return *arenas.back();
+	}
+
+	size_t arenaCount() const { return arenas.size(); }
+
+private:
+	vector<unique_ptr<GeometryArena> > arenas;
+
+	GeometryPool() {}
+};
+#endif
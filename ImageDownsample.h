@@ -0,0 +1,277 @@
+#ifndef IMAGE_DOWNSAMPLE_H
+#define IMAGE_DOWNSAMPLE_H
+
+#include "MipChain.h"
+#include "ThreadPool.h"
+
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+using namespace std;
+
+// Vectorized 2x2 box halving of 8 bit images, the same filter as DownsampleBox but fast enough to run on every load.
+// Samples are decoded through a table to 14 bit linear integers (sRGB color channels are linearized, alpha and linear
+// images are just rescaled), so the vertical and horizontal sums are plain 16 bit additions done 8 (SSE2) or 16 (AVX2)
+// at a time, and the sum of the four samples indexes a table that encodes it back to 8 bits.
+// AVX2 is picked at runtime when the CPU has it, SSE2 is the x86 baseline and other targets run the scalar loops.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define IMAGE_DOWNSAMPLE_SSE2
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define IMAGE_DOWNSAMPLE_AVX2
+#else
+#define IMAGE_DOWNSAMPLE_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+const unsigned int DOWNSAMPLE_LINEAR_MAX = 16383;	// 14 bits, so four samples still sum to a 16 bit value
+const int DOWNSAMPLE_PARALLEL_ROWS = 128;			// halvings to fewer rows than this many per thread stay on one thread
+
+class DownsampleTables
+{
+public:
+	static const DownsampleTables& get()
+	{
+		static DownsampleTables tables;
+		return tables;
+	}
+
+	uint16_t decode[2][256];							// [srgb][8 bit sample] -> linear 0..DOWNSAMPLE_LINEAR_MAX
+	unsigned char encode[2][4 * DOWNSAMPLE_LINEAR_MAX + 1];	// [srgb][sum of four linear samples] -> 8 bit sample
+	bool avx2;
+
+private:
+	DownsampleTables()
+	{
+		const SrgbTable &srgb = SrgbTable::get();
+		for (int i = 0; i < 256; i++)
+		{
+			decode[0][i] = (uint16_t)(i * DOWNSAMPLE_LINEAR_MAX / 255.0f + 0.5f);
+			decode[1][i] = (uint16_t)(srgb.toLinear((unsigned char)i) * DOWNSAMPLE_LINEAR_MAX + 0.5f);
+		}
+		for (unsigned int sum = 0; sum <= 4 * DOWNSAMPLE_LINEAR_MAX; sum++)
+		{
+			float value = sum / (4.0f * DOWNSAMPLE_LINEAR_MAX);
+			encode[0][sum] = (unsigned char)(value * 255.0f + 0.5f);
+			encode[1][sum] = srgb.toSrgb(value);
+		}
+		avx2 = cpuHasAvx2();
+	}
+
+	static bool cpuHasAvx2()
+	{
+#if defined(IMAGE_DOWNSAMPLE_SSE2) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 1);
+		bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		return osAvx && (info[1] & (1 << 5));
+#elif defined(IMAGE_DOWNSAMPLE_SSE2)
+		return __builtin_cpu_supports("avx2");
+#else
+		return false;
+#endif
+	}
+};
+
+// linearizes samples of one row. Like DownsampleBox, only the alpha of 4 channel images isn't color.
+inline void DecodeDownsampleRow(const unsigned char *src, size_t samples, int channels, bool srgb, uint16_t *dst)
+{
+	const DownsampleTables &tables = DownsampleTables::get();
+	const uint16_t *table[4];
+	for (int c = 0; c < 4; c++)
+		table[c] = tables.decode[srgb && !(channels == 4 && c == 3) ? 1 : 0];
+	for (size_t i = 0; i < samples; i += channels)
+		for (int c = 0; c < channels; c++)
+			dst[i + c] = table[c][src[i + c]];
+}
+
+inline void EncodeDownsampleRow(const uint16_t *sums, size_t samples, int channels, bool srgb, unsigned char *dst)
+{
+	const DownsampleTables &tables = DownsampleTables::get();
+	const unsigned char *table[4];
+	for (int c = 0; c < 4; c++)
+		table[c] = tables.encode[srgb && !(channels == 4 && c == 3) ? 1 : 0];
+	for (size_t i = 0; i < samples; i += channels)
+		for (int c = 0; c < channels; c++)
+			dst[i + c] = table[c][sums[i + c]];
+}
+
+#ifdef IMAGE_DOWNSAMPLE_SSE2
+IMAGE_DOWNSAMPLE_AVX2 inline size_t AddDownsampleRowsAvx2(const uint16_t *a, const uint16_t *b, size_t samples, uint16_t *out)
+{
+	size_t i = 0;
+	for (; i + 16 <= samples; i += 16)
+		_mm256_storeu_si256((__m256i*)(out + i), _mm256_add_epi16(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i))));
+	return i;
+}
+
+// pairs of RGBA pixels: 8 pixels in, 4 out per iteration. unpack interleaves 64 bit pixels within the 128 bit lanes,
+// the permute puts the four results back in order.
+IMAGE_DOWNSAMPLE_AVX2 inline size_t AddDownsamplePairs4Avx2(const uint16_t *row, size_t pairs, uint16_t *out)
+{
+	size_t x = 0;
+	for (; x + 4 <= pairs; x += 4)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(row + x * 8));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(row + x * 8 + 16));
+		__m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(a, b), _mm256_unpackhi_epi64(a, b));
+		_mm256_storeu_si256((__m256i*)(out + x * 4), _mm256_permute4x64_epi64(sum, 0xD8));
+	}
+	return x;
+}
+
+// pairs of single channel samples: 32 in, 16 out. Sums can reach 65532, so they are packed with signed saturation
+// after moving them down by 32768 and moved back up afterwards.
+IMAGE_DOWNSAMPLE_AVX2 inline size_t AddDownsamplePairs1Avx2(const uint16_t *row, size_t pairs, uint16_t *out)
+{
+	const __m256i low = _mm256_set1_epi32(0xffff), bias32 = _mm256_set1_epi32(32768), bias16 = _mm256_set1_epi16((short)0x8000);
+	size_t x = 0;
+	for (; x + 16 <= pairs; x += 16)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(row + x * 2));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(row + x * 2 + 16));
+		__m256i sa = _mm256_sub_epi32(_mm256_add_epi32(_mm256_and_si256(a, low), _mm256_srli_epi32(a, 16)), bias32);
+		__m256i sb = _mm256_sub_epi32(_mm256_add_epi32(_mm256_and_si256(b, low), _mm256_srli_epi32(b, 16)), bias32);
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(sa, sb), 0xD8);
+		_mm256_storeu_si256((__m256i*)(out + x), _mm256_add_epi16(packed, bias16));
+	}
+	return x;
+}
+#endif
+
+// out = a + b
+inline void AddDownsampleRows(const uint16_t *a, const uint16_t *b, size_t samples, uint16_t *out)
+{
+	size_t i = 0;
+#ifdef IMAGE_DOWNSAMPLE_SSE2
+	if (DownsampleTables::get().avx2)
+		i = AddDownsampleRowsAvx2(a, b, samples, out);
+	for (; i + 8 <= samples; i += 8)
+		_mm_storeu_si128((__m128i*)(out + i), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+#endif
+	for (; i < samples; i++)
+		out[i] = a[i] + b[i];
+}
+
+// sums horizontally neighbouring pixels: pixel x of out is pixels 2x and 2x + 1 of row. scratch holds a row.
+inline void AddDownsamplePairs(const uint16_t *row, size_t pairs, int channels, uint16_t *out, uint16_t *scratch)
+{
+	size_t x = 0;
+#ifdef IMAGE_DOWNSAMPLE_SSE2
+	bool avx2 = DownsampleTables::get().avx2;
+	if (channels == 4)
+	{
+		if (avx2)
+			x = AddDownsamplePairs4Avx2(row, pairs, out);
+		for (; x + 2 <= pairs; x += 2)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(row + x * 8));
+			__m128i b = _mm_loadu_si128((const __m128i*)(row + x * 8 + 8));
+			_mm_storeu_si128((__m128i*)(out + x * 4), _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b)));
+		}
+	}
+	else if (channels == 1)
+	{
+		if (avx2)
+			x = AddDownsamplePairs1Avx2(row, pairs, out);
+		const __m128i low = _mm_set1_epi32(0xffff), bias32 = _mm_set1_epi32(32768), bias16 = _mm_set1_epi16((short)0x8000);
+		for (; x + 8 <= pairs; x += 8)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i*)(row + x * 2));
+			__m128i b = _mm_loadu_si128((const __m128i*)(row + x * 2 + 8));
+			__m128i sa = _mm_sub_epi32(_mm_add_epi32(_mm_and_si128(a, low), _mm_srli_epi32(a, 16)), bias32);
+			__m128i sb = _mm_sub_epi32(_mm_add_epi32(_mm_and_si128(b, low), _mm_srli_epi32(b, 16)), bias32);
+			_mm_storeu_si128((__m128i*)(out + x), _mm_add_epi16(_mm_packs_epi32(sa, sb), bias16));
+		}
+	}
+	else
+	{
+		// RGB and gray/alpha pixels don't line up with the registers: every sample is added to the same sample of the
+		// next pixel over the whole row, then the sums of the even pixels are picked out
+		size_t samples = pairs * 2 * channels;
+		AddDownsampleRows(row, row + channels, samples - channels, scratch);
+		for (; x < pairs; x++)
+			memcpy(out + x * channels, scratch + x * 2 * channels, channels * sizeof(uint16_t));
+	}
+#endif
+	for (; x < pairs; x++)
+		for (int c = 0; c < channels; c++)
+			out[x * channels + c] = row[x * 2 * channels + c] + row[(x * 2 + 1) * channels + c];
+}
+
+// rows [firstRow, lastRow) of HalveImage
+inline void HalveImageRows(const unsigned char *src, int width, int height, int channels, bool srgb, unsigned char *dst, int firstRow, int lastRow)
+{
+	int dstWidth = width > 1 ? width / 2 : 1;
+	size_t rowSamples = (size_t)width * channels;
+	size_t dstSamples = (size_t)dstWidth * channels;
+	vector<uint16_t> buffer(rowSamples * 3 + dstSamples);
+	uint16_t *top = buffer.data(), *bottom = top + rowSamples, *sum = bottom + rowSamples, *out = sum + rowSamples;
+
+	for (int y = firstRow; y < lastRow; y++)
+	{
+		int y0 = y * 2 < height ? y * 2 : height - 1;
+		int y1 = y * 2 + 1 < height ? y * 2 + 1 : height - 1;
+		DecodeDownsampleRow(src + y0 * rowSamples, rowSamples, channels, srgb, top);
+		if (y1 != y0)
+			DecodeDownsampleRow(src + y1 * rowSamples, rowSamples, channels, srgb, bottom);
+		AddDownsampleRows(top, y1 != y0 ? bottom : top, rowSamples, sum);
+		if (width > 1)
+			AddDownsamplePairs(sum, dstWidth, channels, out, top);
+		else
+			AddDownsampleRows(sum, sum, dstSamples, out);
+		EncodeDownsampleRow(out, dstSamples, channels, srgb, dst + y * dstSamples);
+	}
+}
+
+// halves an image with a 2x2 box filter, with the same edge handling as DownsampleBox: odd edges drop their last
+// row/column, a single row/column is averaged with itself. dst gets (width / 2) * (height / 2) * channels bytes.
+// Large images are split into bands of rows filtered on threads of their own, unless this already runs on a pool worker.
+inline void HalveImage(const unsigned char *src, int width, int height, int channels, bool srgb, unsigned char *dst)
+{
+	int dstHeight = height > 1 ? height / 2 : 1;
+	unsigned int threads = std::thread::hardware_concurrency();
+	unsigned int bands = (unsigned int)(dstHeight / DOWNSAMPLE_PARALLEL_ROWS);
+	bands = bands < threads ? bands : threads;
+	if (bands < 2 || ThreadPool::onWorker())
+	{
+		HalveImageRows(src, width, height, channels, srgb, dst, 0, dstHeight);
+		return;
+	}
+	vector<std::thread> workers;
+	workers.reserve(bands - 1);
+	for (unsigned int band = 1; band < bands; band++)
+	{
+		int first = (int)((size_t)dstHeight * band / bands), last = (int)((size_t)dstHeight * (band + 1) / bands);
+		workers.push_back(std::thread(HalveImageRows, src, width, height, channels, srgb, dst, first, last));
+	}
+	HalveImageRows(src, width, height, channels, srgb, dst, 0, (int)(dstHeight / bands));
+	for (std::thread &worker : workers)
+		worker.join();
+}
+
+// halves the image until neither side exceeds maxSize. Returns false, leaving pixels empty, if it already fits.
+inline bool DownsampleToFit(const unsigned char *src, int &width, int &height, int channels, bool srgb, int maxSize, vector<unsigned char> &pixels)
+{
+	if (maxSize <= 0 || (width <= maxSize && height <= maxSize))
+		return false;
+	vector<unsigned char> previous;
+	while (width > maxSize || height > maxSize)
+	{
+		previous.swap(pixels);
+		int halfWidth = width > 1 ? width / 2 : 1;
+		int halfHeight = height > 1 ? height / 2 : 1;
+		pixels.resize((size_t)halfWidth * halfHeight * channels);
+		HalveImage(previous.empty() ? src : previous.data(), width, height, channels, srgb, pixels.data());
+		width = halfWidth;
+		height = halfHeight;
+	}
+	return true;
+}
+#endif
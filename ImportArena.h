@@ -0,0 +1,220 @@
+#ifndef IMPORT_ARENA_H
+#define IMPORT_ARENA_H
+
+#include <new>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cstddef>
+#include <cstdlib>
+using namespace std;
+
+// Scratch memory for model imports. The hash maps and temporary arrays of parsing, welding and simplifying used to
+// make one heap allocation per node and grow vector by vector; an ImportArena instead hands out memory from a few large
+// blocks by bumping a pointer, and frees all of it at once when the scope that marked it ends. Model::Import installs
+// one per import on the importing thread, containers using ArenaAllocator pick it up from there and fall back to the
+// heap where no arena is installed.
+const size_t IMPORT_ARENA_BLOCK_SIZE = 1024 * 1024;
+
+class ImportArena
+{
+public:
+	// position to rewind to, everything allocated after it is given back at once
+	struct Marker {
+		size_t block;
+		size_t used;
+		size_t base;
+	};
+
+	explicit ImportArena(size_t blockSize = IMPORT_ARENA_BLOCK_SIZE) : blockSize(blockSize), block(0), used(0), base(0), peak(0) {}
+
+	~ImportArena()
+	{
+		for (const Block &b : blocks)
+			::operator delete(b.data);
+	}
+
+	ImportArena(const ImportArena&) = delete;
+	ImportArena& operator=(const ImportArena&) = delete;
+
+	void* allocate(size_t bytes, size_t alignment)
+	{
+		if (bytes == 0)
+			bytes = 1;
+		while (true)
+		{
+			if (block < blocks.size())
+			{
+				size_t start = (used + alignment - 1) / alignment * alignment;
+				if (start + bytes <= blocks[block].size)
+				{
+					used = start + bytes;
+					peak = base + used > peak ? base + used : peak;
+					return blocks[block].data + start;
+				}
+				// the rest of this block is skipped, the next one (kept from before a rewind, or a new one) must fit
+				base += blocks[block].size;
+				block++;
+				used = 0;
+				if (block < blocks.size() && blocks[block].size >= bytes + alignment)
+					continue;
+			}
+			size_t size = bytes + alignment > blockSize ? bytes + alignment : blockSize;
+			Block added = { (unsigned char*)::operator new(size), size };
+			blocks.insert(blocks.begin() + block, added);
+		}
+	}
+
+	Marker mark() const
+	{
+		Marker marker = { block, used, base };
+		return marker;
+	}
+
+	// gives back everything allocated since marker was taken. The blocks stay around for the next allocations.
+	void rewind(const Marker &marker)
+	{
+		block = marker.block;
+		used = marker.used;
+		base = marker.base;
+	}
+
+	size_t peakBytes() const { return peak; }
+
+	size_t reservedBytes() const
+	{
+		size_t total = 0;
+		for (const Block &b : blocks)
+			total += b.size;
+		return total;
+	}
+
+	// the arena of the calling thread's import, null outside of one
+	static ImportArena*& current()
+	{
+		static thread_local ImportArena *arena = nullptr;
+		return arena;
+	}
+
+	// makes an arena the calling thread's current one for the lifetime of the scope
+	class Scope
+	{
+	public:
+		explicit Scope(ImportArena *arena) : previous(current()) { current() = arena; }
+		~Scope() { current() = previous; }
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	private:
+		ImportArena *previous;
+	};
+
+	// rewinds the current arena (if any) to where it was when the scope began
+	class Rewind
+	{
+	public:
+		Rewind() : arena(current())
+		{
+			if (arena)
+				marker = arena->mark();
+		}
+		~Rewind()
+		{
+			if (arena)
+				arena->rewind(marker);
+		}
+		Rewind(const Rewind&) = delete;
+		Rewind& operator=(const Rewind&) = delete;
+	private:
+		ImportArena *arena;
+		Marker marker;
+	};
+
+private:
+	struct Block {
+		unsigned char *data;
+		size_t size;
+	};
+	vector<Block> blocks;
+	size_t blockSize;
+	size_t block;	// the one being bumped
+	size_t used;	// bytes of it handed out
+	size_t base;	// bytes of the blocks before it
+	size_t peak;
+};
+
+// STL allocator drawing from the arena that was current when the container was created. Deallocation is a no-op
+// there, so containers have to be gone before the arena rewinds past them, and should be reserved up front where
+// possible since every regrowth leaves its old buffer behind until then.
+template <typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	ArenaAllocator() : arena(ImportArena::current()) {}
+	explicit ArenaAllocator(ImportArena *arena) : arena(arena) {}
+	template <typename U> ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+	T* allocate(size_t n)
+	{
+		if (arena)
+			return (T*)arena->allocate(n * sizeof(T), alignof(T));
+		return (T*)::operator new(n * sizeof(T));
+	}
+
+	void deallocate(T *p, size_t)
+	{
+		if (!arena)
+			::operator delete(p);
+	}
+
+	ImportArena *arena;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena == b.arena; }
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) { return a.arena != b.arena; }
+
+// import scratch containers
+template <typename T>
+using ScratchVector = vector<T, ArenaAllocator<T> >;
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename Equal = std::equal_to<Key> >
+using ScratchMap = unordered_map<Key, Value, Hash, Equal, ArenaAllocator<std::pair<const Key, Value> > >;
+
+// Counts the heap allocations made while it is installed on a thread (see Scope), so an import can report its
+// allocation churn. Worker threads helping with an import install the same counter.
+// The counting is done by replacing the global allocation functions, which AllocationCounter.cpp only does in builds
+// with PIANO_COUNT_ALLOCATIONS defined, since every allocation of the process goes through them; otherwise the
+// counters stay at 0.
+#ifdef PIANO_COUNT_ALLOCATIONS
+const bool COUNT_ALLOCATIONS = true;
+#else
+const bool COUNT_ALLOCATIONS = false;
+#endif
+
+struct AllocationCounter {
+	std::atomic<size_t> allocations;
+	std::atomic<size_t> bytes;
+
+	AllocationCounter() : allocations(0), bytes(0) {}
+
+	static AllocationCounter*& current()
+	{
+		static thread_local AllocationCounter *counter = nullptr;
+		return counter;
+	}
+
+	class Scope
+	{
+	public:
+		explicit Scope(AllocationCounter *counter) : previous(current()) { current() = counter; }
+		~Scope() { current() = previous; }
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+	private:
+		AllocationCounter *previous;
+	};
+};
+#endif
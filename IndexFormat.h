@@ -0,0 +1,62 @@
+#ifndef INDEX_FORMAT_H
+#define INDEX_FORMAT_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+// Meshes are imported with 32-bit indices but uploaded with the narrowest type that can address all their vertices.
+// 8-bit indices are off by default: most desktop GPUs don't fetch them natively and the driver converts them
+// to 16 bit behind our back, which costs more than the few bytes saved.
+const bool MESH_BYTE_INDICES = false;
+
+inline GLenum ChooseIndexType(size_t vertexCount, bool allowBytes = MESH_BYTE_INDICES)
+{
+	if (allowBytes && vertexCount <= 0x100)
+		return GL_UNSIGNED_BYTE;
+	if (vertexCount <= 0x10000)
+		return GL_UNSIGNED_SHORT;
+	return GL_UNSIGNED_INT;
+}
+
+inline unsigned int IndexSize(GLenum type)
+{
+	if (type == GL_UNSIGNED_BYTE)
+		return 1;
+	if (type == GL_UNSIGNED_SHORT)
+		return 2;
+	return 4;
+}
+
+// one level of detail of a mesh: a range of its index buffer and the largest geometric error (in object space)
+// drawing it instead of the full resolution range introduces
+struct MeshLod {
+	uint32_t indexOffset;
+	uint32_t indexCount;
+	float error;
+};
+
+// narrows 32-bit indices to type, out receives count * IndexSize(type) bytes
+inline void PackIndices(const unsigned int *indices, size_t count, GLenum type, vector<unsigned char> &out)
+{
+	out.resize(count * IndexSize(type));
+	if (type == GL_UNSIGNED_INT)
+	{
+		memcpy(out.data(), indices, out.size());
+		return;
+	}
+	for (size_t i = 0; i < count; i++)
+	{
+		if (type == GL_UNSIGNED_BYTE)
+			out[i] = (unsigned char)indices[i];
+		else
+		{
+			uint16_t value = (uint16_t)indices[i];
+			memcpy(&out[i * 2], &value, 2);
+		}
+	}
+}
+#endif
@@ -0,0 +1,123 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. The mapping lives as long as the object does,
+// so pointers handed out by data() must not outlive it.
+class MappedFile
+{
+public:
+	MappedFile() : ptr(nullptr), length(0)
+#ifdef _WIN32
+		, file(INVALID_HANDLE_VALUE), mapping(NULL)
+#endif
+	{
+	}
+
+	explicit MappedFile(const std::string &path) : MappedFile()
+	{
+		open(path);
+	}
+
+	~MappedFile()
+	{
+		close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// maps the file at path, returns false if it doesn't exist or is empty
+	bool open(const std::string &path)
+	{
+		close();
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+		{
+			close();
+			return false;
+		}
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL)
+		{
+			close();
+			return false;
+		}
+		ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (ptr == nullptr)
+		{
+			close();
+			return false;
+		}
+		length = (size_t)size.QuadPart;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void *mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		// the mapping keeps its own reference to the file
+		::close(fd);
+		if (mapped == MAP_FAILED)
+			return false;
+		ptr = mapped;
+		length = (size_t)st.st_size;
+#endif
+		return true;
+	}
+
+	void close()
+	{
+#ifdef _WIN32
+		if (ptr)
+			UnmapViewOfFile(ptr);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (ptr)
+			munmap(ptr, length);
+#endif
+		ptr = nullptr;
+		length = 0;
+	}
+
+	bool isOpen() const { return ptr != nullptr; }
+	const unsigned char* data() const { return (const unsigned char*)ptr; }
+	size_t size() const { return length; }
+
+private:
+	void *ptr;
+	size_t length;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+#endif
@@ -7,6 +7,11 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "Shader.h"
+#include "TextureRegistry.h"
+#include "TextureArrays.h"
+#include "VertexFormat.h"
+#include "IndexFormat.h"
+#include "GeometryPool.h"
 
 #include <string>
 #include <fstream>
@@ -15,54 +20,137 @@
 #include <vector>
 using namespace std;
 
-struct Vertex {
-	// position
-	glm::vec3 Position;
-	// normal
-	glm::vec3 Normal;
-	// texCoords
-	glm::vec2 TexCoords;
-	// tangent
-	glm::vec3 Tangent;
-	// bitangent
-	glm::vec3 Bitangent;
-};
-
 struct Texture {
 	unsigned int id;
 	string type;
 	string path;
+	TextureHandle handle;	// keeps the shared GL texture alive, empty for references that weren't loaded yet
+};
+
+// Geometry and material references of one mesh before it reaches the GPU, so importing can happen off the GL thread.
+// The arrays are either owned (vertices/indices) or point into memory that outlives the MeshData, like a mapped mesh cache.
+struct MeshData {
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	const Vertex *mappedVertices;
+	unsigned int mappedVertexCount;
+	const unsigned int *mappedIndices;
+	unsigned int mappedIndexCount;
+	vector<Texture> textures;	// texture ids aren't assigned yet
+	vector<MeshLod> lods;		// index ranges of the level of detail chain, empty if the mesh has none
+
+	MeshData() : mappedVertices(nullptr), mappedVertexCount(0), mappedIndices(nullptr), mappedIndexCount(0) {}
+
+	bool isMapped() const { return mappedVertices != nullptr; }
+	const Vertex* vertexData() const { return isMapped() ? mappedVertices : vertices.data(); }
+	unsigned int vertexCount() const { return isMapped() ? mappedVertexCount : (unsigned int)vertices.size(); }
+	const unsigned int* indexData() const { return isMapped() ? mappedIndices : indices.data(); }
+	unsigned int indexCount() const { return isMapped() ? mappedIndexCount : (unsigned int)indices.size(); }
+};
+
+// View parameters used to pick mesh levels of detail, set once per frame. A mesh draws the coarsest level whose error,
+// projected to the screen, stays below pixelThreshold.
+struct LodSettings {
+	bool enabled;
+	glm::vec3 cameraPosition;
+	float projectionScale;	// pixels covered by one unit at distance one: viewport height / (2 * tan(fovy / 2))
+	float pixelThreshold;
+
+	static LodSettings& get()
+	{
+		static LodSettings settings = { false, glm::vec3(0.0f), 1.0f, 1.0f };
+		return settings;
+	}
+
+	void update(const glm::vec3 &position, float fovy, float viewportHeight, float threshold)
+	{
+		enabled = true;
+		cameraPosition = position;
+		projectionScale = viewportHeight / (2.0f * std::tan(fovy * 0.5f));
+		pixelThreshold = threshold;
+	}
 };
 
 class Mesh {
 public:
 	/*  Mesh Data  */
-	vector<Vertex> vertices;
+	vector<Vertex> vertices;	// CPU copy of the geometry, empty unless the owning Model's residency keeps or paged it in
 	vector<unsigned int> indices;
 	vector<Texture> textures;
 	unsigned int VAO;
+	unsigned int vertexCount;
+	unsigned int indexCount;
+	GLenum indexType;			// narrowest type that addresses every vertex, see ChooseIndexType
+	GLenum mode;				// GL_TRIANGLES for everything the importer produces
+	VertexLayout layout;
+	vector<MeshLod> lods;		// level 0 is the full mesh, empty if there's no chain
+	glm::vec3 boundsCenter;		// bounding sphere in object space
+	float boundsRadius;
+	GeometryRange geometry;		// where the mesh lives in the shared geometry pool, arena is null if it has its own buffers
+	MaterialLayers materialLayers;	// layers of its maps if they were packed into texture arrays, see PackMaterialTextures
 
 	/*  Functions  */
-	// constructor
-	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+	// constructor, takes over the imported vectors instead of copying them
+	Mesh(vector<Vertex> &&vertices, vector<unsigned int> &&indices, vector<Texture> &&textures, VertexFormat format = VERTEX_PACKED)
+		: vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures))
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
+		this->indexCount = this->indices.size();
+		this->mode = GL_TRIANGLES;
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size(), format);
+	}
+
+	// constructor for geometry that already sits in memory in its final layout (e.g. a mapped mesh cache).
+	// The data is uploaded straight from the given pointers and no CPU-side copy is kept, so vertices and indices stay empty.
+	Mesh(const Vertex *vertexData, unsigned int vertexCount, const unsigned int *indexData, unsigned int indexCount, vector<Texture> &&textures,
+		VertexFormat format = VERTEX_PACKED) : textures(std::move(textures))
+	{
+		this->indexCount = indexCount;
+		this->mode = GL_TRIANGLES;
+
+		setupMesh(vertexData, vertexCount, indexData, indexCount, format);
+	}
+
+	// picks the level of detail for drawing with the given model matrix, see LodSettings
+	unsigned int selectLod(const glm::mat4 &model) const
+	{
+		const LodSettings &settings = LodSettings::get();
+		if (!settings.enabled || lods.size() < 2)
+			return 0;
+		float scale = 0.0f;
+		for (int i = 0; i < 3; i++)
+			scale = glm::max(scale, glm::length(glm::vec3(model[i])));
+		glm::vec3 center = glm::vec3(model * glm::vec4(boundsCenter, 1.0f));
+		float distance = glm::length(settings.cameraPosition - center) - boundsRadius * scale;
+		if (distance <= 0.0f)
+			return 0;
+		for (unsigned int level = (unsigned int)lods.size() - 1; level > 0; level--)
+		{
+			if (lods[level].error * scale / distance * settings.projectionScale <= settings.pixelThreshold)
+				return level;
+		}
+		return 0;
 	}
 
 	// render the mesh
-	void Draw(Shader shader)
+	void Draw(const Shader &shader, unsigned int lod = 0)
 	{
+		// packed maps: the arrays usually are still bound from the previous mesh, only the layers change
+		bool packed = materialLayers.packed();
+		glUniform1i(shader.uniformLocation("materialArrays"), (int)packed);
+		if (packed)
+		{
+			materialLayers.bind();
+			glUniform2f(shader.uniformLocation("materialLayers"), (float)materialLayers.layers[0], (float)materialLayers.layers[1]);
+		}
+
 		// bind appropriate textures
 		unsigned int diffuseNr = 1;
 		unsigned int specularNr = 1;
 		unsigned int normalNr = 1;
 		unsigned int heightNr = 1;
-		for (unsigned int i = 0; i < textures.size(); i++)
+		for (unsigned int i = 0; !packed && i < textures.size(); i++)
 		{
 			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
 											  // retrieve texture number (the N in diffuse_textureN)
@@ -84,56 +172,142 @@ public:
 		}
 
 		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		BindVertexArray(VAO);
+		// generic attribute values are context state, so meshes without baked occlusion reset it for themselves
+		if (!layout.occlusion)
+			glVertexAttrib1f(VERTEX_OCCLUSION_ATTRIBUTE, 1.0f);
+		unsigned int first = 0, count = indexCount;
+		if (lod < lods.size())
+		{
+			first = lods[lod].indexOffset;
+			count = lods[lod].indexCount;
+		}
+		if (geometry.arena)
+		{
+			// pooled meshes share the arena's VAO, which stays bound for the next mesh of the same layout
+			glDrawElementsBaseVertex(mode, count, indexType, (void*)(uintptr_t)(geometry.indexOffset + first * IndexSize(indexType)),
+				(GLint)geometry.firstVertex);
+		}
+		else
+		{
+			glDrawElements(mode, count, indexType, (void*)(uintptr_t)(first * IndexSize(indexType)));
+			BindVertexArray(0);
+		}
 
 		// always good practice to set everything back to defaults once configured.
 		glActiveTexture(GL_TEXTURE0);
 	}
 
+	bool hasGeometryData() const { return !vertices.empty(); }
+
+	// frees the CPU copy of the geometry, drawing only needs the GPU side
+	void releaseGeometryData()
+	{
+		vector<Vertex>().swap(vertices);
+		vector<unsigned int>().swap(indices);
+	}
+
+	// bytes of geometry held in CPU memory
+	size_t cpuBytes() const
+	{
+		return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int) + lods.capacity() * sizeof(MeshLod);
+	}
+
+	// bytes of geometry in the vertex and index buffers
+	size_t gpuBytes() const
+	{
+		return (size_t)vertexCount * layout.stride + (size_t)indexCount * IndexSize(indexType);
+	}
+
+	// deletes the GL objects. Meshes are copied around by value, so this is explicit rather than a destructor.
+	void release()
+	{
+		if (geometry.arena)
+			geometry.arena->release(geometry);
+		else
+		{
+			glDeleteVertexArrays(1, &VAO);
+			glDeleteBuffers(1, &VBO);
+			glDeleteBuffers(1, &EBO);
+		}
+		geometry = GeometryRange();
+		VAO = VBO = EBO = 0;
+	}
+
 private:
 	/*  Render data  */
 	unsigned int VBO, EBO;
 
 	/*  Functions    */
 	// initializes all the buffer objects/arrays
-	void setupMesh()
+	void setupMesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount, VertexFormat format)
 	{
+		// tangents are only worth their bytes if there's a normal map to use them with
+		bool normalMapped = false;
+		for (unsigned int i = 0; i < textures.size(); i++)
+			normalMapped = normalMapped || textures[i].type == "texture_normal";
+		layout = ChooseVertexLayout(format, vertexData, vertexCount, normalMapped);
+		this->vertexCount = (unsigned int)vertexCount;
+		computeBounds(vertexData, vertexCount);
+
+		// A great thing about structs is that their memory layout is sequential for all its items.
+		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+		// again translates to 3/2 floats which translates to a byte array.
+		vector<unsigned char> packed;
+		const void *vertexBytes = vertexData;
+		if (layout.format != VERTEX_FULL)
+		{
+			PackVertices(vertexData, vertexCount, layout, packed);
+			vertexBytes = packed.data();
+		}
+		indexType = ChooseIndexType(vertexCount);
+		vector<unsigned char> narrowed;
+		const void *indexBytes = indexData;
+		if (indexType != GL_UNSIGNED_INT)
+		{
+			PackIndices(indexData, indexCount, indexType, narrowed);
+			indexBytes = narrowed.data();
+		}
+
+		VBO = EBO = 0;
+		if (MESH_GEOMETRY_POOL)
+		{
+			GeometryArena &arena = GeometryPool::get().arena(layout);
+			arena.upload(vertexBytes, vertexCount, indexBytes, indexCount * IndexSize(indexType), IndexSize(indexType), geometry);
+			VAO = arena.VAO;
+			return;
+		}
+
 		// create buffers/arrays
 		glGenVertexArrays(1, &VAO);
 		glGenBuffers(1, &VBO);
 		glGenBuffers(1, &EBO);
 
-		glBindVertexArray(VAO);
+		BindVertexArray(VAO);
 		// load data into vertex buffers
 		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		// A great thing about structs is that their memory layout is sequential for all its items.
-		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
+		glBufferData(GL_ARRAY_BUFFER, vertexCount * layout.stride, vertexBytes, GL_STATIC_DRAW);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * IndexSize(indexType), indexBytes, GL_STATIC_DRAW);
 
 		// set the vertex attribute pointers
-		// vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-		// vertex normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-		// vertex texture coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-		// vertex tangent
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-		// vertex bitangent
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-
-		glBindVertexArray(0);
+		SetVertexAttributes(layout);
+
+		BindVertexArray(0);
+	}
+
+	void computeBounds(const Vertex *vertexData, size_t vertexCount)
+	{
+		glm::vec3 low(0.0f), high(0.0f);
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			low = i == 0 ? vertexData[i].Position : glm::min(low, vertexData[i].Position);
+			high = i == 0 ? vertexData[i].Position : glm::max(high, vertexData[i].Position);
+		}
+		boundsCenter = (low + high) * 0.5f;
+		boundsRadius = 0.0f;
+		for (size_t i = 0; i < vertexCount; i++)
+			boundsRadius = glm::max(boundsRadius, glm::distance(boundsCenter, vertexData[i].Position));
 	}
 };
 #endif
\ No newline at end of file
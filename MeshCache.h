@@ -0,0 +1,237 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "Mesh.h"
+#include "MappedFile.h"
+#include "ContentHash.h"
+#include "StartupTracer.h"
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+using namespace std;
+
+// Baked binary copy of everything Model::processMesh produces for one model file, so that warm starts
+// don't have to run the OBJ importer at all. Layout (all little-endian, 4-byte aligned):
+//   header   : MeshCacheHeader
+//   per mesh : MeshCacheRecord, MeshLod[lodCount], Vertex[vertexCount], uint32[indexCount],
+//              textureCount * (uint32 typeLength, type, uint32 pathLength, path, padding to 4)
+// The file is meant to be memory-mapped, the vertex/index arrays are handed to glBufferData in place.
+
+const uint32_t MESH_CACHE_MAGIC = 0x31434d50; // "PMC1"
+const uint32_t MESH_CACHE_VERSION = 5;	// 2: real tangents instead of copies of the normal, 3: optimized meshes, 4: LOD chains,
+										// 5: baked ambient occlusion
+const uint64_t MESH_CACHE_ANY_SOURCE = 0;	// accept a cache whatever it was baked from (archived caches ship without their source)
+
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash;
+	uint32_t vertexSize;
+	uint32_t meshCount;
+};
+
+struct MeshCacheRecord {
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t textureCount;
+	uint32_t lodCount;
+};
+
+class MeshCache
+{
+public:
+	// where the cache for a given model file lives
+	static string cachePath(const string &sourcePath)
+	{
+		return sourcePath + ".meshcache";
+	}
+
+	// FNV-1a over the model file and every material library it references, so editing a .mtl invalidates the cache as well.
+	// Returns 0 if the source can't be read.
+	static uint64_t hashSource(const string &sourcePath)
+	{
+		MappedFile source;
+		if (!source.open(sourcePath))
+			return 0;
+		uint64_t hash = HashBytes(source.data(), source.size());
+		for (const string &library : materialLibraries(sourcePath, source))
+		{
+			MappedFile material;
+			if (material.open(library))
+				hash = HashBytes(material.data(), material.size(), hash);
+		}
+		return hash;
+	}
+
+	// the model file followed by the material libraries it references, i.e. every file its cache depends on
+	static vector<string> sourceFiles(const string &sourcePath)
+	{
+		vector<string> files(1, sourcePath);
+		MappedFile source;
+		if (source.open(sourcePath))
+		{
+			vector<string> libraries = materialLibraries(sourcePath, source);
+			files.insert(files.end(), libraries.begin(), libraries.end());
+		}
+		return files;
+	}
+
+	// parses a cache file held in memory (mapped or read from the asset archive) into MeshData views of that memory,
+	// which are only valid while it stays around.
+	// Fails (without touching out) if the file is truncated, from another version or was baked from a different source.
+	static bool read(const unsigned char *data, size_t size, uint64_t sourceHash, vector<MeshData> &out)
+	{
+		TRACE_SCOPE("import", "read mesh cache");
+		if (!data || size < sizeof(MeshCacheHeader))
+			return false;
+		MeshCacheHeader header;
+		memcpy(&header, data, sizeof(header));
+		if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION || header.vertexSize != sizeof(Vertex) ||
+			(sourceHash != MESH_CACHE_ANY_SOURCE && header.sourceHash != sourceHash))
+			return false;
+
+		// counts are checked against the bytes left before anything is allocated for them
+		if (header.meshCount > (size - sizeof(MeshCacheHeader)) / sizeof(MeshCacheRecord))
+			return false;
+		vector<MeshData> meshes;
+		meshes.reserve(header.meshCount);
+		size_t offset = sizeof(MeshCacheHeader);
+		for (uint32_t i = 0; i < header.meshCount; i++)
+		{
+			MeshCacheRecord record;
+			if (!readBytes(data, size, offset, &record, sizeof(record)))
+				return false;
+			if (record.lodCount > (size - offset) / sizeof(MeshLod))
+				return false;
+			MeshData mesh;
+			mesh.lods.resize(record.lodCount);
+			if (record.lodCount > 0 && !readBytes(data, size, offset, mesh.lods.data(), record.lodCount * sizeof(MeshLod)))
+				return false;
+			mesh.mappedVertexCount = record.vertexCount;
+			mesh.mappedIndexCount = record.indexCount;
+			if (size - offset < (size_t)record.vertexCount * sizeof(Vertex))
+				return false;
+			mesh.mappedVertices = (const Vertex*)(data + offset);
+			offset += (size_t)record.vertexCount * sizeof(Vertex);
+			if (size - offset < (size_t)record.indexCount * sizeof(unsigned int))
+				return false;
+			mesh.mappedIndices = (const unsigned int*)(data + offset);
+			offset += (size_t)record.indexCount * sizeof(unsigned int);
+			for (uint32_t t = 0; t < record.textureCount; t++)
+			{
+				Texture texture;
+				texture.id = 0;
+				if (!readString(data, size, offset, texture.type) || !readString(data, size, offset, texture.path))
+					return false;
+				mesh.textures.push_back(texture);
+			}
+			meshes.push_back(std::move(mesh));
+		}
+		out.swap(meshes);
+		return true;
+	}
+
+	// writes the meshes of a freshly imported model. The file is written under a temporary name first so
+	// a crash mid-write never leaves a half-baked cache behind.
+	static bool write(const string &path, uint64_t sourceHash, const vector<MeshData> &meshes)
+	{
+		string tmpPath = path + ".tmp";
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+
+		MeshCacheHeader header;
+		header.magic = MESH_CACHE_MAGIC;
+		header.version = MESH_CACHE_VERSION;
+		header.sourceHash = sourceHash;
+		header.vertexSize = sizeof(Vertex);
+		header.meshCount = (uint32_t)meshes.size();
+		file.write((const char*)&header, sizeof(header));
+
+		for (const MeshData &mesh : meshes)
+		{
+			MeshCacheRecord record;
+			record.vertexCount = mesh.vertexCount();
+			record.indexCount = mesh.indexCount();
+			record.textureCount = (uint32_t)mesh.textures.size();
+			record.lodCount = (uint32_t)mesh.lods.size();
+			file.write((const char*)&record, sizeof(record));
+			file.write((const char*)mesh.lods.data(), record.lodCount * sizeof(MeshLod));
+			file.write((const char*)mesh.vertexData(), (size_t)record.vertexCount * sizeof(Vertex));
+			file.write((const char*)mesh.indexData(), (size_t)record.indexCount * sizeof(unsigned int));
+			for (const Texture &texture : mesh.textures)
+			{
+				writeString(file, texture.type);
+				writeString(file, texture.path);
+			}
+		}
+		file.close();
+		if (!file)
+			return false;
+		std::remove(path.c_str());
+		return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+	}
+
+private:
+	// paths of the mtllib statements of a mapped OBJ file
+	static vector<string> materialLibraries(const string &sourcePath, const MappedFile &source)
+	{
+		vector<string> libraries;
+		string directory = sourcePath.substr(0, sourcePath.find_last_of('/'));
+		const char *text = (const char*)source.data();
+		size_t size = source.size();
+		for (size_t pos = 0; pos < size; )
+		{
+			size_t end = pos;
+			while (end < size && text[end] != '\n')
+				end++;
+			if (end - pos > 7 && strncmp(text + pos, "mtllib ", 7) == 0)
+			{
+				string library(text + pos + 7, end - pos - 7);
+				while (!library.empty() && (library.back() == '\r' || library.back() == ' '))
+					library.pop_back();
+				libraries.push_back(directory + '/' + library);
+			}
+			pos = end + 1;
+		}
+		return libraries;
+	}
+
+	static bool readBytes(const unsigned char *data, size_t size, size_t &offset, void *dst, size_t count)
+	{
+		if (size - offset < count)
+			return false;
+		memcpy(dst, data + offset, count);
+		offset += count;
+		return true;
+	}
+
+	static bool readString(const unsigned char *data, size_t size, size_t &offset, string &out)
+	{
+		uint32_t length;
+		if (!readBytes(data, size, offset, &length, sizeof(length)))
+			return false;
+		size_t padded = ((size_t)length + 3) & ~(size_t)3;
+		if (size - offset < padded)
+			return false;
+		out.assign((const char*)data + offset, length);
+		offset += padded;
+		return true;
+	}
+
+	static void writeString(std::ofstream &file, const string &value)
+	{
+		static const char padding[4] = { 0, 0, 0, 0 };
+		uint32_t length = (uint32_t)value.size();
+		file.write((const char*)&length, sizeof(length));
+		file.write(value.data(), length);
+		file.write(padding, ((length + 3) & ~3u) - length);
+	}
+};
+#endif
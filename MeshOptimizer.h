@@ -0,0 +1,320 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include "VertexFormat.h"
+#include "ContentHash.h"
+#include "ImportArena.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+using namespace std;
+
+// Import-time optimization of triangle lists, run once before a mesh goes into the mesh cache:
+//   1. weld     - vertices that are bitwise identical are merged (OBJ import gives every face corner its own vertex)
+//   2. cache    - triangles are reordered for the post-transform vertex cache (Forsyth's linear-speed algorithm)
+//   3. overdraw - clusters of the cache-ordered list are sorted so outward facing ones come first, as long as that
+//                 keeps the ACMR within MESH_OVERDRAW_THRESHOLD of the cache-optimal order (Sander et al.)
+//   4. fetch    - vertices are renumbered in order of first use so the vertex fetch walks the VBO linearly
+// ACMR (average cache miss ratio) is the number of vertex shader invocations per triangle on a FIFO cache;
+// 3.0 is the worst case, around 0.6-0.7 is what a good order gets on regular meshes.
+
+const unsigned int MESH_CACHE_SIZE = 32;		// LRU size the Forsyth scoring is tuned for
+const unsigned int MESH_FIFO_SIZE = 16;			// FIFO size ACMR is measured with
+const float MESH_OVERDRAW_THRESHOLD = 1.05f;
+
+struct MeshOptimizeStats {
+	size_t verticesBefore;
+	size_t verticesAfter;
+	float acmrBefore;
+	float acmrAfter;
+};
+
+// vertex shader invocations per triangle for a FIFO cache of the given size
+inline float ComputeACMR(const vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize = MESH_FIFO_SIZE)
+{
+	if (indices.size() < 3)
+		return 0.0f;
+	vector<unsigned int> timestamp(vertexCount, 0);
+	unsigned int time = cacheSize + 1;
+	size_t misses = 0;
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		unsigned int v = indices[i];
+		if (time - timestamp[v] > cacheSize)
+		{
+			timestamp[v] = time++;
+			misses++;
+		}
+	}
+	return (float)misses / (indices.size() / 3);
+}
+
+// merges bitwise identical vertices and rewrites the indices accordingly
+inline void WeldVertices(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+	struct VertexHash {
+		size_t operator()(const Vertex &v) const { return (size_t)HashBytes((const unsigned char*)&v, sizeof(Vertex)); }
+	};
+	struct VertexEqual {
+		bool operator()(const Vertex &a, const Vertex &b) const { return memcmp(&a, &b, sizeof(Vertex)) == 0; }
+	};
+	ScratchMap<Vertex, unsigned int, VertexHash, VertexEqual> unique;
+	unique.reserve(vertices.size());
+	ScratchVector<unsigned int> remap(vertices.size());
+	vector<Vertex> welded;
+	welded.reserve(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		auto inserted = unique.insert(std::make_pair(vertices[i], (unsigned int)welded.size()));
+		if (inserted.second)
+			welded.push_back(vertices[i]);
+		remap[i] = inserted.first->second;
+	}
+	for (size_t i = 0; i < indices.size(); i++)
+		indices[i] = remap[indices[i]];
+	vertices.swap(welded);
+}
+
+// Forsyth vertex score: recently used vertices score high (the last triangle's three equally), and vertices with
+// few triangles left score higher so the algorithm finishes off regions instead of leaving single triangles behind
+inline float ForsythVertexScore(int cachePosition, unsigned int remainingTriangles)
+{
+	if (remainingTriangles == 0)
+		return -1.0f;
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		if (cachePosition < 3)
+			score = 0.75f;
+		else
+			score = std::pow(1.0f - (float)(cachePosition - 3) / (MESH_CACHE_SIZE - 3), 1.5f);
+	}
+	return score + 2.0f / std::sqrt((float)remainingTriangles);
+}
+
+// reorders triangles for post-transform vertex cache hits
+inline void OptimizeVertexCache(vector<unsigned int> &indices, size_t vertexCount)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	// triangles around every vertex
+	ScratchVector<unsigned int> remaining(vertexCount, 0);
+	for (size_t i = 0; i < indices.size(); i++)
+		remaining[indices[i]]++;
+	ScratchVector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+	ScratchVector<unsigned int> adjacency(indices.size());
+	ScratchVector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+		adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+	ScratchVector<int> cachePosition(vertexCount, -1);
+	ScratchVector<float> vertexScore(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		vertexScore[v] = ForsythVertexScore(-1, remaining[v]);
+	ScratchVector<char> emitted(triangleCount, 0);
+
+	unsigned int cache[MESH_CACHE_SIZE + 3];
+	unsigned int cacheCount = 0;
+	vector<unsigned int> result;
+	result.reserve(indices.size());
+
+	// start with the best triangle overall
+	size_t best = 0;
+	float bestScore = -1.0f;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+		if (score > bestScore)
+		{
+			bestScore = score;
+			best = t;
+		}
+	}
+
+	size_t cursor = 0;
+	for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+	{
+		if (bestScore < 0.0f)
+		{
+			// nothing in the cache has triangles left, continue with the next unused triangle in input order
+			while (emitted[cursor])
+				cursor++;
+			best = cursor;
+		}
+		emitted[best] = 1;
+		const unsigned int *triangle = &indices[best * 3];
+		result.insert(result.end(), triangle, triangle + 3);
+
+		// the triangle's vertices move to the front of the LRU cache
+		unsigned int newCache[MESH_CACHE_SIZE + 6];
+		unsigned int newCount = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			remaining[triangle[k]]--;
+			newCache[newCount++] = triangle[k];
+		}
+		for (unsigned int i = 0; i < cacheCount; i++)
+		{
+			unsigned int v = cache[i];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				newCache[newCount++] = v;
+		}
+		for (unsigned int i = 0; i < newCount; i++)
+		{
+			unsigned int v = newCache[i];
+			cachePosition[v] = i < MESH_CACHE_SIZE ? (int)i : -1;
+			vertexScore[v] = ForsythVertexScore(cachePosition[v], remaining[v]);
+		}
+		cacheCount = newCount < MESH_CACHE_SIZE ? newCount : MESH_CACHE_SIZE;
+		memcpy(cache, newCache, cacheCount * sizeof(unsigned int));
+
+		// next triangle is the best one touching the cache
+		bestScore = -1.0f;
+		for (unsigned int i = 0; i < cacheCount; i++)
+		{
+			unsigned int v = cache[i];
+			for (unsigned int a = offsets[v]; a < offsets[v + 1]; a++)
+			{
+				unsigned int t = adjacency[a];
+				if (emitted[t])
+					continue;
+				float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+				if (score > bestScore)
+				{
+					bestScore = score;
+					best = t;
+				}
+			}
+		}
+	}
+	indices.swap(result);
+}
+
+// sorts clusters of a cache-optimized triangle list front to back-ish: clusters whose normal points away from the mesh
+// center are likely to occlude the rest and go first. Clusters start where the FIFO cache runs cold anyway (a triangle
+// with three misses), so the ACMR barely moves; if it still gets worse than threshold allows the order is left alone.
+inline void OptimizeOverdraw(vector<unsigned int> &indices, const vector<Vertex> &vertices, float threshold = MESH_OVERDRAW_THRESHOLD)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount < 2)
+		return;
+
+	struct Cluster {
+		size_t begin;
+		size_t end;
+		float sortKey;
+	};
+	vector<Cluster> clusters;
+	vector<unsigned int> timestamp(vertices.size(), 0);
+	unsigned int time = MESH_FIFO_SIZE + 1;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int v = indices[t * 3 + k];
+			if (time - timestamp[v] > MESH_FIFO_SIZE)
+			{
+				timestamp[v] = time++;
+				misses++;
+			}
+		}
+		if (t == 0 || misses == 3)
+			clusters.push_back(Cluster{ t, t + 1, 0.0f });
+		else
+			clusters.back().end = t + 1;
+	}
+	if (clusters.size() < 2)
+		return;
+
+	// area weighted mesh centroid
+	glm::vec3 meshCenter(0.0f);
+	float meshArea = 0.0f;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const glm::vec3 &p0 = vertices[indices[t * 3]].Position;
+		const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].Position;
+		const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].Position;
+		float area = glm::length(glm::cross(p1 - p0, p2 - p0));
+		meshCenter += (p0 + p1 + p2) * (area / 3.0f);
+		meshArea += area;
+	}
+	if (meshArea > 0.0f)
+		meshCenter /= meshArea;
+
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		glm::vec3 center(0.0f), normal(0.0f);
+		float area = 0.0f;
+		for (size_t t = clusters[c].begin; t < clusters[c].end; t++)
+		{
+			const glm::vec3 &p0 = vertices[indices[t * 3]].Position;
+			const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].Position;
+			const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].Position;
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float a = glm::length(n);
+			center += (p0 + p1 + p2) * (a / 3.0f);
+			normal += n;
+			area += a;
+		}
+		if (area > 0.0f)
+			center /= area;
+		float length = glm::length(normal);
+		clusters[c].sortKey = length > 0.0f ? glm::dot(center - meshCenter, normal / length) : 0.0f;
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) { return a.sortKey > b.sortKey; });
+
+	vector<unsigned int> result;
+	result.reserve(indices.size());
+	for (size_t c = 0; c < clusters.size(); c++)
+		result.insert(result.end(), indices.begin() + clusters[c].begin * 3, indices.begin() + clusters[c].end * 3);
+	if (ComputeACMR(result, vertices.size()) <= ComputeACMR(indices, vertices.size()) * threshold)
+		indices.swap(result);
+}
+
+// renumbers vertices in the order the index buffer first references them, dropping unreferenced ones
+inline void OptimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+	const unsigned int unused = 0xffffffff;
+	vector<unsigned int> remap(vertices.size(), unused);
+	vector<Vertex> ordered;
+	ordered.reserve(vertices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		unsigned int &target = remap[indices[i]];
+		if (target == unused)
+		{
+			target = (unsigned int)ordered.size();
+			ordered.push_back(vertices[indices[i]]);
+		}
+		indices[i] = target;
+	}
+	vertices.swap(ordered);
+}
+
+// runs every pass on one triangle list
+inline MeshOptimizeStats OptimizeMesh(vector<Vertex> &vertices, vector<unsigned int> &indices)
+{
+	MeshOptimizeStats stats;
+	stats.verticesBefore = vertices.size();
+	stats.acmrBefore = ComputeACMR(indices, vertices.size());
+
+	WeldVertices(vertices, indices);
+	OptimizeVertexCache(indices, vertices.size());
+	OptimizeOverdraw(indices, vertices);
+	OptimizeVertexFetch(vertices, indices);
+
+	stats.verticesAfter = vertices.size();
+	stats.acmrAfter = ComputeACMR(indices, vertices.size());
+	return stats;
+}
+#endif
@@ -0,0 +1,274 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include "VertexFormat.h"
+#include "IndexFormat.h"
+#include "MeshOptimizer.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+using namespace std;
+
+// Level of detail generation by quadric error edge collapse (Garland & Heckbert). Only the index buffer is simplified:
+// a vertex is collapsed onto one of its neighbours, so every level reuses the mesh's vertex buffer and a LOD chain is
+// just more index ranges (MeshLod) appended to the same index buffer.
+// Vertices on attribute seams (several vertices sharing a position) and on open borders are never removed, which keeps
+// UV charts and silhouettes intact at the cost of stopping early on meshes that are mostly seams.
+
+const unsigned int MESH_LOD_MAX_LEVELS = 4;		// levels below the full resolution one
+const unsigned int MESH_LOD_MIN_INDICES = 384;	// meshes (or levels) smaller than this aren't simplified further
+
+// symmetric 4x4 error quadric, upper triangle only, plus the total weight of its planes
+struct Quadric {
+	double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+	double weight;
+
+	Quadric() : a00(0), a01(0), a02(0), a03(0), a11(0), a12(0), a13(0), a22(0), a23(0), a33(0), weight(0) {}
+
+	// squared distance to the plane n.p + d = 0, weighted
+	void addPlane(double nx, double ny, double nz, double d, double weight)
+	{
+		a00 += weight * nx * nx; a01 += weight * nx * ny; a02 += weight * nx * nz; a03 += weight * nx * d;
+		a11 += weight * ny * ny; a12 += weight * ny * nz; a13 += weight * ny * d;
+		a22 += weight * nz * nz; a23 += weight * nz * d;
+		a33 += weight * d * d;
+		this->weight += weight;
+	}
+
+	void add(const Quadric &q)
+	{
+		a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+		a11 += q.a11; a12 += q.a12; a13 += q.a13;
+		a22 += q.a22; a23 += q.a23;
+		a33 += q.a33;
+		weight += q.weight;
+	}
+
+	// weighted mean squared distance of p to the planes
+	double evaluate(const glm::vec3 &p) const
+	{
+		double x = p.x, y = p.y, z = p.z;
+		double error = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+			+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+			+ a22 * z * z + 2 * a23 * z
+			+ a33;
+		return error > 0.0 && weight > 0.0 ? error / weight : 0.0;
+	}
+};
+
+// Simplifies a triangle list down to about targetIndexCount indices. error receives the largest geometric deviation
+// (in object space units) one of the collapses introduced.
+inline vector<unsigned int> SimplifyMesh(const vector<Vertex> &vertices, const vector<unsigned int> &source, size_t targetIndexCount, float &error)
+{
+	vector<unsigned int> indices = source;
+	size_t vertexCount = vertices.size();
+	error = 0.0f;
+	// the scratch of one level is given back before the next
+	ImportArena::Rewind rewind;
+
+	// vertices sharing a position are the same corner for quadrics and border detection
+	struct PositionHash {
+		size_t operator()(const glm::vec3 &p) const { return (size_t)HashBytes((const unsigned char*)&p, sizeof(p)); }
+	};
+	struct PositionEqual {
+		bool operator()(const glm::vec3 &a, const glm::vec3 &b) const { return memcmp(&a, &b, sizeof(a)) == 0; }
+	};
+	ScratchMap<glm::vec3, unsigned int, PositionHash, PositionEqual> positions;
+	positions.reserve(vertexCount);
+	vector<unsigned int> corner(vertexCount);
+	vector<unsigned int> wedges;
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		auto inserted = positions.insert(std::make_pair(vertices[v].Position, (unsigned int)wedges.size()));
+		if (inserted.second)
+			wedges.push_back(0);
+		corner[v] = inserted.first->second;
+		wedges[corner[v]]++;
+	}
+
+	// seams and open borders are locked
+	vector<char> locked(vertexCount, 0);
+	ScratchMap<uint64_t, unsigned int> edgeUse;
+	edgeUse.reserve(indices.size());
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			unsigned int a = corner[indices[i + k]], b = corner[indices[i + (k + 1) % 3]];
+			uint64_t key = a < b ? ((uint64_t)a << 32 | b) : ((uint64_t)b << 32 | a);
+			edgeUse[key]++;
+		}
+	}
+	vector<char> cornerLocked(wedges.size(), 0);
+	for (size_t c = 0; c < wedges.size(); c++)
+		cornerLocked[c] = wedges[c] > 1;
+	for (auto it = edgeUse.begin(); it != edgeUse.end(); ++it)
+	{
+		if (it->second != 2)
+		{
+			cornerLocked[it->first >> 32] = 1;
+			cornerLocked[it->first & 0xffffffff] = 1;
+		}
+	}
+	for (size_t v = 0; v < vertexCount; v++)
+		locked[v] = cornerLocked[corner[v]];
+
+	// plane quadrics, weighted by triangle area
+	vector<Quadric> quadrics(wedges.size());
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		const glm::vec3 &p0 = vertices[indices[i]].Position;
+		const glm::vec3 &p1 = vertices[indices[i + 1]].Position;
+		const glm::vec3 &p2 = vertices[indices[i + 2]].Position;
+		glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		float area = glm::length(normal);
+		if (area <= 0.0f)
+			continue;
+		normal /= area;
+		double d = -glm::dot(normal, p0);
+		for (int k = 0; k < 3; k++)
+			quadrics[corner[indices[i + k]]].addPlane(normal.x, normal.y, normal.z, d, area * 0.5);
+	}
+
+	struct Collapse {
+		unsigned int from;
+		unsigned int to;
+		double cost;
+	};
+	// reused by every pass
+	vector<unsigned int> offsets, adjacency, fill, remap(vertexCount);
+	vector<char> touched(vertexCount);
+	vector<Collapse> collapses;
+	while (indices.size() > targetIndexCount)
+	{
+		// triangles around every vertex
+		offsets.assign(vertexCount + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+			offsets[indices[i] + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] += offsets[v];
+		adjacency.resize(indices.size());
+		fill.assign(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+		// every edge leaving an unlocked vertex is a candidate
+		collapses.clear();
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int from = indices[i + k];
+				if (locked[from])
+					continue;
+				for (int n = 1; n < 3; n++)
+				{
+					unsigned int to = indices[i + (k + n) % 3];
+					Quadric q = quadrics[corner[from]];
+					q.add(quadrics[corner[to]]);
+					collapses.push_back(Collapse{ from, to, q.evaluate(vertices[to].Position) });
+				}
+			}
+		}
+		if (collapses.empty())
+			break;
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+		// collapse the cheapest edges, at most one per neighbourhood per pass
+		for (size_t v = 0; v < vertexCount; v++)
+			remap[v] = (unsigned int)v;
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t indexCount = indices.size();
+		size_t applied = 0;
+		for (size_t c = 0; c < collapses.size() && indexCount > targetIndexCount; c++)
+		{
+			const Collapse &collapse = collapses[c];
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			// reject collapses that would flip a triangle
+			bool flips = false;
+			size_t removed = 0;
+			const glm::vec3 &target = vertices[collapse.to].Position;
+			for (unsigned int a = offsets[collapse.from]; a < offsets[collapse.from + 1] && !flips; a++)
+			{
+				const unsigned int *triangle = &indices[adjacency[a] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+				{
+					removed++;
+					continue;
+				}
+				glm::vec3 p[3], q[3];
+				for (int k = 0; k < 3; k++)
+				{
+					p[k] = vertices[triangle[k]].Position;
+					q[k] = triangle[k] == collapse.from ? target : p[k];
+				}
+				glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				flips = glm::dot(before, after) <= 0.0f;
+			}
+			if (flips)
+				continue;
+
+			remap[collapse.from] = collapse.to;
+			quadrics[corner[collapse.to]].add(quadrics[corner[collapse.from]]);
+			float deviation = (float)std::sqrt(collapse.cost);
+			error = deviation > error ? deviation : error;
+			for (unsigned int a = offsets[collapse.from]; a < offsets[collapse.from + 1]; a++)
+				for (int k = 0; k < 3; k++)
+					touched[indices[adjacency[a] * 3 + k]] = 1;
+			indexCount -= removed * 3;
+			applied++;
+		}
+		if (applied == 0)
+			break;
+
+		// apply the collapses and drop the triangles that became degenerate
+		size_t write = 0;
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			unsigned int a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			indices[write++] = a;
+			indices[write++] = b;
+			indices[write++] = c;
+		}
+		indices.resize(write);
+	}
+	return indices;
+}
+
+// Appends up to MESH_LOD_MAX_LEVELS simplified levels, each with about half the triangles of the previous one,
+// to indices. lods receives the full resolution range followed by one range per generated level.
+inline void BuildLodChain(const vector<Vertex> &vertices, vector<unsigned int> &indices, vector<MeshLod> &lods)
+{
+	lods.clear();
+	lods.push_back(MeshLod{ 0, (uint32_t)indices.size(), 0.0f });
+	vector<unsigned int> current = indices;
+	float error = 0.0f;
+	for (unsigned int level = 0; level < MESH_LOD_MAX_LEVELS; level++)
+	{
+		size_t target = current.size() / 6 * 3;
+		if (target < MESH_LOD_MIN_INDICES)
+			break;
+		float levelError;
+		vector<unsigned int> next = SimplifyMesh(vertices, current, target, levelError);
+		// mostly locked vertices, another level wouldn't save enough to be worth the memory
+		if (next.size() > current.size() * 85 / 100)
+			break;
+		OptimizeVertexCache(next, vertices.size());
+		// every level is simplified from the previous one, so the deviations add up
+		error += levelError;
+		lods.push_back(MeshLod{ (uint32_t)indices.size(), (uint32_t)next.size(), error });
+		indices.insert(indices.end(), next.begin(), next.end());
+		current.swap(next);
+	}
+}
+#endif
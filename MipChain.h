@@ -0,0 +1,102 @@
+#ifndef MIP_CHAIN_H
+#define MIP_CHAIN_H
+
+#include <vector>
+#include <cmath>
+using namespace std;
+
+// One level of a mip pyramid, tightly packed rows of width * channels bytes.
+struct MipLevel {
+	int width;
+	int height;
+	vector<unsigned char> pixels;
+};
+
+// sRGB <-> linear conversion for gamma-correct filtering. Alpha is never converted.
+class SrgbTable
+{
+public:
+	static const SrgbTable& get()
+	{
+		static SrgbTable table;
+		return table;
+	}
+
+	float toLinear(unsigned char value) const { return linear[value]; }
+
+	unsigned char toSrgb(float value) const
+	{
+		if (value <= 0.0f)
+			return 0;
+		if (value >= 1.0f)
+			return 255;
+		float srgb = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+		return (unsigned char)(srgb * 255.0f + 0.5f);
+	}
+
+private:
+	float linear[256];
+
+	SrgbTable()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			float c = i / 255.0f;
+			linear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+	}
+};
+
+// halves an image with a 2x2 box filter. Odd edges are clamped, so the last row/column is averaged with itself.
+// With srgb set, color channels are averaged in linear space.
+inline void DownsampleBox(const MipLevel &src, int channels, bool srgb, MipLevel &dst)
+{
+	dst.width = src.width > 1 ? src.width / 2 : 1;
+	dst.height = src.height > 1 ? src.height / 2 : 1;
+	dst.pixels.resize((size_t)dst.width * dst.height * channels);
+	const SrgbTable &table = SrgbTable::get();
+	int colorChannels = channels == 4 ? 3 : channels;
+
+	for (int y = 0; y < dst.height; y++)
+	{
+		int y0 = y * 2 < src.height ? y * 2 : src.height - 1;
+		int y1 = y * 2 + 1 < src.height ? y * 2 + 1 : src.height - 1;
+		for (int x = 0; x < dst.width; x++)
+		{
+			int x0 = x * 2 < src.width ? x * 2 : src.width - 1;
+			int x1 = x * 2 + 1 < src.width ? x * 2 + 1 : src.width - 1;
+			const unsigned char *p00 = &src.pixels[((size_t)y0 * src.width + x0) * channels];
+			const unsigned char *p01 = &src.pixels[((size_t)y0 * src.width + x1) * channels];
+			const unsigned char *p10 = &src.pixels[((size_t)y1 * src.width + x0) * channels];
+			const unsigned char *p11 = &src.pixels[((size_t)y1 * src.width + x1) * channels];
+			unsigned char *out = &dst.pixels[((size_t)y * dst.width + x) * channels];
+			for (int c = 0; c < channels; c++)
+			{
+				if (srgb && c < colorChannels)
+				{
+					float sum = table.toLinear(p00[c]) + table.toLinear(p01[c]) + table.toLinear(p10[c]) + table.toLinear(p11[c]);
+					out[c] = table.toSrgb(sum * 0.25f);
+				}
+				else
+					out[c] = (unsigned char)((p00[c] + p01[c] + p10[c] + p11[c] + 2) >> 2);
+			}
+		}
+	}
+}
+
+// builds the full pyramid down to 1x1 from tightly packed base level pixels
+inline void BuildMipChain(const unsigned char *pixels, int width, int height, int channels, bool srgb, vector<MipLevel> &levels)
+{
+	levels.clear();
+	levels.push_back(MipLevel());
+	levels[0].width = width;
+	levels[0].height = height;
+	levels[0].pixels.assign(pixels, pixels + (size_t)width * height * channels);
+	while (levels.back().width > 1 || levels.back().height > 1)
+	{
+		MipLevel next;
+		DownsampleBox(levels.back(), channels, srgb, next);
+		levels.push_back(std::move(next));
+	}
+}
+#endif
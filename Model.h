@@ -6,72 +6,387 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-#define STB_IMAGE_IMPLEMENTATION
-
-#include "stb_image.h"
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include "AssetArchive.h"
+#include "ImportArena.h"
 #include "Mesh.h"
+#include "MeshCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "OcclusionBaker.h"
+#include "ObjLoader.h"
 #include "Shader.h"
+#include "TextureLoader.h"
+#include "TextureStreamer.h"
+#include "TextureBudget.h"
+#include "TextureRegistry.h"
+#include "StartupTracer.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include <memory>
+#include <functional>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+TextureHandle TextureFromFile(const char *path, const string &directory, bool gamma = false, uint64_t contentHash = 0);
+TextureHandle AcquireTexture(const string &filename, uint64_t contentHash = 0);
+
+// Everything read from a model file before any GL object exists. Produced by Model::Import, which doesn't need
+// the GL context, and consumed by the Model constructor on the GL thread.
+struct ModelData {
+	string path;
+	string directory;
+	vector<MeshData> meshes;
+	unique_ptr<AssetFile> cacheFile;	// keeps meshes that point into a mapped or archived mesh cache valid until upload
+	unordered_map<string, uint64_t> textureHashes;	// texture path -> contents hash, see HashModelTextures
+
+	// the hash of a referenced texture for TextureRegistry::acquire, 0 if it wasn't taken
+	uint64_t textureHash(const string &texturePath) const
+	{
+		auto it = textureHashes.find(texturePath);
+		return it != textureHashes.end() ? it->second : 0;
+	}
+};
+
+// whether the scene has ambient occlusion baked into the model file at path, see SceneAsset::bakeOcclusion
+inline bool BakesOcclusion(const string &path)
+{
+	for (const SceneAsset &asset : SCENE_MODELS)
+	{
+		if (path == asset.path)
+			return asset.bakeOcclusion;
+	}
+	return false;
+}
+
+// geometry memory of a model, see Model::footprint
+struct GeometryFootprint {
+	size_t cpuBytes;
+	size_t gpuBytes;
+};
+
+// records the budget category of every texture an imported model references, before any of them gets loaded.
+// Normal and height maps don't count as colors.
+inline void AssignTextureBudget(const ModelData &data, TextureCategory category)
+{
+	for (const MeshData &mesh : data.meshes)
+		for (const Texture &texture : mesh.textures)
+			TextureBudget::get().assign(data.directory + '/' + texture.path, category,
+				texture.type != "texture_normal" && texture.type != "texture_height");
+}
+
+// hashes the contents of every texture an imported model references, on the thread that imported it, so the GL thread
+// can match them against the TextureRegistry without reading the files. Textures resident under their path are skipped.
+inline void HashModelTextures(ModelData &data)
+{
+	for (const MeshData &mesh : data.meshes)
+	{
+		for (const Texture &texture : mesh.textures)
+		{
+			string path = data.directory + '/' + texture.path;
+			if (data.textureHashes.count(texture.path) || TextureRegistry::get().isLoaded(path))
+				continue;
+			data.textureHashes[texture.path] = TextureRegistry::hashFile(path);
+		}
+	}
+}
 
 class Model
 {
 public:
 	/*  Model Data */
 	vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+	unordered_map<string, unsigned int> textureIndex;	// path -> position in textures_loaded
 	vector<Mesh> meshes;
+	string path;
 	string directory;
 	bool gammaCorrection;
+	GeometryResidency residency;	// what happens to the meshes' CPU-side geometry after upload
 
 	/*  Functions   */
-	// constructor, expects a filepath to a 3D model.
-	Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+	// constructor, expects a filepath to a 3D model. Its textures fall under category of the TextureBudget.
+	Model(string const &path, bool gamma = false, TextureCategory category = TEXTURE_OTHER, GeometryResidency residency = RESIDENCY_RELOAD)
+		: gammaCorrection(gamma), residency(residency)
+	{
+		TRACE_SCOPE("model", path);
+		loadModel(path, category);
+	}
+
+	// constructor for a model that was already imported with Import (e.g. on a worker thread), only does the GL work.
+	// resolveTexture maps a texture path, relative to the model's directory, to a shared texture.
+	Model(ModelData &data, const function<TextureHandle(const string&)> &resolveTexture, bool gamma = false,
+		GeometryResidency residency = RESIDENCY_RELOAD) : gammaCorrection(gamma), residency(residency)
+	{
+		upload(data, resolveTexture);
+	}
+
+	// deletes the GL objects of every mesh, textures are shared and go away with their last handle
+	void release()
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].release();
+		meshes.clear();
+		textures_loaded.clear();
+		textureIndex.clear();
+	}
+
+	// Changes what is kept of the meshes' geometry in CPU memory. Going to RESIDENCY_KEEP pages the geometry back in
+	// unless it was dropped for good; the other two free it.
+	void setResidency(GeometryResidency policy)
+	{
+		if (policy == RESIDENCY_KEEP && !pageIn())
+			return;
+		residency = policy;
+		pageOut();
+	}
+
+	// Makes the CPU-side geometry of every mesh available again (for picking, LOD generation and the like) by
+	// re-importing the model, which comes from the mesh cache unless the source changed. False if it was dropped for
+	// good or the model no longer matches what was uploaded. pageOut gives it back.
+	bool pageIn()
 	{
-		loadModel(path);
+		bool resident = true;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			resident = resident && meshes[i].hasGeometryData();
+		if (resident)
+			return true;
+		if (residency == RESIDENCY_DROP)
+		{
+			cout << "WARNING::RESIDENCY:: geometry of " << path << " was dropped after upload" << endl;
+			return false;
+		}
+		ModelData data;
+		if (!Import(path, data) || data.meshes.size() != meshes.size())
+		{
+			cout << "ERROR::RESIDENCY:: could not page in the geometry of " << path << endl;
+			return false;
+		}
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			MeshData &meshData = data.meshes[i];
+			if (meshData.isMapped())
+			{
+				meshes[i].vertices.assign(meshData.vertexData(), meshData.vertexData() + meshData.vertexCount());
+				meshes[i].indices.assign(meshData.indexData(), meshData.indexData() + meshData.indexCount());
+			}
+			else
+			{
+				meshes[i].vertices = std::move(meshData.vertices);
+				meshes[i].indices = std::move(meshData.indices);
+			}
+		}
+		return true;
+	}
+
+	// frees the CPU-side geometry again, unless the residency is RESIDENCY_KEEP
+	void pageOut()
+	{
+		if (residency == RESIDENCY_KEEP)
+			return;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].releaseGeometryData();
+	}
+
+	GeometryFootprint footprint() const
+	{
+		GeometryFootprint total = { 0, 0 };
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			total.cpuBytes += meshes[i].cpuBytes();
+			total.gpuBytes += meshes[i].gpuBytes();
+		}
+		return total;
 	}
 
 	// draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	void Draw(const Shader &shader)
 	{
 		for (unsigned int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shader);
 	}
 
+	// draws the model with every mesh at the level of detail its size on screen calls for (see LodSettings).
+	// model is the same matrix the shader gets.
+	void Draw(const Shader &shader, const glm::mat4 &model)
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].Draw(shader, meshes[i].selectLod(model));
+	}
+
+	// reads a model with supported ASSIMP extensions from file without touching OpenGL, so it may run on any thread.
+	// A baked mesh cache next to the file is used instead of ASSIMP as long as the source hasn't changed since it was written,
+	// one in the mounted asset archive always is, and OBJ files go through the native ObjLoader unless they use something
+	// only ASSIMP understands.
+	// Scratch memory comes from a per-import ImportArena, whose peak is always reported. The heap allocations the import
+	// made are only reported in builds with PIANO_COUNT_ALLOCATIONS defined (see AllocationCounter).
+	static bool Import(string const &path, ModelData &data)
+	{
+		TRACE_SCOPE("import", path);
+		AllocationCounter counter;
+		ImportArena arena;
+		bool imported;
+		{
+			AllocationCounter::Scope counting(&counter);
+			ImportArena::Scope scratch(&arena);
+			imported = importFile(path, data);
+		}
+		if (imported && COUNT_ALLOCATIONS)
+			cout << "IMPORT:: " << path << ": " << counter.allocations << " allocations, " << counter.bytes / 1024 << " KiB allocated, "
+				<< arena.peakBytes() / 1024 << " KiB peak scratch" << endl;
+		else if (imported)
+			cout << "IMPORT:: " << path << ": " << arena.peakBytes() / 1024 << " KiB peak scratch (allocation counts need PIANO_COUNT_ALLOCATIONS)" << endl;
+		return imported;
+	}
+
 private:
 	/*  Functions   */
-	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-	void loadModel(string const &path)
+	static bool importFile(string const &path, ModelData &data)
 	{
+		// retrieve the directory path of the filepath
+		data.path = path;
+		data.directory = path.substr(0, path.find_last_of('/'));
+
+		string cachePath = MeshCache::cachePath(path);
+		unique_ptr<AssetFile> file(new AssetFile());
+		bool cached = file->open(cachePath);
+		// a cache from the mounted asset archive ships without its source and is used as is
+		if (cached && file->isArchived() && MeshCache::read(file->data(), file->size(), MESH_CACHE_ANY_SOURCE, data.meshes))
+		{
+			data.cacheFile = std::move(file);
+			return true;
+		}
+
+		uint64_t sourceHash = MeshCache::hashSource(path);
+		// a cache baked with occlusion doesn't match one without
+		if (sourceHash != 0 && BakesOcclusion(path))
+			sourceHash = HashBytes((const unsigned char*)"occlusion", 9, sourceHash);
+		if (cached && !file->isArchived() && sourceHash != 0 && MeshCache::read(file->data(), file->size(), sourceHash, data.meshes))
+		{
+			data.cacheFile = std::move(file);
+			return true;
+		}
+
+		size_t extension = path.find_last_of('.');
+		if (extension != string::npos && path.compare(extension, string::npos, ".obj") == 0 && ObjLoader::Load(path, data.meshes))
+		{
+			finishImport(path, sourceHash, cachePath, data.meshes);
+			return true;
+		}
+
 		// read file via ASSIMP
+		TRACE_SCOPE("import", "assimp");
 		Assimp::Importer importer;
 		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
 		// check for errors
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
 		{
 			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-			return;
+			return false;
 		}
-		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('/'));
 
 		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		data.meshes.reserve(scene->mNumMeshes);
+		processNode(scene->mRootNode, scene, data.meshes);
+		finishImport(path, sourceHash, cachePath, data.meshes);
+		return true;
+	}
+
+	// loads a model from file and uploads it right away on the calling (GL) thread.
+	void loadModel(string const &path, TextureCategory category)
+	{
+		ModelData data;
+		if (!Import(path, data))
+			return;
+		AssignTextureBudget(data, category);
+		HashModelTextures(data);
+		upload(data, [this, &data](const string &file) {
+			return TextureFromFile(file.c_str(), this->directory, gammaCorrection, data.textureHash(file));
+		});
+	}
+
+	// creates the GL side of every imported mesh. Each distinct texture path is resolved to a texture only once.
+	// Meshes keep their CPU-side geometry only with RESIDENCY_KEEP.
+	void upload(ModelData &data, const function<TextureHandle(const string&)> &resolveTexture)
+	{
+		TRACE_SCOPE("upload", data.path);
+		path = data.path;
+		directory = data.directory;
+		meshes.reserve(data.meshes.size());
+		for (unsigned int i = 0; i < data.meshes.size(); i++)
+		{
+			TRACE_SCOPE("upload", "mesh");
+			MeshData &meshData = data.meshes[i];
+			vector<Texture> textures;
+			textures.reserve(meshData.textures.size());
+			for (unsigned int j = 0; j < meshData.textures.size(); j++)
+				textures.push_back(loadTexture(meshData.textures[j], resolveTexture));
+			if (meshData.isMapped())
+				meshes.emplace_back(meshData.vertexData(), meshData.vertexCount(), meshData.indexData(), meshData.indexCount(), std::move(textures));
+			else
+				meshes.emplace_back(std::move(meshData.vertices), std::move(meshData.indices), std::move(textures));
+			meshes.back().lods = std::move(meshData.lods);
+			if (residency != RESIDENCY_KEEP)
+				meshes.back().releaseGeometryData();
+			else if (meshData.isMapped())
+			{
+				meshes.back().vertices.assign(meshData.vertexData(), meshData.vertexData() + meshData.vertexCount());
+				meshes.back().indices.assign(meshData.indexData(), meshData.indexData() + meshData.indexCount());
+			}
+		}
+	}
+
+	// optimizes freshly imported meshes, bakes their ambient occlusion if the scene asks for it and stores them in the mesh cache
+	static void finishImport(string const &path, uint64_t sourceHash, string const &cachePath, vector<MeshData> &meshes)
+	{
+		optimizeMeshes(path, meshes);
+		if (BakesOcclusion(path))
+		{
+			TRACE_SCOPE("import", "bake occlusion");
+			ImportArena::Rewind rewind;
+			OcclusionStats stats = BakeOcclusion(meshes);
+			cout << "OCCLUSION:: " << path << ": " << stats.vertices << " vertices against " << stats.triangles << " triangles, mean "
+				<< stats.mean << endl;
+		}
+		if (sourceHash != 0 && !MeshCache::write(cachePath, sourceHash, meshes))
+			cout << "WARNING::MESH_CACHE:: could not write " << cachePath << endl;
+	}
+
+	// welds and reorders the freshly imported meshes for the GPU caches (see MeshOptimizer.h) and appends their
+	// level of detail chains (see MeshSimplifier.h). Only runs on a cache miss, the cache stores the result.
+	static void optimizeMeshes(string const &path, vector<MeshData> &meshes)
+	{
+		size_t verticesBefore = 0, verticesAfter = 0, triangles = 0;
+		float missesBefore = 0.0f, missesAfter = 0.0f;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			// the scratch of one mesh is given back before the next
+			TRACE_SCOPE("import", "optimize mesh");
+			ImportArena::Rewind rewind;
+			MeshOptimizeStats stats = OptimizeMesh(meshes[i].vertices, meshes[i].indices);
+			size_t meshTriangles = meshes[i].indices.size() / 3;
+			BuildLodChain(meshes[i].vertices, meshes[i].indices, meshes[i].lods);
+			verticesBefore += stats.verticesBefore;
+			verticesAfter += stats.verticesAfter;
+			missesBefore += stats.acmrBefore * meshTriangles;
+			missesAfter += stats.acmrAfter * meshTriangles;
+			triangles += meshTriangles;
+		}
+		if (triangles > 0)
+			cout << "MESH_OPTIMIZER:: " << path << ": " << verticesBefore << " -> " << verticesAfter << " vertices, ACMR "
+				<< missesBefore / triangles << " -> " << missesAfter / triangles << endl;
 	}
 
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode *node, const aiScene *scene)
+	static void processNode(aiNode *node, const aiScene *scene, vector<MeshData> &meshes)
 	{
 		// process each mesh located at the current node
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -79,27 +394,34 @@ private:
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			meshes.emplace_back();
+			processMesh(mesh, scene, meshes.back());
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, meshes);
 		}
 
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	// fills data in place, with every array sized once up front
+	static void processMesh(aiMesh *mesh, const aiScene *scene, MeshData &data)
 	{
 		// data to fill
-		vector<Vertex> vertices;
-		vector<unsigned int> indices;
-		vector<Texture> textures;
+		vector<Vertex> &vertices = data.vertices;
+		vector<unsigned int> &indices = data.indices;
+		vector<Texture> &textures = data.textures;
+		vertices.resize(mesh->mNumVertices);
+		size_t indexCount = 0;
+		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+			indexCount += mesh->mFaces[i].mNumIndices;
+		indices.reserve(indexCount);
 
 		// Walk through each of the mesh's vertices
 		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
 		{
-			Vertex vertex;
+			Vertex &vertex = vertices[i];
 			glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
 							  // positions
 			vector.x = mesh->mVertices[i].x;
@@ -123,22 +445,29 @@ private:
 			}
 			else
 				vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-			// tangent
-			//vector.x = mesh->mTangents[i].x;
-			//vector.y = mesh->mTangents[i].y;
-			//vector.z = mesh->mTangents[i].z;
-			vertex.Tangent = vector;
-			// bitangent
-			//vector.x = mesh->mBitangents[i].x;
-			//vector.y = mesh->mBitangents[i].y;
-			//vector.z = mesh->mBitangents[i].z;
-			vertex.Bitangent = vector;
-			vertices.push_back(vertex);
+			// tangent and bitangent, only there if the mesh has texture coordinates to derive them from
+			if (mesh->mTangents)
+			{
+				vector.x = mesh->mTangents[i].x;
+				vector.y = mesh->mTangents[i].y;
+				vector.z = mesh->mTangents[i].z;
+				vertex.Tangent = vector;
+				vector.x = mesh->mBitangents[i].x;
+				vector.y = mesh->mBitangents[i].y;
+				vector.z = mesh->mBitangents[i].z;
+				vertex.Bitangent = vector;
+			}
+			else
+			{
+				vertex.Tangent = glm::vec3(0.0f);
+				vertex.Bitangent = glm::vec3(0.0f);
+			}
+			vertex.Occlusion = 1.0f;
 		}
 		// now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
 		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
 		{
-			aiFace face = mesh->mFaces[i];
+			const aiFace &face = mesh->mFaces[i];
 			// retrieve all indices of the face and store them in the indices vector
 			for (unsigned int j = 0; j < face.mNumIndices; j++)
 				indices.push_back(face.mIndices[j]);
@@ -152,95 +481,152 @@ private:
 		// specular: texture_specularN
 		// normal: texture_normalN
 
+		textures.reserve(material->GetTextureCount(aiTextureType_DIFFUSE) + material->GetTextureCount(aiTextureType_SPECULAR) +
+			material->GetTextureCount(aiTextureType_HEIGHT) + material->GetTextureCount(aiTextureType_AMBIENT));
 		// 1. diffuse maps
-		vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-		textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+		loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", textures);
 		// 2. specular maps
-		vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-		textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+		loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", textures);
 		// 3. normal maps
-		std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-		textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+		loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", textures);
 		// 4. height maps
-		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+		loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", textures);
 
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		// the extracted mesh data is uploaded later on the GL thread
 	}
 
-	// checks all material textures of a given type and loads the textures if they're not loaded yet.
-	// the required info is returned as a Texture struct.
-	vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+	// appends all material textures of a given type to textures. Only the references are collected here,
+	// the textures themselves are loaded once the mesh gets uploaded.
+	static void loadMaterialTextures(aiMaterial *mat, aiTextureType type, const char *typeName, vector<Texture> &textures)
 	{
-		vector<Texture> textures;
 		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
+			textures.emplace_back();
+			Texture &texture = textures.back();
+			texture.id = 0;
+			texture.type = typeName;
+			texture.path = str.C_Str();
+		}
+	}
+
+	// loads a texture unless it was loaded before, in which case the earlier one is reused.
+	// Across models the sharing happens in the TextureRegistry the resolver goes through.
+	Texture loadTexture(const Texture &reference, const function<TextureHandle(const string&)> &resolveTexture)
+	{
+		// check if texture was loaded before and if so, skip loading a new texture
+		unordered_map<string, unsigned int>::iterator it = textureIndex.find(reference.path);
+		if (it != textureIndex.end())
+		{
+			Texture texture = textures_loaded[it->second];
+			texture.type = reference.type;
+			return texture; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
+		}
+		Texture texture = reference;
+		texture.handle = resolveTexture(reference.path);
+		texture.id = texture.handle->id;
+		textureIndex[reference.path] = (unsigned int)textures_loaded.size();
+		textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+		return texture;
+	}
+};
+
+// GL thread, once every texture of models is filled: packs the maps the lighting shader samples into texture arrays
+// (see TextureArrays.h) and points the meshes at their layers. Without keepSources, the 2D textures left to packed
+// meshes only are shrunk to a single texel since nothing samples them anymore, and taken out of the TextureRegistry so
+// a later model using the same file loads it anew; that is only for when nothing re-uploads them (no hot reloading).
+// pinned textures are used elsewhere and stay.
+inline void PackMaterialTextures(const vector<Model*> &models, bool keepSources, const vector<TextureHandle> &pinned)
+{
+	TRACE_SCOPE("upload", "texture arrays");
+	vector<TextureHandle> textures;
+	for (Model *model : models)
+		for (const Mesh &mesh : model->meshes)
+			for (unsigned int slot = 0; slot < MATERIAL_ARRAY_SLOTS && mesh.textures.size() >= MATERIAL_ARRAY_SLOTS; slot++)
+				textures.push_back(mesh.textures[slot].handle);
+	unordered_map<const TextureEntry*, TextureArrayLayer> layers = TextureArrays::get().pack(textures);
+
+	unordered_set<const TextureEntry*> bound;
+	for (const TextureHandle &texture : pinned)
+		bound.insert(texture.get());
+	unordered_set<const TextureArray*> arrays;
+	unsigned int packedMeshes = 0;
+	for (Model *model : models)
+	{
+		for (Mesh &mesh : model->meshes)
+		{
+			MaterialLayers material;
+			bool packed = mesh.textures.size() >= MATERIAL_ARRAY_SLOTS;
+			for (unsigned int slot = 0; packed && slot < MATERIAL_ARRAY_SLOTS; slot++)
 			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
+				auto layer = layers.find(mesh.textures[slot].handle.get());
+				packed = layer != layers.end();
+				if (packed)
 				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
+					material.arrays[slot] = layer->second.array;
+					material.layers[slot] = layer->second.layer;
 				}
 			}
-			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+			if (!packed)
+			{
+				for (const Texture &texture : mesh.textures)
+					bound.insert(texture.handle.get());
+				continue;
 			}
+			mesh.materialLayers = material;
+			for (unsigned int slot = 0; slot < MATERIAL_ARRAY_SLOTS; slot++)
+				arrays.insert(material.arrays[slot].get());
+			packedMeshes++;
 		}
-		return textures;
 	}
-};
 
+	size_t released = 0;
+	for (auto it = layers.begin(); !keepSources && it != layers.end(); ++it)
+	{
+		if (bound.count(it->first))
+			continue;
+		static const unsigned int texel = 0xff808080;
+		SpecifyTexture2D(it->first->id, 1, 1, 4, &texel);
+		// whoever asks for the file later gets it loaded again rather than the texel
+		TextureRegistry::get().unlist(it->second.array->sources[it->second.layer]);
+		released++;
+	}
+	size_t packedTextures = 0;
+	for (const TextureArray *array : arrays)
+		packedTextures += array->sources.size();
+	std::cout << "TEXTURE_ARRAYS:: " << packedTextures << " textures in " << arrays.size() << " arrays, " << packedMeshes
+		<< " meshes draw from their layers, " << released << " 2D textures released" << std::endl;
+}
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+
+TextureHandle TextureFromFile(const char *path, const string &directory, bool gamma, uint64_t contentHash)
 {
 	string filename = string(path);
 	filename = directory + '/' + filename;
 
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+	return AcquireTexture(filename, contentHash);
+}
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// returns the process-wide texture for an image file, loading it only if no one else did yet. Without the file's
+// contentHash (see TextureRegistry::acquire) a copy under another path isn't recognized.
+TextureHandle AcquireTexture(const string &filename, uint64_t contentHash)
+{
+	bool created;
+	TextureHandle texture = TextureRegistry::get().acquire(filename, created, contentHash);
+	if (!created)
+		return texture;
 
-		stbi_image_free(data);
-	}
+	// with a streamer running, hand out a placeholder now and let the real image arrive in a later frame
+	if (TextureStreamer::current())
+		TextureStreamer::current()->stream(texture->id, filename);
 	else
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		ImageData image;
+		if (LoadImageData(filename, image))
+			UploadTexture2D(texture->id, image);
 	}
-
-	return textureID;
+	TextureRegistry::get().markLoaded(texture);
+	return texture;
 }
-#endif
\ No newline at end of file
+#endif
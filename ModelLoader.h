@@ -0,0 +1,346 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <glad/glad.h>
+
+#include "Model.h"
+#include "TextureLoader.h"
+#include "TextureRegistry.h"
+#include "ThreadPool.h"
+
+#include <string>
+#include <iostream>
+#include <map>
+#include <unordered_set>
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+using namespace std;
+
+// Loads a batch of models and standalone textures in parallel. Importing the model files and decoding the images
+// fan out over a worker pool, the calling thread (which must own the GL context) only drains a queue of finished
+// items and does the uploads. Textures go through the TextureRegistry: a file referenced by several models is decoded
+// and uploaded once, and files some earlier load already brought in aren't decoded at all.
+// A batch can either be loaded as a whole (load) or streamed in while rendering (start, then update once per frame).
+class ModelLoader
+{
+public:
+	// importance of a model going by its object space bounding sphere, higher is decoded and uploaded first
+	typedef function<float(const string &name, const glm::vec3 &center, float radius)> Priority;
+
+	// threads == 0 uses one worker per hardware thread
+	explicit ModelLoader(unsigned int threads = 0) : pending(0), running(false), placeholderPixel(0xff808080), pool(threads)
+	{
+	}
+
+	// the model's textures fall under category of the TextureBudget, its geometry is kept as residency says
+	void addModel(const string &name, const string &path, TextureCategory category = TEXTURE_OTHER,
+		GeometryResidency residency = RESIDENCY_RELOAD)
+	{
+		modelRequests.push_back(Request{ name, path, category, residency });
+	}
+
+	void addTexture(const string &name, const string &path, TextureCategory category = TEXTURE_OTHER)
+	{
+		TextureBudget::get().assign(path, category, true);
+		textureRequests.push_back(Request{ name, path, category, RESIDENCY_KEEP });
+	}
+
+	// ranks the models of the batch once they are imported, their textures are decoded in that order. Without one
+	// everything goes first come first served.
+	void setPriority(const Priority &priority)
+	{
+		this->priority = priority;
+	}
+
+	// runs the whole batch, returns once every requested model and texture is uploaded
+	void load(map<string, Model*> &models, map<string, TextureHandle> &textures)
+	{
+		start();
+		complete(models, textures);
+	}
+
+	// starts importing and decoding the batch in the background, see update
+	void start()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending = modelRequests.size() + textureRequests.size();
+		}
+		running = true;
+		for (unsigned int i = 0; i < textureRequests.size(); i++)
+			requestImage(textureRequests[i].path, textureRequests[i].name, 0.0f, 0);
+		for (unsigned int i = 0; i < modelRequests.size(); i++)
+		{
+			Request request = modelRequests[i];
+			pool.enqueue([this, request]() { importModel(request); });
+		}
+	}
+
+	// uploads what finished since the last call, most important first, until budgetSeconds are used up (at least one
+	// item per call). A model shows up in models as soon as its geometry is uploaded, drawing its textures as a flat
+	// placeholder until they arrive. Returns true once the started batch is completely in.
+	bool update(map<string, Model*> &models, map<string, TextureHandle> &textures, double budgetSeconds)
+	{
+		if (!running)
+			return true;
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		ReadyItem item;
+		while (takeFinished(item, false))
+		{
+			upload(item, models, textures);
+			if (std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() >= budgetSeconds)
+				break;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (pending != 0)
+				return false;
+		}
+		finish();
+		return true;
+	}
+
+	// blocks until the rest of a started batch is uploaded
+	void complete(map<string, Model*> &models, map<string, TextureHandle> &textures)
+	{
+		if (!running)
+			return;
+		ReadyItem item;
+		while (takeFinished(item, true))
+			upload(item, models, textures);
+		finish();
+	}
+
+private:
+	struct Request {
+		string name;
+		string path;
+		TextureCategory category;
+		GeometryResidency residency;
+	};
+
+	struct ReadyItem {
+		bool isModel;
+		string name;
+		ModelData model;
+		GeometryResidency residency;
+		ImageData image;
+		uint64_t contentHash;	// of the image file, taken next to decoding it (see TextureRegistry::acquire)
+		float priority;
+
+		ReadyItem() : isModel(false), residency(RESIDENCY_RELOAD), contentHash(0), priority(0.0f) {}
+	};
+
+	struct ImageRequest {
+		string path;
+		string name;
+		float priority;
+		uint64_t contentHash;	// already taken by the model import, 0 to hash the file when decoding it
+	};
+
+	vector<Request> modelRequests;
+	vector<Request> textureRequests;
+	Priority priority;
+
+	// shared between workers and the GL thread
+	std::mutex mutex;
+	std::condition_variable ready;
+	deque<ReadyItem> finished;
+	unordered_set<string> requestedImages;
+	vector<ImageRequest> imageQueue;	// waiting for a worker, the pool jobs pick the most important one when they run
+	size_t pending;
+
+	bool running;
+	uint32_t placeholderPixel;
+
+	// GL thread only: every texture touched by this batch, held until the batch is done so an image that arrives
+	// before the model using it isn't released in between
+	unordered_map<string, TextureHandle> batchTextures;
+
+	// declared last so its workers are joined before anything they touch is destroyed
+	ThreadPool pool;
+
+	// worker: parses one model and schedules decoding of the textures it references
+	void importModel(const Request &request)
+	{
+		ReadyItem item;
+		item.isModel = true;
+		item.name = request.name;
+		item.residency = request.residency;
+		Model::Import(request.path, item.model);
+		AssignTextureBudget(item.model, request.category);
+		HashModelTextures(item.model);
+		if (priority)
+		{
+			glm::vec3 center;
+			float radius;
+			modelBounds(item.model, center, radius);
+			item.priority = priority(request.name, center, radius);
+		}
+		for (unsigned int i = 0; i < item.model.meshes.size(); i++)
+		{
+			const vector<Texture> &references = item.model.meshes[i].textures;
+			for (unsigned int j = 0; j < references.size(); j++)
+				requestImage(item.model.directory + '/' + references[j].path, "", item.priority, item.model.textureHash(references[j].path));
+		}
+		push(std::move(item));
+	}
+
+	// bounding sphere around every mesh of an imported model
+	static void modelBounds(const ModelData &model, glm::vec3 &center, float &radius)
+	{
+		glm::vec3 low(0.0f), high(0.0f);
+		bool first = true;
+		for (const MeshData &mesh : model.meshes)
+		{
+			const Vertex *vertices = mesh.vertexData();
+			for (unsigned int i = 0; i < mesh.vertexCount(); i++, first = false)
+			{
+				low = first ? vertices[i].Position : glm::min(low, vertices[i].Position);
+				high = first ? vertices[i].Position : glm::max(high, vertices[i].Position);
+			}
+		}
+		center = (low + high) * 0.5f;
+		radius = glm::length(high - low) * 0.5f;
+	}
+
+	// schedules decoding of an image. Named requests (standalone textures) are counted up front and always produce an item,
+	// the ones coming from model materials are skipped if that file was already requested in this batch.
+	// Images that are already resident in the registry aren't decoded again.
+	void requestImage(const string &file, const string &name, float importance, uint64_t contentHash)
+	{
+		string path = TextureRegistry::canonicalPath(file);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			bool first = requestedImages.insert(path).second;
+			if (name.empty())
+			{
+				if (!first)
+					return;
+				pending++;
+			}
+			imageQueue.push_back(ImageRequest{ path, name, importance, contentHash });
+		}
+		pool.enqueue([this]() { decodeImage(); });
+	}
+
+	// worker: decodes the most important queued image, the earliest requested one among equals
+	void decodeImage()
+	{
+		ImageRequest request;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t best = 0;
+			for (size_t i = 1; i < imageQueue.size(); i++)
+			{
+				if (imageQueue[i].priority > imageQueue[best].priority)
+					best = i;
+			}
+			request = std::move(imageQueue[best]);
+			imageQueue.erase(imageQueue.begin() + best);
+		}
+		ReadyItem item;
+		item.name = request.name;
+		item.priority = request.priority;
+		if (TextureRegistry::get().isLoaded(request.path))
+			item.image.path = request.path;
+		else
+		{
+			item.contentHash = request.contentHash ? request.contentHash : TextureRegistry::hashFile(request.path);
+			LoadImageData(request.path, item.image);
+		}
+		push(std::move(item));
+	}
+
+	void push(ReadyItem &&item)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished.push_back(std::move(item));
+		}
+		ready.notify_one();
+	}
+
+	// takes the most important finished item, waiting for one if wait is set. Returns false once the batch is
+	// complete, or without wait when nothing is ready yet.
+	bool takeFinished(ReadyItem &item, bool wait)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (pending == 0)
+			return false;
+		if (wait)
+			ready.wait(lock, [this] { return !finished.empty(); });
+		else if (finished.empty())
+			return false;
+		size_t best = 0;
+		for (size_t i = 1; i < finished.size(); i++)
+		{
+			if (finished[i].priority > finished[best].priority)
+				best = i;
+		}
+		item = std::move(finished[best]);
+		finished.erase(finished.begin() + best);
+		pending--;
+		return true;
+	}
+
+	void upload(ReadyItem &item, map<string, Model*> &models, map<string, TextureHandle> &textures)
+	{
+		if (item.isModel)
+			uploadModel(item, models);
+		else
+			uploadImage(item, textures);
+	}
+
+	void finish()
+	{
+		running = false;
+		modelRequests.clear();
+		textureRequests.clear();
+		requestedImages.clear();
+		batchTextures.clear();
+	}
+
+	// the shared texture for an image path. A texture created here shows a neutral 1x1 placeholder until its decoded
+	// image arrives. contentHash was taken by a worker, the GL thread doesn't read image files.
+	TextureHandle texture(const string &path, uint64_t contentHash)
+	{
+		unordered_map<string, TextureHandle>::iterator it = batchTextures.find(path);
+		if (it != batchTextures.end())
+			return it->second;
+		bool created;
+		TextureHandle handle = TextureRegistry::get().acquire(path, created, contentHash);
+		if (created)
+			SpecifyTexture2D(handle->id, 1, 1, 4, &placeholderPixel);
+		batchTextures[path] = handle;
+		return handle;
+	}
+
+	void uploadImage(ReadyItem &item, map<string, TextureHandle> &textures)
+	{
+		TextureHandle handle = texture(item.image.path, item.contentHash);
+		// the same file may have been loaded under another path (content match) or by an earlier batch
+		if (!handle->loaded)
+		{
+			UploadTexture2D(handle->id, item.image);
+			TextureRegistry::get().markLoaded(handle);
+		}
+		if (!item.name.empty())
+			textures[item.name] = handle;
+	}
+
+	void uploadModel(ReadyItem &item, map<string, Model*> &models)
+	{
+		const ModelData &data = item.model;
+		Model *model = new Model(item.model, [this, &data](const string &path) {
+			return texture(TextureRegistry::canonicalPath(data.directory + '/' + path), data.textureHash(path));
+		}, false, item.residency);
+		models.insert(std::make_pair(item.name, model));
+	}
+};
+#endif
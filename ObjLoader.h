@@ -0,0 +1,623 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "MappedFile.h"
+#include "ImportArena.h"
+#include "StartupTracer.h"
+#include "ThreadPool.h"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+using namespace std;
+
+// Reader for the Wavefront OBJ/MTL subset our assets use (v/vt/vn, polygon faces, o/g, usemtl, mtllib), producing MeshData
+// straight from the mapped file. Large files are split into line-aligned chunks parsed on separate threads; the chunks are
+// stitched together afterwards (OBJ indices are global, only relative indices need the chunk's vertex offset) and the
+// meshes are assembled in parallel, one per object/material pair.
+// The result matches what Model::Import got from Assimp with aiProcess_Triangulate | aiProcess_FlipUVs |
+// aiProcess_CalcTangentSpace, except that identical face corners already share a vertex. Files using anything else
+// (lines, points, free-form geometry) or with broken indices make Load fail so the caller can fall back to Assimp.
+
+const size_t OBJ_CHUNK_SIZE = 1024 * 1024;	// files are parsed by one thread per this many bytes, up to the core count
+
+// fast decimal float parser for the plain [-]digits[.digits][e[-]digits] numbers exporters write
+inline const char* ParseObjFloat(const char *p, const char *end, float &value)
+{
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+		1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = *p++ == '-';
+	uint64_t mantissa = 0;
+	int exponent = 0, digits = 0;
+	const char *start = p;
+	for (; p < end && *p >= '0' && *p <= '9'; p++)
+	{
+		if (digits++ < 19)
+			mantissa = mantissa * 10 + (*p - '0');
+		else
+			exponent++;
+	}
+	if (p < end && *p == '.')
+	{
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+		{
+			if (digits++ < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				exponent--;
+			}
+		}
+	}
+	if (p == start)
+		return nullptr;
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char *e = p + 1;
+		bool negativeExponent = false;
+		if (e < end && (*e == '-' || *e == '+'))
+			negativeExponent = *e++ == '-';
+		int value = 0;
+		const char *digitsStart = e;
+		for (; e < end && *e >= '0' && *e <= '9'; e++)
+			value = value < 10000 ? value * 10 + (*e - '0') : value;
+		if (e != digitsStart)
+		{
+			exponent += negativeExponent ? -value : value;
+			p = e;
+		}
+	}
+	double result = (double)mantissa;
+	if (exponent < 0)
+		result = exponent >= -22 ? result / powers[-exponent] : result * std::pow(10.0, exponent);
+	else if (exponent > 0)
+		result = exponent <= 22 ? result * powers[exponent] : result * std::pow(10.0, exponent);
+	value = (float)(negative ? -result : result);
+	return p;
+}
+
+class ObjLoader
+{
+public:
+	// reads path into one MeshData per object/material pair. Returns false if the file can't be read or uses
+	// something this reader doesn't support.
+	static bool Load(const string &path, vector<MeshData> &meshes)
+	{
+		TRACE_SCOPE("import", "parse obj");
+		MappedFile file;
+		if (!file.open(path))
+			return false;
+		const char *data = (const char*)file.data();
+		size_t size = file.size();
+
+		// line aligned chunks, one per thread runParallel gets to use
+		unsigned int threads = ThreadPool::onWorker() ? 1 : std::thread::hardware_concurrency();
+		size_t chunkCount = size / OBJ_CHUNK_SIZE + 1;
+		if (threads > 0 && chunkCount > threads)
+			chunkCount = threads;
+		vector<Chunk> chunks(chunkCount);
+		size_t begin = 0;
+		for (size_t i = 0; i < chunkCount; i++)
+		{
+			size_t end = i + 1 == chunkCount ? size : (size / chunkCount) * (i + 1);
+			end = end < begin ? begin : end;
+			while (end < size && data[end - 1] != '\n')
+				end++;
+			chunks[i].begin = data + begin;
+			chunks[i].end = data + end;
+			begin = end;
+		}
+		runParallel(chunkCount, [&chunks](size_t i) { parseChunk(chunks[i]); });
+		for (size_t i = 0; i < chunkCount; i++)
+			if (!chunks[i].supported)
+				return false;
+
+		string directory = path.substr(0, path.find_last_of('/'));
+		Scene scene;
+		if (!stitch(chunks, directory, scene))
+			return false;
+
+		meshes.clear();
+		meshes.resize(scene.groups.size());
+		runParallel(scene.groups.size(), [&scene, &meshes](size_t i) { buildMesh(scene, scene.groups[i], meshes[i]); });
+		for (size_t i = 0; i < meshes.size(); )
+		{
+			if (meshes[i].indices.empty())
+				meshes.erase(meshes.begin() + i);
+			else
+				i++;
+		}
+		return !meshes.empty();
+	}
+
+private:
+	static const int MISSING = INT_MIN;
+
+	// one face corner as written in the file. Indices are 0-based and global unless the matching relative bit is set,
+	// in which case they count from the start of the chunk and still need its vertex offset.
+	struct Corner {
+		int position;
+		int texCoord;
+		int normal;
+		int relative;	// bit 0: position, bit 1: texCoord, bit 2: normal
+	};
+
+	// a run of triangles after an o/g or usemtl statement. Names are empty if the statement didn't change them.
+	struct Segment {
+		bool newObject;
+		string object;
+		bool newMaterial;
+		string material;
+		size_t firstCorner;
+	};
+
+	struct Chunk {
+		const char *begin;
+		const char *end;
+		vector<glm::vec3> positions;
+		vector<glm::vec2> texCoords;
+		vector<glm::vec3> normals;
+		vector<Corner> corners;				// three per triangle
+		vector<Segment> segments;
+		vector<string> libraries;
+		bool supported;
+
+		Chunk() : begin(nullptr), end(nullptr), supported(true) {}
+	};
+
+	struct Material {
+		vector<Texture> textures;
+	};
+
+	// triangles sharing object and material, referencing the stitched corner list
+	struct Group {
+		string material;
+		vector<size_t> ranges;				// [begin, end) pairs into Scene::corners
+	};
+
+	struct Scene {
+		vector<glm::vec3> positions;
+		vector<glm::vec2> texCoords;
+		vector<glm::vec3> normals;
+		vector<Corner> corners;
+		vector<Group> groups;
+		map<string, Material> materials;
+	};
+
+	template <typename Function>
+	static void runParallel(size_t count, const Function &function)
+	{
+		// a pool worker already has the other cores busy
+		if (count <= 1 || ThreadPool::onWorker())
+		{
+			for (size_t i = 0; i < count; i++)
+				function(i);
+			return;
+		}
+		// helpers count their allocations towards the import and get scratch arenas of their own
+		AllocationCounter *counter = AllocationCounter::current();
+		vector<std::thread> workers;
+		workers.reserve(count - 1);
+		for (size_t i = 1; i < count; i++)
+		{
+			workers.push_back(std::thread([&function, counter, i]() {
+				StartupTracer::get().nameThread("import helper");
+				AllocationCounter::Scope counting(counter);
+				ImportArena arena;
+				ImportArena::Scope scratch(&arena);
+				function(i);
+			}));
+		}
+		function(0);
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	static const char* skipSpace(const char *p, const char *end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+		return p;
+	}
+
+	static const char* lineEnd(const char *p, const char *end)
+	{
+		const char *newline = (const char*)memchr(p, '\n', end - p);
+		return newline ? newline : end;
+	}
+
+	// rest of the line without surrounding whitespace
+	static string restOfLine(const char *p, const char *end)
+	{
+		p = skipSpace(p, end);
+		while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+			end--;
+		return string(p, end);
+	}
+
+	static bool keyword(const char *p, const char *end, const char *word)
+	{
+		size_t length = strlen(word);
+		return (size_t)(end - p) > length && memcmp(p, word, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+	}
+
+	static const char* parseIndex(const char *p, const char *end, size_t count, int bit, int &index, int &relative)
+	{
+		bool negative = p < end && *p == '-';
+		if (negative)
+			p++;
+		long value = 0;
+		const char *start = p;
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+			value = value * 10 + (*p - '0');
+		if (p == start || value == 0 || value > INT_MAX)
+			return nullptr;
+		if (negative)
+		{
+			index = (int)((long)count - value);
+			relative |= bit;
+		}
+		else
+			index = (int)(value - 1);
+		return p;
+	}
+
+	static void parseChunk(Chunk &chunk)
+	{
+		TRACE_SCOPE("import", "parse chunk");
+		const char *p = chunk.begin;
+		const char *end = chunk.end;
+		vector<Corner> polygon;
+		while (p < end && chunk.supported)
+		{
+			p = skipSpace(p, end);
+			const char *eol = lineEnd(p, end);
+			const char *q = p;
+			if (q == eol || *q == '#' || *q == '\r')
+			{
+			}
+			else if (keyword(q, eol, "v"))
+			{
+				glm::vec3 v;
+				q = ParseObjFloat(q + 1, eol, v.x);
+				q = q ? ParseObjFloat(q, eol, v.y) : nullptr;
+				q = q ? ParseObjFloat(q, eol, v.z) : nullptr;
+				chunk.supported = q != nullptr;
+				chunk.positions.push_back(v);
+			}
+			else if (keyword(q, eol, "vt"))
+			{
+				glm::vec2 v;
+				q = ParseObjFloat(q + 2, eol, v.x);
+				// a missing v is 0, the optional w is ignored
+				const char *next = q ? ParseObjFloat(q, eol, v.y) : nullptr;
+				if (!next)
+					v.y = 0.0f;
+				chunk.supported = q != nullptr;
+				// same as aiProcess_FlipUVs
+				v.y = 1.0f - v.y;
+				chunk.texCoords.push_back(v);
+			}
+			else if (keyword(q, eol, "vn"))
+			{
+				glm::vec3 v;
+				q = ParseObjFloat(q + 2, eol, v.x);
+				q = q ? ParseObjFloat(q, eol, v.y) : nullptr;
+				q = q ? ParseObjFloat(q, eol, v.z) : nullptr;
+				chunk.supported = q != nullptr;
+				chunk.normals.push_back(v);
+			}
+			else if (keyword(q, eol, "f"))
+			{
+				polygon.clear();
+				q = skipSpace(q + 1, eol);
+				while (q && q < eol && *q != '\r')
+				{
+					Corner corner = { MISSING, MISSING, MISSING, 0 };
+					q = parseIndex(q, eol, chunk.positions.size(), 1, corner.position, corner.relative);
+					if (q && q < eol && *q == '/')
+					{
+						q++;
+						if (q < eol && *q != '/')
+							q = parseIndex(q, eol, chunk.texCoords.size(), 2, corner.texCoord, corner.relative);
+						if (q && q < eol && *q == '/')
+							q = parseIndex(q + 1, eol, chunk.normals.size(), 4, corner.normal, corner.relative);
+					}
+					if (q)
+						q = skipSpace(q, eol);
+					polygon.push_back(corner);
+				}
+				if (!q || polygon.size() < 3)
+					chunk.supported = false;
+				// fan triangulation, like aiProcess_Triangulate does for the convex polygons exporters write
+				for (size_t i = 2; i < polygon.size(); i++)
+				{
+					chunk.corners.push_back(polygon[0]);
+					chunk.corners.push_back(polygon[i - 1]);
+					chunk.corners.push_back(polygon[i]);
+				}
+			}
+			else if (keyword(q, eol, "o") || keyword(q, eol, "g"))
+				chunk.segments.push_back(Segment{ true, restOfLine(q + 1, eol), false, "", chunk.corners.size() });
+			else if (keyword(q, eol, "usemtl"))
+				chunk.segments.push_back(Segment{ false, "", true, restOfLine(q + 6, eol), chunk.corners.size() });
+			else if (keyword(q, eol, "mtllib"))
+				chunk.libraries.push_back(restOfLine(q + 6, eol));
+			else if (keyword(q, eol, "s"))
+			{
+				// smoothing groups only matter for generated normals
+			}
+			else
+				chunk.supported = false;
+			p = eol + 1;
+		}
+	}
+
+	// concatenates the chunks, resolves relative indices and groups the triangles by object and material
+	static bool stitch(vector<Chunk> &chunks, const string &directory, Scene &scene)
+	{
+		size_t positionCount = 0, texCoordCount = 0, normalCount = 0, cornerCount = 0;
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			positionCount += chunks[i].positions.size();
+			texCoordCount += chunks[i].texCoords.size();
+			normalCount += chunks[i].normals.size();
+			cornerCount += chunks[i].corners.size();
+		}
+		scene.positions.reserve(positionCount);
+		scene.texCoords.reserve(texCoordCount);
+		scene.normals.reserve(normalCount);
+		scene.corners.reserve(cornerCount);
+
+		map<pair<string, string>, size_t> groupIndex;
+		string object, material;
+		size_t group = SIZE_MAX;
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			Chunk &chunk = chunks[i];
+			int positionOffset = (int)scene.positions.size();
+			int texCoordOffset = (int)scene.texCoords.size();
+			int normalOffset = (int)scene.normals.size();
+			scene.positions.insert(scene.positions.end(), chunk.positions.begin(), chunk.positions.end());
+			scene.texCoords.insert(scene.texCoords.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+			scene.normals.insert(scene.normals.end(), chunk.normals.begin(), chunk.normals.end());
+			for (size_t l = 0; l < chunk.libraries.size(); l++)
+				loadMaterials(directory + '/' + chunk.libraries[l], scene.materials);
+
+			size_t base = scene.corners.size();
+			for (size_t c = 0; c < chunk.corners.size(); c++)
+			{
+				Corner corner = chunk.corners[c];
+				if (corner.relative & 1)
+					corner.position += positionOffset;
+				if (corner.relative & 2)
+					corner.texCoord += texCoordOffset;
+				if (corner.relative & 4)
+					corner.normal += normalOffset;
+				corner.relative = 0;
+				if (corner.position < 0 || corner.position >= (int)positionCount ||
+					(corner.texCoord != MISSING && (corner.texCoord < 0 || corner.texCoord >= (int)texCoordCount)) ||
+					(corner.normal != MISSING && (corner.normal < 0 || corner.normal >= (int)normalCount)))
+					return false;
+				scene.corners.push_back(corner);
+			}
+
+			// triangles before the chunk's first statement continue the previous chunk's group
+			size_t segmentStart = 0;
+			for (size_t s = 0; s <= chunk.segments.size(); s++)
+			{
+				size_t segmentEnd = s < chunk.segments.size() ? chunk.segments[s].firstCorner : chunk.corners.size();
+				if (segmentEnd > segmentStart)
+				{
+					if (group == SIZE_MAX)
+					{
+						pair<string, string> key(object, material);
+						map<pair<string, string>, size_t>::iterator it = groupIndex.find(key);
+						if (it == groupIndex.end())
+						{
+							it = groupIndex.insert(std::make_pair(key, scene.groups.size())).first;
+							scene.groups.push_back(Group());
+							scene.groups.back().material = material;
+						}
+						group = it->second;
+					}
+					scene.groups[group].ranges.push_back(base + segmentStart);
+					scene.groups[group].ranges.push_back(base + segmentEnd);
+				}
+				if (s < chunk.segments.size())
+				{
+					if (chunk.segments[s].newObject)
+						object = chunk.segments[s].object;
+					if (chunk.segments[s].newMaterial)
+						material = chunk.segments[s].material;
+					group = SIZE_MAX;
+				}
+				segmentStart = segmentEnd;
+			}
+		}
+		return true;
+	}
+
+	// reads the texture maps of a material library. Texture types follow Assimp's OBJ mapping and Model::processMesh.
+	static void loadMaterials(const string &path, map<string, Material> &materials)
+	{
+		MappedFile file;
+		if (!file.open(path))
+		{
+			cout << "WARNING::OBJ_LOADER:: material library " << path << " not found" << endl;
+			return;
+		}
+		const char *p = (const char*)file.data();
+		const char *end = p + file.size();
+		Material *current = nullptr;
+		// one list per type so the textures end up in processMesh's order: diffuse, specular, normal, height
+		vector<Texture> maps[4];
+		static const char *typeNames[4] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+		while (p < end)
+		{
+			p = skipSpace(p, end);
+			const char *eol = lineEnd(p, end);
+			int type = -1;
+			const char *arguments = nullptr;
+			if (keyword(p, eol, "newmtl"))
+			{
+				if (current)
+					for (int t = 0; t < 4; t++)
+						current->textures.insert(current->textures.end(), maps[t].begin(), maps[t].end());
+				for (int t = 0; t < 4; t++)
+					maps[t].clear();
+				current = &materials[restOfLine(p + 6, eol)];
+				current->textures.clear();
+			}
+			else if (keyword(p, eol, "map_Kd"))
+				type = 0, arguments = p + 6;
+			else if (keyword(p, eol, "map_Ks"))
+				type = 1, arguments = p + 6;
+			else if (keyword(p, eol, "map_Bump") || keyword(p, eol, "map_bump"))
+				type = 2, arguments = p + 8;
+			else if (keyword(p, eol, "bump"))
+				type = 2, arguments = p + 4;
+			else if (keyword(p, eol, "map_Ka"))
+				type = 3, arguments = p + 6;
+			if (type >= 0 && current)
+			{
+				// options like "-bm 1.0" come before the file name, which is the last token
+				string line = restOfLine(arguments, eol);
+				size_t space = line.find_last_of(" \t");
+				Texture texture;
+				texture.id = 0;
+				texture.type = typeNames[type];
+				texture.path = space == string::npos ? line : line.substr(space + 1);
+				if (!texture.path.empty())
+					maps[type].push_back(texture);
+			}
+			p = eol + 1;
+		}
+		if (current)
+			for (int t = 0; t < 4; t++)
+				current->textures.insert(current->textures.end(), maps[t].begin(), maps[t].end());
+	}
+
+	struct CornerHash {
+		size_t operator()(const Corner &c) const
+		{
+			return ((size_t)c.position * 73856093u) ^ ((size_t)(unsigned int)c.texCoord * 19349663u) ^ ((size_t)(unsigned int)c.normal * 83492791u);
+		}
+	};
+	struct CornerEqual {
+		bool operator()(const Corner &a, const Corner &b) const
+		{
+			return a.position == b.position && a.texCoord == b.texCoord && a.normal == b.normal;
+		}
+	};
+
+	// one vertex per distinct position/texCoord/normal triple, plus flat normals and tangents where the file has none
+	static void buildMesh(const Scene &scene, const Group &group, MeshData &mesh)
+	{
+		TRACE_SCOPE("import", group.material);
+		map<string, Material>::const_iterator material = scene.materials.find(group.material);
+		if (material != scene.materials.end())
+			mesh.textures = material->second.textures;
+
+		size_t cornerCount = 0;
+		for (size_t r = 0; r < group.ranges.size(); r += 2)
+			cornerCount += group.ranges[r + 1] - group.ranges[r];
+		ImportArena::Rewind rewind;
+		ScratchMap<Corner, unsigned int, CornerHash, CornerEqual> unique;
+		unique.reserve(cornerCount);
+		vector<Vertex> &vertices = mesh.vertices;
+		vector<unsigned int> &indices = mesh.indices;
+		indices.reserve(cornerCount);
+		bool hasTexCoords = true;
+		for (size_t r = 0; r < group.ranges.size(); r += 2)
+		{
+			for (size_t c = group.ranges[r]; c < group.ranges[r + 1]; c += 3)
+			{
+				// corners without a normal get the face normal and a vertex of their own
+				glm::vec3 faceNormal = glm::cross(scene.positions[scene.corners[c + 1].position] - scene.positions[scene.corners[c].position],
+					scene.positions[scene.corners[c + 2].position] - scene.positions[scene.corners[c].position]);
+				float length = glm::length(faceNormal);
+				faceNormal = length > 0.0f ? faceNormal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+				for (int k = 0; k < 3; k++)
+				{
+					const Corner &corner = scene.corners[c + k];
+					hasTexCoords = hasTexCoords && corner.texCoord != MISSING;
+					if (corner.normal != MISSING)
+					{
+						auto inserted = unique.insert(std::make_pair(corner, (unsigned int)vertices.size()));
+						if (!inserted.second)
+						{
+							indices.push_back(inserted.first->second);
+							continue;
+						}
+					}
+					Vertex vertex;
+					vertex.Position = scene.positions[corner.position];
+					vertex.Normal = corner.normal != MISSING ? scene.normals[corner.normal] : faceNormal;
+					vertex.TexCoords = corner.texCoord != MISSING ? scene.texCoords[corner.texCoord] : glm::vec2(0.0f, 0.0f);
+					vertex.Tangent = glm::vec3(0.0f);
+					vertex.Bitangent = glm::vec3(0.0f);
+					vertex.Occlusion = 1.0f;
+					indices.push_back((unsigned int)vertices.size());
+					vertices.push_back(vertex);
+				}
+			}
+		}
+		if (hasTexCoords)
+			computeTangents(vertices, indices);
+	}
+
+	// per vertex tangent frames from the UV gradients of the surrounding triangles, orthogonalized against the normal
+	static void computeTangents(vector<Vertex> &vertices, const vector<unsigned int> &indices)
+	{
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			Vertex &v0 = vertices[indices[i]];
+			Vertex &v1 = vertices[indices[i + 1]];
+			Vertex &v2 = vertices[indices[i + 2]];
+			glm::vec3 edge1 = v1.Position - v0.Position;
+			glm::vec3 edge2 = v2.Position - v0.Position;
+			glm::vec2 deltaUV1 = v1.TexCoords - v0.TexCoords;
+			glm::vec2 deltaUV2 = v2.TexCoords - v0.TexCoords;
+			float determinant = deltaUV1.x * deltaUV2.y - deltaUV2.x * deltaUV1.y;
+			if (std::fabs(determinant) < 1e-12f)
+				continue;
+			float f = 1.0f / determinant;
+			glm::vec3 tangent = (edge1 * deltaUV2.y - edge2 * deltaUV1.y) * f;
+			glm::vec3 bitangent = (edge2 * deltaUV1.x - edge1 * deltaUV2.x) * f;
+			for (int k = 0; k < 3; k++)
+			{
+				vertices[indices[i + k]].Tangent += tangent;
+				vertices[indices[i + k]].Bitangent += bitangent;
+			}
+		}
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			Vertex &vertex = vertices[i];
+			glm::vec3 tangent = vertex.Tangent - vertex.Normal * glm::dot(vertex.Normal, vertex.Tangent);
+			float length = glm::length(tangent);
+			if (length < 1e-12f)
+			{
+				vertex.Tangent = glm::vec3(0.0f);
+				vertex.Bitangent = glm::vec3(0.0f);
+				continue;
+			}
+			vertex.Tangent = tangent / length;
+			float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+			vertex.Bitangent = glm::cross(vertex.Normal, vertex.Tangent) * handedness;
+		}
+	}
+};
+#endif
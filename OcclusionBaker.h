@@ -0,0 +1,382 @@
+#ifndef OCCLUSION_BAKER_H
+#define OCCLUSION_BAKER_H
+
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "ImportArena.h"
+#include "ThreadPool.h"
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+using namespace std;
+
+// Import-time ambient occlusion for static models. Every vertex casts OCCLUSION_RAYS cosine distributed rays over the
+// hemisphere around its normal against all triangles of the model (held in a bounding volume hierarchy), and stores the
+// share that escapes within OCCLUSION_RANGE in Vertex::Occlusion, which the lighting shader multiplies the ambient term
+// with. Runs once per cache miss on all cores, the mesh cache keeps the result.
+const unsigned int OCCLUSION_RAYS = 64;
+const float OCCLUSION_RANGE = 0.1f;				// ray length as a fraction of the model's bounding box diagonal
+const float OCCLUSION_BIAS = 1e-4f;				// ray origin offset along the normal, same units
+const unsigned int OCCLUSION_LEAF_SIZE = 4;		// most triangles per BVH leaf
+const unsigned int OCCLUSION_SAH_BINS = 16;
+const unsigned int OCCLUSION_CHUNK = 256;		// vertices a worker takes at a time
+
+struct OcclusionStats {
+	size_t vertices;
+	size_t triangles;
+	float mean;		// average Occlusion over all vertices
+};
+
+// Bounding volume hierarchy over a triangle soup that only answers whether a ray segment hits anything. Built top-down
+// with binned SAH splits, nodes are stored depth first with the left child right after its parent.
+class OcclusionBvh
+{
+public:
+	void build(const vector<MeshData> &meshes)
+	{
+		size_t count = 0;
+		for (const MeshData &mesh : meshes)
+			count += mesh.indexCount() / 3;
+		triangles.clear();
+		triangles.reserve(count);
+		for (const MeshData &mesh : meshes)
+		{
+			const Vertex *vertices = mesh.vertexData();
+			const unsigned int *indices = mesh.indexData();
+			for (unsigned int i = 0; i + 2 < mesh.indexCount(); i += 3)
+			{
+				Triangle triangle;
+				triangle.v0 = vertices[indices[i]].Position;
+				triangle.edge1 = vertices[indices[i + 1]].Position - triangle.v0;
+				triangle.edge2 = vertices[indices[i + 2]].Position - triangle.v0;
+				triangles.push_back(triangle);
+			}
+		}
+
+		nodes.clear();
+		nodes.reserve(triangles.size() > 0 ? triangles.size() * 2 / OCCLUSION_LEAF_SIZE + 1 : 1);
+		ScratchVector<glm::vec3> centroids;
+		centroids.reserve(triangles.size());
+		for (const Triangle &triangle : triangles)
+			centroids.push_back(triangle.v0 + (triangle.edge1 + triangle.edge2) * (1.0f / 3.0f));
+		Node root;
+		root.first = 0;
+		root.count = (unsigned int)triangles.size();
+		nodes.push_back(root);
+		subdivide(0, centroids);
+	}
+
+	size_t triangleCount() const { return triangles.size(); }
+
+	// whether anything lies along origin + t * direction for t in (0, length]
+	bool occluded(const glm::vec3 &origin, const glm::vec3 &direction, float length) const
+	{
+		if (triangles.empty())
+			return false;
+		glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+		unsigned int stack[64];
+		unsigned int depth = 0;
+		stack[depth++] = 0;
+		while (depth > 0)
+		{
+			unsigned int index = stack[--depth];
+			const Node &node = nodes[index];
+			if (!hitsBox(node, origin, inverse, length))
+				continue;
+			if (node.count > 0)
+			{
+				for (unsigned int i = node.first; i < node.first + node.count; i++)
+				{
+					if (hitsTriangle(triangles[i], origin, direction, length))
+						return true;
+				}
+			}
+			else if (depth + 2 <= 64)
+			{
+				stack[depth++] = node.first;
+				stack[depth++] = index + 1;
+			}
+		}
+		return false;
+	}
+
+private:
+	struct Triangle {
+		glm::vec3 v0;
+		glm::vec3 edge1;
+		glm::vec3 edge2;
+	};
+
+	struct Node {
+		glm::vec3 low;
+		glm::vec3 high;
+		unsigned int first;		// first triangle of a leaf, right child of an interior node (the left one is next to it)
+		unsigned int count;		// triangles of a leaf, 0 for interior nodes
+	};
+
+	struct Bin {
+		glm::vec3 low;
+		glm::vec3 high;
+		unsigned int count;
+	};
+
+	ScratchVector<Triangle> triangles;
+	ScratchVector<Node> nodes;
+
+	static void grow(glm::vec3 &low, glm::vec3 &high, const Triangle &triangle)
+	{
+		low = glm::min(low, glm::min(triangle.v0, glm::min(triangle.v0 + triangle.edge1, triangle.v0 + triangle.edge2)));
+		high = glm::max(high, glm::max(triangle.v0, glm::max(triangle.v0 + triangle.edge1, triangle.v0 + triangle.edge2)));
+	}
+
+	static float area(const glm::vec3 &low, const glm::vec3 &high)
+	{
+		glm::vec3 extent = glm::max(high - low, glm::vec3(0.0f));
+		return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+	}
+
+	// fits the bounds of node and splits it while that lowers the SAH cost. Recursion depth is bounded by the
+	// traversal stack: a split always leaves triangles on both sides and stops when nothing separates the centroids.
+	void subdivide(unsigned int index, ScratchVector<glm::vec3> &centroids, unsigned int level = 0)
+	{
+		Node node = nodes[index];
+		glm::vec3 low(INFINITY), high(-INFINITY), centroidLow(INFINITY), centroidHigh(-INFINITY);
+		for (unsigned int i = node.first; i < node.first + node.count; i++)
+		{
+			grow(low, high, triangles[i]);
+			centroidLow = glm::min(centroidLow, centroids[i]);
+			centroidHigh = glm::max(centroidHigh, centroids[i]);
+		}
+		nodes[index].low = low;
+		nodes[index].high = high;
+		if (node.count <= OCCLUSION_LEAF_SIZE || level >= 60)
+			return;
+
+		glm::vec3 extent = centroidHigh - centroidLow;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		if (extent[axis] <= 0.0f)
+			return;
+
+		Bin bins[OCCLUSION_SAH_BINS];
+		for (unsigned int b = 0; b < OCCLUSION_SAH_BINS; b++)
+		{
+			bins[b].low = glm::vec3(INFINITY);
+			bins[b].high = glm::vec3(-INFINITY);
+			bins[b].count = 0;
+		}
+		float scale = OCCLUSION_SAH_BINS / extent[axis];
+		for (unsigned int i = node.first; i < node.first + node.count; i++)
+		{
+			unsigned int b = std::min(OCCLUSION_SAH_BINS - 1, (unsigned int)((centroids[i][axis] - centroidLow[axis]) * scale));
+			grow(bins[b].low, bins[b].high, triangles[i]);
+			bins[b].count++;
+		}
+
+		// cost of splitting after each bin, swept from both sides
+		float leftCost[OCCLUSION_SAH_BINS - 1];
+		glm::vec3 sweepLow(INFINITY), sweepHigh(-INFINITY);
+		unsigned int sweepCount = 0;
+		for (unsigned int b = 0; b + 1 < OCCLUSION_SAH_BINS; b++)
+		{
+			sweepLow = glm::min(sweepLow, bins[b].low);
+			sweepHigh = glm::max(sweepHigh, bins[b].high);
+			sweepCount += bins[b].count;
+			leftCost[b] = sweepCount > 0 ? area(sweepLow, sweepHigh) * sweepCount : 0.0f;
+		}
+		float bestCost = INFINITY;
+		unsigned int bestSplit = 0;
+		sweepLow = glm::vec3(INFINITY);
+		sweepHigh = glm::vec3(-INFINITY);
+		sweepCount = 0;
+		for (unsigned int b = OCCLUSION_SAH_BINS - 1; b > 0; b--)
+		{
+			sweepLow = glm::min(sweepLow, bins[b].low);
+			sweepHigh = glm::max(sweepHigh, bins[b].high);
+			sweepCount += bins[b].count;
+			float cost = leftCost[b - 1] + (sweepCount > 0 ? area(sweepLow, sweepHigh) * sweepCount : 0.0f);
+			if (sweepCount > 0 && sweepCount < node.count && cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+		if (bestSplit == 0 || bestCost >= area(low, high) * node.count)
+			return;
+
+		// partition the triangles (and their centroids) around the split
+		unsigned int middle = node.first;
+		for (unsigned int i = node.first; i < node.first + node.count; i++)
+		{
+			unsigned int b = std::min(OCCLUSION_SAH_BINS - 1, (unsigned int)((centroids[i][axis] - centroidLow[axis]) * scale));
+			if (b < bestSplit)
+			{
+				std::swap(triangles[i], triangles[middle]);
+				std::swap(centroids[i], centroids[middle]);
+				middle++;
+			}
+		}
+
+		Node left, right;
+		left.first = node.first;
+		left.count = middle - node.first;
+		right.first = middle;
+		right.count = node.first + node.count - middle;
+		unsigned int leftIndex = (unsigned int)nodes.size();
+		nodes.push_back(left);
+		subdivide(leftIndex, centroids, level + 1);
+		unsigned int rightIndex = (unsigned int)nodes.size();
+		nodes.push_back(right);
+		subdivide(rightIndex, centroids, level + 1);
+		nodes[index].first = rightIndex;
+		nodes[index].count = 0;
+	}
+
+	static bool hitsBox(const Node &node, const glm::vec3 &origin, const glm::vec3 &inverse, float length)
+	{
+		glm::vec3 t0 = (node.low - origin) * inverse;
+		glm::vec3 t1 = (node.high - origin) * inverse;
+		glm::vec3 first = glm::min(t0, t1), last = glm::max(t0, t1);
+		float enter = std::max(std::max(first.x, first.y), std::max(first.z, 0.0f));
+		float exit = std::min(std::min(last.x, last.y), std::min(last.z, length));
+		return enter <= exit;
+	}
+
+	// Moller-Trumbore, both sides count
+	static bool hitsTriangle(const Triangle &triangle, const glm::vec3 &origin, const glm::vec3 &direction, float length)
+	{
+		glm::vec3 p = glm::cross(direction, triangle.edge2);
+		float determinant = glm::dot(triangle.edge1, p);
+		if (std::fabs(determinant) < 1e-12f)
+			return false;
+		float inverse = 1.0f / determinant;
+		glm::vec3 s = origin - triangle.v0;
+		float u = glm::dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		glm::vec3 q = glm::cross(s, triangle.edge1);
+		float v = glm::dot(direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		float t = glm::dot(triangle.edge2, q) * inverse;
+		return t > 0.0f && t <= length;
+	}
+};
+
+// i-th of count points of the Hammersley set in [0, 1)^2
+inline glm::vec2 HammersleyPoint(unsigned int i, unsigned int count)
+{
+	uint32_t bits = i;
+	bits = (bits << 16) | (bits >> 16);
+	bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+	bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+	bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+	bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+	return glm::vec2((float)i / count, bits * 2.3283064365386963e-10f);
+}
+
+// share of the hemisphere above a surface point that is open within range. The ray pattern is rotated per vertex
+// (seed) so neighbouring vertices don't all miss the same features.
+inline float VertexOcclusion(const OcclusionBvh &bvh, const glm::vec3 &position, const glm::vec3 &normal, float range, float bias,
+	uint32_t seed)
+{
+	float length = glm::length(normal);
+	if (length <= 0.0f)
+		return 1.0f;
+	glm::vec3 n = normal / length;
+	// orthonormal basis around n (Duff et al.)
+	float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+	float a = -1.0f / (sign + n.z);
+	float b = n.x * n.y * a;
+	glm::vec3 tangent(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+	glm::vec3 bitangent(b, sign + n.y * n.y * a, -n.y);
+
+	seed = seed * 747796405u + 2891336453u;
+	glm::vec2 rotation((seed >> 8) * (1.0f / 16777216.0f), ((seed * 2654435761u) >> 8) * (1.0f / 16777216.0f));
+	glm::vec3 origin = position + n * bias;
+	unsigned int open = 0;
+	for (unsigned int i = 0; i < OCCLUSION_RAYS; i++)
+	{
+		glm::vec2 sample = HammersleyPoint(i, OCCLUSION_RAYS) + rotation;
+		sample.x -= std::floor(sample.x);
+		sample.y -= std::floor(sample.y);
+		// cosine weighted, so the open share is the cosine weighted visibility
+		float radius = std::sqrt(sample.x);
+		float angle = 6.28318531f * sample.y;
+		glm::vec3 direction = tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) +
+			n * std::sqrt(std::max(0.0f, 1.0f - sample.x));
+		if (!bvh.occluded(origin, direction, range))
+			open++;
+	}
+	return (float)open / OCCLUSION_RAYS;
+}
+
+// bakes Vertex::Occlusion for every vertex of meshes (which must own their arrays), each mesh shadowing the others
+inline OcclusionStats BakeOcclusion(vector<MeshData> &meshes)
+{
+	OcclusionStats stats = { 0, 0, 1.0f };
+	glm::vec3 low(INFINITY), high(-INFINITY);
+	ScratchVector<size_t> firstVertex;
+	firstVertex.reserve(meshes.size() + 1);
+	for (const MeshData &mesh : meshes)
+	{
+		firstVertex.push_back(stats.vertices);
+		stats.vertices += mesh.vertices.size();
+		for (const Vertex &vertex : mesh.vertices)
+		{
+			low = glm::min(low, vertex.Position);
+			high = glm::max(high, vertex.Position);
+		}
+	}
+	firstVertex.push_back(stats.vertices);
+	if (stats.vertices == 0)
+		return stats;
+	float diagonal = glm::length(high - low);
+
+	OcclusionBvh bvh;
+	bvh.build(meshes);
+	stats.triangles = bvh.triangleCount();
+
+	// workers take chunks of the vertices of all meshes in turn
+	std::atomic<size_t> next(0);
+	auto work = [&]() {
+		for (;;)
+		{
+			size_t begin = next.fetch_add(OCCLUSION_CHUNK);
+			if (begin >= stats.vertices)
+				return;
+			size_t end = std::min(begin + OCCLUSION_CHUNK, stats.vertices);
+			size_t m = std::upper_bound(firstVertex.begin(), firstVertex.end(), begin) - firstVertex.begin() - 1;
+			for (size_t i = begin; i < end; i++)
+			{
+				while (i >= firstVertex[m + 1])
+					m++;
+				Vertex &vertex = meshes[m].vertices[i - firstVertex[m]];
+				vertex.Occlusion = VertexOcclusion(bvh, vertex.Position, vertex.Normal, diagonal * OCCLUSION_RANGE,
+					diagonal * OCCLUSION_BIAS, (uint32_t)i);
+			}
+		}
+	};
+	// a pool worker already has the other cores busy
+	unsigned int threads = ThreadPool::onWorker() ? 1 : std::max(1u, std::thread::hardware_concurrency());
+	threads = (unsigned int)std::max<size_t>(1, std::min<size_t>(threads, (stats.vertices + OCCLUSION_CHUNK - 1) / OCCLUSION_CHUNK));
+	vector<std::thread> workers;
+	workers.reserve(threads - 1);
+	for (unsigned int i = 1; i < threads; i++)
+		workers.push_back(std::thread(work));
+	work();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	double sum = 0.0;
+	for (const MeshData &mesh : meshes)
+		for (const Vertex &vertex : mesh.vertices)
+			sum += vertex.Occlusion;
+	stats.mean = (float)(sum / stats.vertices);
+	return stats;
+}
+#endif
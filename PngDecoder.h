@@ -0,0 +1,681 @@
+#ifndef PNG_DECODER_H
+#define PNG_DECODER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+// Fast path for the PNGs the scene ships: 8 and 16 bit gray, gray-alpha, RGB and RGBA without interlacing or a tRNS
+// chunk. It produces exactly what stb_image does for them (16 bit samples keep their high byte, like stb's conversion
+// to 8 bits), and returns null for everything else, including any file it finds damaged, so the caller falls back
+// to stb_image and its error reporting.
+// The inflater decodes litlen codes through an 11 bit table whose entries can hold two literals at once and refills
+// a 64 bit bit buffer eight bytes at a time; the unfilter runs Sub, Avg and Paeth a pixel at a time in SSE2 registers
+// (Up 16 bytes at a time) for the 3 to 8 byte pixels, and scalar for the rest.
+// bake verify-png checks the decoder against stb_image on any set of files.
+const bool PNG_FAST_DECODE = true;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PNG_DECODER_SSE2
+#include <emmintrin.h>
+#endif
+
+const int PNG_FAST_BITS = 11;				// litlen and distance codes up to this long decode with one table lookup
+const unsigned int PNG_MAX_DIMENSION = 1 << 24;	// stb_image's limit
+const size_t PNG_PADDING = 16;				// readable bytes past the end of the compressed and inflated buffers
+
+class PngInflater
+{
+public:
+	// inflates a zlib stream into exactly size bytes, false if it's damaged or doesn't produce that many
+	static bool inflate(const unsigned char *data, size_t length, unsigned char *out, size_t size)
+	{
+		if (length < 2 || (data[0] & 15) != 8 || (data[0] * 256 + data[1]) % 31 != 0 || (data[1] & 32))
+			return false;
+		PngInflater inflater(data + 2, length - 2, out, size);
+		return inflater.run();
+	}
+
+private:
+	// Canonical Huffman code. fast holds (symbol << 4) | length for codes up to PNG_FAST_BITS long indexed by their
+	// bit reversed code, longer codes are found from the first code of each length like stb_image does.
+	struct Huffman {
+		uint16_t fast[1 << PNG_FAST_BITS];
+		uint16_t firstCode[17];
+		uint16_t firstSymbol[17];
+		uint32_t maxCode[18];
+		uint8_t lengths[288];
+		uint16_t symbols[288];
+
+		bool build(const uint8_t *codeLengths, int count)
+		{
+			int counts[17] = { 0 };
+			memset(fast, 0, sizeof(fast));
+			memset(symbols, 0, sizeof(symbols));
+			for (int i = 0; i < count; i++)
+				counts[codeLengths[i]]++;
+			counts[0] = 0;
+			int nextCode[16];
+			int code = 0, symbol = 0;
+			for (int length = 1; length < 16; length++)
+			{
+				nextCode[length] = code;
+				firstCode[length] = (uint16_t)code;
+				firstSymbol[length] = (uint16_t)symbol;
+				code += counts[length];
+				if (counts[length] && code - 1 >= (1 << length))
+					return false;
+				maxCode[length] = (uint32_t)code << (16 - length);
+				code <<= 1;
+				symbol += counts[length];
+			}
+			maxCode[16] = 0x10000;
+			for (int i = 0; i < count; i++)
+			{
+				int length = codeLengths[i];
+				lengths[i] = (uint8_t)length;
+				if (!length)
+					continue;
+				symbols[firstSymbol[length] + nextCode[length] - firstCode[length]] = (uint16_t)i;
+				if (length <= PNG_FAST_BITS)
+				{
+					for (int j = reverse(nextCode[length], length); j < (1 << PNG_FAST_BITS); j += 1 << length)
+						fast[j] = (uint16_t)((i << 4) | length);
+				}
+				nextCode[length]++;
+			}
+			return true;
+		}
+
+		// the symbol at the front of bits and its length, false for codes that aren't in the table
+		bool decodeSlow(uint64_t bits, int &symbol, int &length) const
+		{
+			int code = reverse((int)(bits & 0xffff), 16);
+			for (length = PNG_FAST_BITS + 1; length < 16; length++)
+				if ((uint32_t)code < maxCode[length])
+					break;
+			if (length >= 16)
+				return false;
+			int index = (code >> (16 - length)) - firstCode[length] + firstSymbol[length];
+			if (index < 0 || index >= 288 || lengths[symbols[index]] != length)
+				return false;
+			symbol = symbols[index];
+			return true;
+		}
+	};
+
+	// litlen table entries: the bits consumed in the low 5 bits, then the kind. Literal entries hold one or two
+	// bytes, length entries the base length and extra bit count of their symbol. Zero sends the lookup to decodeSlow.
+	enum {
+		ENTRY_LITERAL = 1 << 5,
+		ENTRY_PAIR = 1 << 6,
+		ENTRY_LENGTH = 1 << 7,
+		ENTRY_END = 1 << 8,
+		ENTRY_INVALID = 1 << 9
+	};
+
+	const unsigned char *in;
+	const unsigned char *inEnd;			// end of the stream's bytes
+	const unsigned char *inLimit;		// end of the readable padding after them
+	uint64_t bits;
+	unsigned int count;
+	unsigned char *out;
+	unsigned char *outStart;
+	unsigned char *outEnd;
+	Huffman literals;
+	Huffman distances;
+	uint32_t literalTable[1 << PNG_FAST_BITS];
+
+	PngInflater(const unsigned char *data, size_t length, unsigned char *out, size_t size)
+		: in(data), inEnd(data + length), inLimit(data + length + PNG_PADDING), bits(0), count(0),
+		out(out), outStart(out), outEnd(out + size)
+	{
+	}
+
+	static int reverse(int code, int length)
+	{
+		int reversed = 0;
+		for (int i = 0; i < length; i++, code >>= 1)
+			reversed = (reversed << 1) | (code & 1);
+		return reversed;
+	}
+
+	// tops the bit buffer up to at least 56 bits. Bits past count may already hold the following bytes, ORing them
+	// in again doesn't change them. Loads are little endian, like every target this builds for.
+	void refill()
+	{
+		if (inLimit - in >= 8)
+		{
+			uint64_t next;
+			memcpy(&next, in, 8);
+			bits |= next << count;
+			in += (63 - count) >> 3;
+			count |= 56;
+			return;
+		}
+		while (count <= 56)
+		{
+			bits |= (uint64_t)(in < inLimit ? *in : 0) << count;
+			in++;
+			count += 8;
+		}
+	}
+
+	void consume(unsigned int n)
+	{
+		bits >>= n;
+		count -= n;
+	}
+
+	unsigned int take(unsigned int n)
+	{
+		unsigned int value = (unsigned int)(bits & ((1ull << n) - 1));
+		consume(n);
+		return value;
+	}
+
+	bool run()
+	{
+		bool last = false;
+		while (!last)
+		{
+			refill();
+			last = take(1) != 0;
+			unsigned int type = take(2);
+			bool ok;
+			if (type == 0)
+				ok = stored();
+			else if (type == 1)
+				ok = fixedCodes() && codes();
+			else if (type == 2)
+				ok = dynamicCodes() && codes();
+			else
+				ok = false;
+			if (!ok)
+				return false;
+		}
+		// every byte of the image, and no more input than there was
+		return out == outEnd && in - (count >> 3) <= inEnd;
+	}
+
+	bool stored()
+	{
+		// drop to the byte boundary and hand the buffered bytes back to the input
+		consume(count & 7);
+		in -= count >> 3;
+		bits = 0;
+		count = 0;
+		if (inEnd - in < 4)
+			return false;
+		unsigned int length = in[0] | (in[1] << 8);
+		unsigned int inverse = in[2] | (in[3] << 8);
+		in += 4;
+		if ((length ^ 0xffff) != inverse || (size_t)(inEnd - in) < length || (size_t)(outEnd - out) < length)
+			return false;
+		memcpy(out, in, length);
+		out += length;
+		in += length;
+		return true;
+	}
+
+	bool fixedCodes()
+	{
+		uint8_t lengths[288 + 32];
+		memset(lengths, 8, 144);
+		memset(lengths + 144, 9, 112);
+		memset(lengths + 256, 7, 24);
+		memset(lengths + 280, 8, 8);
+		memset(lengths + 288, 5, 32);
+		return literals.build(lengths, 288) && distances.build(lengths + 288, 32) && buildLiteralTable();
+	}
+
+	bool dynamicCodes()
+	{
+		static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+		refill();
+		unsigned int literalCount = take(5) + 257;
+		unsigned int distanceCount = take(5) + 1;
+		unsigned int lengthCount = take(4) + 4;
+		uint8_t codeLengths[19] = { 0 };
+		for (unsigned int i = 0; i < lengthCount; i++)
+		{
+			refill();
+			codeLengths[order[i]] = (uint8_t)take(3);
+		}
+		Huffman lengthCode;
+		if (!lengthCode.build(codeLengths, 19))
+			return false;
+
+		uint8_t lengths[288 + 32];
+		unsigned int total = literalCount + distanceCount, n = 0;
+		while (n < total)
+		{
+			refill();
+			int symbol, length;
+			uint16_t entry = lengthCode.fast[bits & ((1 << PNG_FAST_BITS) - 1)];
+			if (!entry)
+				return false;
+			symbol = entry >> 4;
+			length = entry & 15;
+			consume(length);
+			if (symbol < 16)
+			{
+				lengths[n++] = (uint8_t)symbol;
+				continue;
+			}
+			unsigned int repeat;
+			uint8_t value = 0;
+			if (symbol == 16)
+			{
+				if (n == 0)
+					return false;
+				repeat = take(2) + 3;
+				value = lengths[n - 1];
+			}
+			else if (symbol == 17)
+				repeat = take(3) + 3;
+			else
+				repeat = take(7) + 11;
+			if (total - n < repeat)
+				return false;
+			memset(lengths + n, value, repeat);
+			n += repeat;
+		}
+		if (literalCount > 286 || distanceCount > 30 || lengths[256] == 0)
+			return false;
+		return literals.build(lengths, literalCount) && distances.build(lengths + literalCount, distanceCount) &&
+			buildLiteralTable();
+	}
+
+	// resolves the litlen fast table into entries the decode loop can use directly, pairing two literals whenever
+	// both codes fit into the table's bits together
+	bool buildLiteralTable()
+	{
+		static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+			67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+			5, 5, 5, 5, 0 };
+		for (int i = 0; i < (1 << PNG_FAST_BITS); i++)
+		{
+			uint16_t code = literals.fast[i];
+			if (!code)
+			{
+				literalTable[i] = 0;
+				continue;
+			}
+			uint32_t symbol = code >> 4, length = code & 15;
+			if (symbol < 256)
+				literalTable[i] = length | ENTRY_LITERAL | (symbol << 16);
+			else if (symbol == 256)
+				literalTable[i] = length | ENTRY_END;
+			else if (symbol < 286)
+				literalTable[i] = length | ENTRY_LENGTH | (lengthBase[symbol - 257] << 16) | (lengthExtra[symbol - 257] << 10);
+			else
+				literalTable[i] = length | ENTRY_INVALID;
+		}
+		// downwards, so the entry that follows a literal (at a lower index) is still a single one
+		for (int i = (1 << PNG_FAST_BITS) - 1; i >= 0; i--)
+		{
+			uint32_t first = literalTable[i];
+			if (!(first & ENTRY_LITERAL))
+				continue;
+			uint32_t firstLength = first & 31;
+			uint32_t second = literalTable[i >> firstLength];
+			uint32_t secondLength = second & 31;
+			if ((second & ENTRY_LITERAL) && firstLength + secondLength <= PNG_FAST_BITS)
+				literalTable[i] = (firstLength + secondLength) | ENTRY_LITERAL | ENTRY_PAIR | (first & 0xff0000) |
+					((second & 0xff0000) << 8);
+		}
+		return true;
+	}
+
+	// the next distance, 0 if the code is invalid
+	unsigned int distance()
+	{
+		static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385,
+			513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		static const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10,
+			10, 11, 11, 12, 12, 13, 13 };
+		int symbol, length;
+		uint16_t entry = distances.fast[bits & ((1 << PNG_FAST_BITS) - 1)];
+		if (entry)
+		{
+			symbol = entry >> 4;
+			length = entry & 15;
+		}
+		else if (!distances.decodeSlow(bits, symbol, length))
+			return 0;
+		if (symbol >= 30)
+			return 0;
+		consume(length);
+		return distanceBase[symbol] + take(distanceExtra[symbol]);
+	}
+
+	// one block of Huffman coded data. Each iteration refills once: a litlen code with its extra bits and a
+	// distance code with its extra bits take at most 48 of the 56 bits.
+	bool codes()
+	{
+		static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+			67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+			5, 5, 5, 5, 0 };
+		const uint32_t mask = (1 << PNG_FAST_BITS) - 1;
+		for (;;)
+		{
+			refill();
+			uint32_t entry = literalTable[bits & mask];
+			if (entry & ENTRY_LITERAL)
+			{
+				consume(entry & 31);
+				if (outEnd - out >= 2)
+				{
+					out[0] = (unsigned char)(entry >> 16);
+					out[1] = (unsigned char)(entry >> 24);
+					out += (entry & ENTRY_PAIR) ? 2 : 1;
+					continue;
+				}
+				if (out == outEnd || (entry & ENTRY_PAIR))
+					return false;
+				*out++ = (unsigned char)(entry >> 16);
+				continue;
+			}
+
+			unsigned int length;
+			if (entry & ENTRY_LENGTH)
+			{
+				consume(entry & 31);
+				length = (entry >> 16) + take((entry >> 10) & 7);
+			}
+			else if (entry & ENTRY_END)
+			{
+				consume(entry & 31);
+				return true;
+			}
+			else if (entry & ENTRY_INVALID)
+				return false;
+			else
+			{
+				int symbol, codeLength;
+				if (!literals.decodeSlow(bits, symbol, codeLength) || symbol >= 286)
+					return false;
+				consume(codeLength);
+				if (symbol < 256)
+				{
+					if (out == outEnd)
+						return false;
+					*out++ = (unsigned char)symbol;
+					continue;
+				}
+				if (symbol == 256)
+					return true;
+				length = lengthBase[symbol - 257] + take(lengthExtra[symbol - 257]);
+			}
+
+			unsigned int offset = distance();
+			if (offset == 0 || offset > (size_t)(out - outStart) || length > (size_t)(outEnd - out))
+				return false;
+			copy(offset, length);
+		}
+	}
+
+	// copies a match. The output buffer has PNG_PADDING bytes after outEnd, so whole 8 byte chunks may run past
+	// the match as long as they start inside it; they only touch bytes that aren't written yet.
+	void copy(unsigned int offset, unsigned int length)
+	{
+		const unsigned char *from = out - offset;
+		unsigned char *to = out;
+		out += length;
+		if (offset >= 8)
+		{
+			do {
+				memcpy(to, from, 8);
+				to += 8;
+				from += 8;
+			} while (to < out);
+		}
+		else if (offset == 1)
+			memset(to, *from, length);
+		else
+		{
+			while (length--)
+				*to++ = *from++;
+		}
+	}
+};
+
+#ifdef PNG_DECODER_SSE2
+// one pixel of up to 8 bytes in the low lanes of a register
+template<int Bpp> inline __m128i PngLoadPixel(const unsigned char *p)
+{
+	uint64_t value = 0;
+	memcpy(&value, p, Bpp);
+	return _mm_loadl_epi64((const __m128i*)&value);
+}
+
+template<int Bpp> inline void PngStorePixel(unsigned char *p, __m128i pixel)
+{
+	uint64_t value;
+	_mm_storel_epi64((__m128i*)&value, pixel);
+	memcpy(p, &value, Bpp);
+}
+
+template<int Bpp> inline void PngUnfilterSse2(int filter, const unsigned char *src, unsigned char *dst,
+	const unsigned char *prior, size_t rowBytes)
+{
+	__m128i left = _mm_setzero_si128();
+	if (filter == 1)
+	{
+		for (size_t i = 0; i < rowBytes; i += Bpp)
+		{
+			left = _mm_add_epi8(PngLoadPixel<Bpp>(src + i), left);
+			PngStorePixel<Bpp>(dst + i, left);
+		}
+	}
+	else if (filter == 3)
+	{
+		// _mm_avg_epu8 rounds up, (a + b) >> 1 doesn't
+		const __m128i one = _mm_set1_epi8(1);
+		for (size_t i = 0; i < rowBytes; i += Bpp)
+		{
+			__m128i up = PngLoadPixel<Bpp>(prior + i);
+			__m128i average = _mm_sub_epi8(_mm_avg_epu8(left, up), _mm_and_si128(_mm_xor_si128(left, up), one));
+			left = _mm_add_epi8(PngLoadPixel<Bpp>(src + i), average);
+			PngStorePixel<Bpp>(dst + i, left);
+		}
+	}
+	else
+	{
+		// Paeth in 16 bit lanes: pa = |b - c|, pb = |a - c|, pc = |a + b - 2c|, the first of a, b, c with the least
+		const __m128i zero = _mm_setzero_si128();
+		__m128i a = zero, c = zero;
+		for (size_t i = 0; i < rowBytes; i += Bpp)
+		{
+			__m128i b = _mm_unpacklo_epi8(PngLoadPixel<Bpp>(prior + i), zero);
+			__m128i bc = _mm_sub_epi16(b, c);
+			__m128i ac = _mm_sub_epi16(a, c);
+			__m128i pa = _mm_max_epi16(bc, _mm_sub_epi16(zero, bc));
+			__m128i pb = _mm_max_epi16(ac, _mm_sub_epi16(zero, ac));
+			__m128i abc = _mm_add_epi16(ac, bc);
+			__m128i pc = _mm_max_epi16(abc, _mm_sub_epi16(zero, abc));
+			__m128i least = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			__m128i pickA = _mm_cmpeq_epi16(pa, least);
+			__m128i pickB = _mm_andnot_si128(pickA, _mm_cmpeq_epi16(pb, least));
+			__m128i pickC = _mm_andnot_si128(_mm_or_si128(pickA, pickB), _mm_cmpeq_epi16(zero, zero));
+			__m128i predictor = _mm_or_si128(_mm_or_si128(_mm_and_si128(pickA, a), _mm_and_si128(pickB, b)),
+				_mm_and_si128(pickC, c));
+			__m128i pixel = _mm_add_epi8(PngLoadPixel<Bpp>(src + i), _mm_packus_epi16(predictor, zero));
+			PngStorePixel<Bpp>(dst + i, pixel);
+			a = _mm_unpacklo_epi8(pixel, zero);
+			c = b;
+		}
+	}
+}
+#endif
+
+inline unsigned char PngPaeth(int a, int b, int c)
+{
+	int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+	if (pa <= pb && pa <= pc)
+		return (unsigned char)a;
+	return (unsigned char)(pb <= pc ? b : c);
+}
+
+// reconstructs one filtered row into dst, prior is the reconstructed row above (zeros for the first)
+inline bool PngUnfilterRow(int filter, const unsigned char *src, unsigned char *dst, const unsigned char *prior,
+	size_t rowBytes, int bpp)
+{
+	if (filter == 0)
+	{
+		memcpy(dst, src, rowBytes);
+		return true;
+	}
+	if (filter == 2)
+	{
+		size_t i = 0;
+#ifdef PNG_DECODER_SSE2
+		for (; i + 16 <= rowBytes; i += 16)
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_add_epi8(_mm_loadu_si128((const __m128i*)(src + i)),
+				_mm_loadu_si128((const __m128i*)(prior + i))));
+#endif
+		for (; i < rowBytes; i++)
+			dst[i] = (unsigned char)(src[i] + prior[i]);
+		return true;
+	}
+	if (filter > 4)
+		return false;
+#ifdef PNG_DECODER_SSE2
+	switch (bpp)
+	{
+	case 3: PngUnfilterSse2<3>(filter, src, dst, prior, rowBytes); return true;
+	case 4: PngUnfilterSse2<4>(filter, src, dst, prior, rowBytes); return true;
+	case 6: PngUnfilterSse2<6>(filter, src, dst, prior, rowBytes); return true;
+	case 8: PngUnfilterSse2<8>(filter, src, dst, prior, rowBytes); return true;
+	}
+#endif
+	size_t first = (size_t)bpp < rowBytes ? bpp : rowBytes;
+	if (filter == 1)
+	{
+		memcpy(dst, src, first);
+		for (size_t i = bpp; i < rowBytes; i++)
+			dst[i] = (unsigned char)(src[i] + dst[i - bpp]);
+	}
+	else if (filter == 3)
+	{
+		for (size_t i = 0; i < first; i++)
+			dst[i] = (unsigned char)(src[i] + (prior[i] >> 1));
+		for (size_t i = bpp; i < rowBytes; i++)
+			dst[i] = (unsigned char)(src[i] + ((dst[i - bpp] + prior[i]) >> 1));
+	}
+	else
+	{
+		for (size_t i = 0; i < first; i++)
+			dst[i] = (unsigned char)(src[i] + prior[i]);
+		for (size_t i = bpp; i < rowBytes; i++)
+			dst[i] = (unsigned char)(src[i] + PngPaeth(dst[i - bpp], prior[i], prior[i - bpp]));
+	}
+	return true;
+}
+
+inline uint32_t PngReadUint32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// decodes a PNG the fast path handles into malloc'd 8 bit pixels with the file's own channel count (release them with
+// stbi_image_free like stb_image's), null if it isn't one of those
+inline unsigned char* DecodePng(const unsigned char *data, size_t size, int *width, int *height, int *channels)
+{
+	static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	if (size < 8 + 25 || memcmp(data, signature, 8) != 0)
+		return nullptr;
+
+	// IHDR first, then concatenate the IDAT chunks
+	const unsigned char *chunk = data + 8, *end = data + size;
+	uint32_t imageWidth = 0, imageHeight = 0;
+	int depth = 0, components = 0;
+	vector<unsigned char> compressed;
+	bool header = false, image = false;
+	while (end - chunk >= 12)
+	{
+		uint32_t length = PngReadUint32(chunk);
+		const unsigned char *type = chunk + 4, *body = chunk + 8;
+		if (length > (size_t)(end - body) - 4)
+			return nullptr;
+		if (!header)
+		{
+			// colour types 0, 2, 4 and 6 at 8 or 16 bits, deflate, adaptive filtering, no interlacing
+			static const int typeComponents[7] = { 1, 0, 3, 0, 2, 0, 4 };
+			if (memcmp(type, "IHDR", 4) != 0 || length != 13)
+				return nullptr;
+			imageWidth = PngReadUint32(body);
+			imageHeight = PngReadUint32(body + 4);
+			depth = body[8];
+			int colorType = body[9];
+			if (imageWidth == 0 || imageHeight == 0 || imageWidth > PNG_MAX_DIMENSION || imageHeight > PNG_MAX_DIMENSION ||
+				(depth != 8 && depth != 16) || colorType > 6 || !typeComponents[colorType] || body[10] || body[11] || body[12])
+				return nullptr;
+			components = typeComponents[colorType];
+			header = true;
+		}
+		else if (memcmp(type, "IDAT", 4) == 0)
+		{
+			compressed.insert(compressed.end(), body, body + length);
+			image = true;
+		}
+		else if (memcmp(type, "IEND", 4) == 0)
+			break;
+		else if (memcmp(type, "tRNS", 4) == 0 || memcmp(type, "CgBI", 4) == 0 || !(type[0] & 32))
+		{
+			// transparency is expanded by stb, Apple's CgBI files are byte swapped and unknown critical chunks
+			// are errors there
+			return nullptr;
+		}
+		chunk = body + length + 4;
+	}
+	if (!image)
+		return nullptr;
+
+	int bpp = components * depth / 8;
+	size_t rowBytes = (size_t)imageWidth * bpp;
+	size_t filteredSize = (rowBytes + 1) * imageHeight;
+	size_t pixelsSize = (size_t)imageWidth * imageHeight * components;
+	if (rowBytes / bpp != imageWidth || filteredSize / (rowBytes + 1) != imageHeight)
+		return nullptr;
+	compressed.resize(compressed.size() + PNG_PADDING, 0);
+	vector<unsigned char> filtered(filteredSize + PNG_PADDING);
+	if (!PngInflater::inflate(compressed.data(), compressed.size() - PNG_PADDING, filtered.data(), filteredSize))
+		return nullptr;
+
+	unsigned char *pixels = (unsigned char*)malloc(pixelsSize);
+	if (!pixels)
+		return nullptr;
+	// 8 bit rows are reconstructed straight into the image, 16 bit ones into two alternating rows that keep their
+	// high bytes
+	vector<unsigned char> rows((depth == 16 ? 2 : 1) * rowBytes + rowBytes, 0);
+	unsigned char *zeros = rows.data();
+	const unsigned char *prior = zeros;
+	for (uint32_t y = 0; y < imageHeight; y++)
+	{
+		const unsigned char *src = &filtered[y * (rowBytes + 1)];
+		unsigned char *dst = depth == 8 ? pixels + y * rowBytes : zeros + rowBytes * (1 + (y & 1));
+		if (!PngUnfilterRow(src[0], src + 1, dst, prior, rowBytes, bpp))
+		{
+			free(pixels);
+			return nullptr;
+		}
+		if (depth == 16)
+		{
+			unsigned char *row = pixels + y * (size_t)imageWidth * components;
+			for (size_t i = 0; i < rowBytes / 2; i++)
+				row[i] = dst[i * 2];
+		}
+		prior = dst;
+	}
+	*width = (int)imageWidth;
+	*height = (int)imageHeight;
+	*channels = components;
+	return pixels;
+}
+#endif
@@ -0,0 +1,176 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include "ContentHash.h"
+#include "GLExtensions.h"
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+using namespace std;
+
+// Linked shader programs saved with glGetProgramBinary, so later launches skip compiling and linking altogether.
+// A binary is only valid for the driver that produced it, so the key hashes the GLSL sources together with the
+// GL vendor, renderer and version strings; a driver update or an edited shader simply misses the cache. Drivers are
+// still allowed to reject a binary (they do after some updates that keep the version string), in which case the
+// program is compiled from source as if there were no cache and the stale file is replaced.
+// Layout of shadercache/<key>.bin: ProgramCacheHeader followed by length bytes of driver binary.
+
+const uint32_t PROGRAM_CACHE_MAGIC = 0x31425050; // "PPB1"
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+const char *const PROGRAM_CACHE_DIRECTORY = "shadercache";
+
+struct ProgramCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t binaryFormat;
+	uint32_t length;
+};
+
+class ProgramCache
+{
+public:
+	// identifies a program built from these sources by the current driver, 0 if binaries aren't supported
+	static uint64_t key(const string &vertexCode, const string &fragmentCode, const string &geometryCode)
+	{
+		if (!GLExt().programBinary)
+			return 0;
+		uint64_t hash = driverHash();
+		hash = hashString(vertexCode, hash);
+		hash = hashString(fragmentCode, hash);
+		hash = hashString(geometryCode, hash);
+		return hash != 0 ? hash : 1;
+	}
+
+	// creates program from the cached binary. Returns 0 if there is none or the driver rejected it.
+	static unsigned int load(uint64_t key)
+	{
+		if (key == 0)
+			return 0;
+		string path = cachePath(key);
+		MappedFile file;
+		if (!file.open(path) || file.size() < sizeof(ProgramCacheHeader))
+			return 0;
+		ProgramCacheHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+		if (header.magic != PROGRAM_CACHE_MAGIC || header.version != PROGRAM_CACHE_VERSION || header.key != key ||
+			file.size() - sizeof(header) < header.length)
+			return 0;
+
+		unsigned int program = glCreateProgram();
+		GLExt().ProgramBinary(program, header.binaryFormat, file.data() + sizeof(header), (GLsizei)header.length);
+		GLint linked = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (!linked)
+		{
+			cout << "WARNING::PROGRAM_CACHE:: driver rejected " << path << ", compiling from source" << endl;
+			glDeleteProgram(program);
+			file.close();
+			std::remove(path.c_str());
+			return 0;
+		}
+		return program;
+	}
+
+	// call before glLinkProgram on a program that is going to be stored
+	static void prepare(unsigned int program)
+	{
+		if (GLExt().programBinary)
+			GLExt().ProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	// saves a successfully linked program under key
+	static bool store(uint64_t key, unsigned int program)
+	{
+		if (key == 0)
+			return false;
+		GLint linked = GL_FALSE, length = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (!linked || length <= 0)
+			return false;
+		vector<unsigned char> binary(length);
+		GLsizei written = 0;
+		GLenum binaryFormat = 0;
+		GLExt().GetProgramBinary(program, length, &written, &binaryFormat, binary.data());
+		if (written <= 0)
+			return false;
+
+		ProgramCacheHeader header;
+		header.magic = PROGRAM_CACHE_MAGIC;
+		header.version = PROGRAM_CACHE_VERSION;
+		header.key = key;
+		header.binaryFormat = binaryFormat;
+		header.length = (uint32_t)written;
+
+		makeDirectory(PROGRAM_CACHE_DIRECTORY);
+		string path = cachePath(key);
+		string tmpPath = path + ".tmp";
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)binary.data(), written);
+		file.close();
+		if (!file)
+			return false;
+		std::remove(path.c_str());
+		return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+	}
+
+private:
+	static string cachePath(uint64_t key)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+		return string(PROGRAM_CACHE_DIRECTORY) + '/' + name;
+	}
+
+	static uint64_t hashString(const string &value, uint64_t hash)
+	{
+		// the length goes in too so moving text from one stage to the next changes the key
+		uint64_t length = value.size();
+		hash = HashBytes((const unsigned char*)&length, sizeof(length), hash);
+		return HashBytes((const unsigned char*)value.data(), value.size(), hash);
+	}
+
+	static uint64_t driverHash()
+	{
+		static uint64_t hash = 0;
+		if (hash == 0)
+		{
+			const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+			hash = CONTENT_HASH_SEED;
+			for (GLenum name : names)
+			{
+				const char *value = (const char*)glGetString(name);
+				hash = hashString(value ? value : "", hash);
+			}
+		}
+		return hash;
+	}
+
+	static void makeDirectory(const char *path)
+	{
+#ifdef _WIN32
+		_mkdir(path);
+#else
+		mkdir(path, 0755);
+#endif
+	}
+};
+#endif
@@ -0,0 +1,68 @@
+#ifndef SCENE_ASSETS_H
+#define SCENE_ASSETS_H
+
+// Every file the scene loads at startup, in one place so the bake tool archives exactly what main() opens.
+// Paths are relative to the project root, which is also where the archive is looked for.
+
+// groups of textures sharing a resolution limit, see TextureBudget
+enum TextureCategory {
+	TEXTURE_OTHER,
+	TEXTURE_KEYS,		// the piano, its keys and everything on it
+	TEXTURE_STAGE,
+	TEXTURE_SKYBOX,
+	TEXTURE_CATEGORY_COUNT
+};
+
+// what happens to a model's CPU-side geometry once it is on the GPU, see Model::setResidency
+enum GeometryResidency {
+	RESIDENCY_KEEP,		// stays in memory
+	RESIDENCY_DROP,		// freed after upload for good
+	RESIDENCY_RELOAD	// freed after upload, paged back in from the mesh cache when asked for
+};
+
+struct SceneAsset {
+	const char *name;
+	const char *path;
+	TextureCategory textureCategory;	// of the texture, or of every texture the model references
+	GeometryResidency residency;		// models only
+	bool bakeOcclusion;					// models that never move: ambient occlusion is baked into their vertices on import
+};
+
+const SceneAsset SCENE_MODELS[] = {
+	{ "piano", "obj/Piano2/Pianotex.obj", TEXTURE_KEYS, RESIDENCY_RELOAD, true },
+	{ "key_white", "obj/Piano2/white.obj", TEXTURE_KEYS, RESIDENCY_RELOAD, false },
+	{ "key_black", "obj/Piano2/black.obj", TEXTURE_KEYS, RESIDENCY_RELOAD, false },
+	{ "paper", "obj/Piano2/paper.obj", TEXTURE_KEYS, RESIDENCY_RELOAD, true },
+	{ "piano_flap", "obj/Piano2/flap.obj", TEXTURE_KEYS, RESIDENCY_RELOAD, false },
+	{ "stick", "obj/Piano2/stick.obj", TEXTURE_KEYS, RESIDENCY_RELOAD, false },
+
+	{ "stage", "obj/stage/stage2.obj", TEXTURE_STAGE, RESIDENCY_RELOAD, true },
+	{ "lamp", "obj/stage/lamp.obj", TEXTURE_STAGE, RESIDENCY_RELOAD, false },
+	{ "lens", "obj/stage/lens.obj", TEXTURE_STAGE, RESIDENCY_RELOAD, false },
+};
+
+const SceneAsset SCENE_TEXTURES[] = {
+	{ "diffuse", "textures/container2.png", TEXTURE_OTHER, RESIDENCY_KEEP, false },
+	{ "specular", "textures/container2_specular.png", TEXTURE_OTHER, RESIDENCY_KEEP, false },
+};
+
+// A little bit brighter skybox ;)
+// textures/skymap/right.jpg, left.jpg, top.jpg, bottom.jpg, front.jpg, back.jpg
+const char *const SKYBOX_FACES[] = {
+	"textures/skymap/purplenebulart.jpg",
+	"textures/skymap/purplenebulalf.jpg",
+	"textures/skymap/purplenebulaup.jpg",
+	"textures/skymap/purplenebuladn.jpg",
+	"textures/skymap/purplenebulaft.jpg",
+	"textures/skymap/purplenebulabk.jpg",
+};
+
+const char *const SCENE_SHADERS[] = {
+	"shader.vs", "shader.fs",
+	"model.vs", "model.fs",
+	"cubeMap.vs", "cubeMap.fs",
+};
+
+// written by `bake archive`, mounted by main() when present
+const char *const ASSET_ARCHIVE_PATH = "scene.pak";
+#endif
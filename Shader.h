@@ -4,10 +4,15 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "AssetArchive.h"
+#include "ProgramCache.h"
+#include "StartupTracer.h"
+
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
 
 class Shader
 {
@@ -17,6 +22,7 @@ public:
 	// ------------------------------------------------------------------------
 	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
 	{
+		TRACE_SCOPE("shader", vertexPath);
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
 		std::string fragmentCode;
@@ -28,38 +34,50 @@ public:
 		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 		fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 		gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		try
+		// sources in the mounted asset archive win over the loose files
+		bool archived = readArchived(vertexPath, vertexCode) && readArchived(fragmentPath, fragmentCode) &&
+			(geometryPath == nullptr || readArchived(geometryPath, geometryCode));
+		if (!archived)
 		{
-			// open files
-			vShaderFile.open(vertexPath);
-			fShaderFile.open(fragmentPath);
-			std::stringstream vShaderStream, fShaderStream;
-			// read file's buffer contents into streams
-			vShaderStream << vShaderFile.rdbuf();
-			fShaderStream << fShaderFile.rdbuf();
-			// close file handlers
-			vShaderFile.close();
-			fShaderFile.close();
-			// convert stream into string
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
-			// if geometry shader path is present, also load a geometry shader
-			if (geometryPath != nullptr)
+			try
 			{
-				gShaderFile.open(geometryPath);
-				std::stringstream gShaderStream;
-				gShaderStream << gShaderFile.rdbuf();
-				gShaderFile.close();
-				geometryCode = gShaderStream.str();
+				// open files
+				vShaderFile.open(vertexPath);
+				fShaderFile.open(fragmentPath);
+				std::stringstream vShaderStream, fShaderStream;
+				// read file's buffer contents into streams
+				vShaderStream << vShaderFile.rdbuf();
+				fShaderStream << fShaderFile.rdbuf();
+				// close file handlers
+				vShaderFile.close();
+				fShaderFile.close();
+				// convert stream into string
+				vertexCode = vShaderStream.str();
+				fragmentCode = fShaderStream.str();
+				// if geometry shader path is present, also load a geometry shader
+				if (geometryPath != nullptr)
+				{
+					gShaderFile.open(geometryPath);
+					std::stringstream gShaderStream;
+					gShaderStream << gShaderFile.rdbuf();
+					gShaderFile.close();
+					geometryCode = gShaderStream.str();
+				}
+			}
+			catch (std::ifstream::failure e)
+			{
+				std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 			}
 		}
-		catch (std::ifstream::failure e)
-		{
-			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-		}
+		// 2. reuse the driver's binary of this exact program from an earlier run if there is one
+		uint64_t programKey = ProgramCache::key(vertexCode, fragmentCode, geometryCode);
+		ID = ProgramCache::load(programKey);
+		if (ID != 0)
+			return;
+		TRACE_SCOPE("shader", "compile and link");
 		const char* vShaderCode = vertexCode.c_str();
 		const char * fShaderCode = fragmentCode.c_str();
-		// 2. compile shaders
+		// 3. compile shaders
 		unsigned int vertex, fragment;
 		int success;
 		char infoLog[512];
@@ -89,8 +107,10 @@ public:
 		glAttachShader(ID, fragment);
 		if (geometryPath != nullptr)
 			glAttachShader(ID, geometry);
+		ProgramCache::prepare(ID);
 		glLinkProgram(ID);
 		checkCompileErrors(ID, "PROGRAM");
+		ProgramCache::store(programKey, ID);
 		// delete the shaders as they're linked into our program now and no longer necessery
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
@@ -98,12 +118,40 @@ public:
 			glDeleteShader(geometry);
 
 	}
+	// rebuilds the program from source, keeping the current one if the new sources don't compile or link
+	// ------------------------------------------------------------------------
+	bool reload(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+	{
+		Shader fresh(vertexPath, fragmentPath, geometryPath);
+		GLint linked = GL_FALSE;
+		glGetProgramiv(fresh.ID, GL_LINK_STATUS, &linked);
+		if (!linked)
+		{
+			glDeleteProgram(fresh.ID);
+			return false;
+		}
+		glDeleteProgram(ID);
+		ID = fresh.ID;
+		locations.clear();
+		return true;
+	}
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use()
 	{
 		glUseProgram(ID);
 	}
+	// location of a uniform, looked up only the first time for this program. For uniforms set on every draw.
+	// ------------------------------------------------------------------------
+	GLint uniformLocation(const std::string &name) const
+	{
+		std::unordered_map<std::string, GLint>::const_iterator it = locations.find(name);
+		if (it != locations.end())
+			return it->second;
+		GLint location = glGetUniformLocation(ID, name.c_str());
+		locations[name] = location;
+		return location;
+	}
 	// utility uniform functions
 	// ------------------------------------------------------------------------
 	void setBool(const std::string &name, bool value) const
@@ -164,6 +212,21 @@ public:
 	}
 
 private:
+	mutable std::unordered_map<std::string, GLint> locations;	// see uniformLocation
+
+	// reads a shader source from the mounted asset archive, false if there is none or it doesn't hold the file
+	static bool readArchived(const char *path, std::string &code)
+	{
+		AssetArchive *archive = AssetArchive::current();
+		if (!archive || !archive->contains(path))
+			return false;
+		AssetFile file;
+		if (!file.open(path))
+			return false;
+		code.assign((const char*)file.data(), file.size());
+		return true;
+	}
+
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)
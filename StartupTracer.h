@@ -0,0 +1,193 @@
+#ifndef STARTUP_TRACER_H
+#define STARTUP_TRACER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+using namespace std;
+
+// Records where startup time goes as nested spans (see TraceScope) on every thread, and writes them as Chrome trace
+// event JSON (loadable in chrome://tracing or ui.perfetto.dev) to the file named by the PIANO_TRACE environment variable
+// when the program exits. Without the variable nothing is recorded and a scope costs a flag check.
+const char *const STARTUP_TRACE_ENV = "PIANO_TRACE";
+
+class StartupTracer
+{
+public:
+	static StartupTracer& get()
+	{
+		static StartupTracer tracer;
+		return tracer;
+	}
+
+	bool enabled() const { return active; }
+
+	// microseconds since the tracer was first used, which main() does before anything else
+	double now() const
+	{
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+	}
+
+	// a span that began and ended at the given times (see now) on the calling thread
+	void record(const char *category, const string &name, double begin, double end)
+	{
+		if (!active)
+			return;
+		Event event = { category, name, begin, end - begin, threadId() };
+		std::lock_guard<std::mutex> lock(mutex);
+		events.push_back(std::move(event));
+	}
+
+	// labels the calling thread in the trace
+	void nameThread(const string &name)
+	{
+		if (!active)
+			return;
+		unsigned int id = threadId();
+		std::lock_guard<std::mutex> lock(mutex);
+		threadNames[id] = name;
+	}
+
+	// writes the trace recorded so far, done on exit anyway
+	bool write()
+	{
+		if (!active)
+			return false;
+		std::lock_guard<std::mutex> lock(mutex);
+		FILE *file = fopen(path.c_str(), "wb");
+		if (!file)
+		{
+			cout << "ERROR::TRACE:: could not write " << path << endl;
+			return false;
+		}
+		fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		bool first = true;
+		for (const Event &event : events)
+		{
+			fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+				first ? "" : ",\n", escape(event.name).c_str(), event.category, event.begin, event.duration, event.thread);
+			first = false;
+		}
+		for (const auto &thread : threadNames)
+		{
+			fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+				first ? "" : ",\n", thread.first, escape(thread.second).c_str());
+			first = false;
+		}
+		fprintf(file, "\n]}\n");
+		bool written = fclose(file) == 0;
+		if (written)
+			cout << "TRACE:: " << events.size() << " spans written to " << path << endl;
+		return written;
+	}
+
+private:
+	struct Event {
+		const char *category;	// string literal
+		string name;
+		double begin;
+		double duration;
+		unsigned int thread;
+	};
+
+	bool active;
+	string path;
+	std::chrono::steady_clock::time_point origin;
+	std::mutex mutex;
+	vector<Event> events;
+	map<unsigned int, string> threadNames;
+	std::atomic<unsigned int> nextThread;
+
+	StartupTracer() : active(false), origin(std::chrono::steady_clock::now()), nextThread(1)
+	{
+		const char *target = getenv(STARTUP_TRACE_ENV);
+		if (target && *target)
+		{
+			active = true;
+			path = target;
+			events.reserve(4096);
+		}
+	}
+
+	~StartupTracer()
+	{
+		write();
+	}
+
+	StartupTracer(const StartupTracer&) = delete;
+	StartupTracer& operator=(const StartupTracer&) = delete;
+
+	// small sequential ids, in order of the threads' first span
+	unsigned int threadId()
+	{
+		static thread_local unsigned int id = 0;
+		if (id == 0)
+			id = nextThread.fetch_add(1);
+		return id;
+	}
+
+	static string escape(const string &value)
+	{
+		string escaped;
+		escaped.reserve(value.size());
+		for (char c : value)
+		{
+			if (c == '"' || c == '\\')
+				escaped += '\\';
+			if ((unsigned char)c >= 0x20)
+				escaped += c;
+		}
+		return escaped;
+	}
+};
+
+// times the enclosing scope as a span of the startup trace. Names are only copied while tracing.
+class TraceScope
+{
+public:
+	TraceScope(const char *category, const char *name) : category(category), begin(-1.0)
+	{
+		StartupTracer &tracer = StartupTracer::get();
+		if (!tracer.enabled())
+			return;
+		this->name = name;
+		begin = tracer.now();
+	}
+
+	TraceScope(const char *category, const string &name) : category(category), begin(-1.0)
+	{
+		StartupTracer &tracer = StartupTracer::get();
+		if (!tracer.enabled())
+			return;
+		this->name = name;
+		begin = tracer.now();
+	}
+
+	~TraceScope()
+	{
+		if (begin < 0.0)
+			return;
+		StartupTracer &tracer = StartupTracer::get();
+		tracer.record(category, name, begin, tracer.now());
+	}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char *category;
+	string name;
+	double begin;
+};
+
+#define TRACE_SCOPE_JOIN2(a, b) a##b
+#define TRACE_SCOPE_JOIN(a, b) TRACE_SCOPE_JOIN2(a, b)
+// TRACE_SCOPE("texture", path); spans the rest of the enclosing block
+#define TRACE_SCOPE(category, name) TraceScope TRACE_SCOPE_JOIN(traceScope, __LINE__)(category, name)
+#endif
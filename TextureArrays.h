@@ -0,0 +1,326 @@
+#ifndef TEXTURE_ARRAYS_H
+#define TEXTURE_ARRAYS_H
+
+#include <glad/glad.h>
+
+#include "GLExtensions.h"
+#include "TextureCompression.h"
+#include "TextureRegistry.h"
+
+#include <string>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <tuple>
+using namespace std;
+
+// Material textures packed into the layers of GL_TEXTURE_2D_ARRAY textures. The maps the lighting shader samples
+// (material.diffuse and material.specular, a mesh's first two textures) are grouped by size, format and mip count, and
+// every group of two or more becomes one array with a layer per image. Meshes whose maps all landed in arrays record
+// their layers and draw with the arrays bound once to units of their own, so between the keys, the piano's black
+// parts and the lamps only a layer uniform changes instead of two texture bindings.
+// Layers are copied on the GPU from the 2D textures, with glCopyImageSubData where the driver has it and a read back
+// otherwise. The 2D textures stay the source: a hot reload re-uploads one and refreshes its layers, and a layer whose
+// image no longer fits its array sends the meshes using it back to the 2D texture.
+
+const unsigned int MATERIAL_ARRAY_SLOTS = 2;	// material.diffuse and material.specular
+const GLint MATERIAL_ARRAY_UNIT = 2;			// units of the arrays start after the 2D maps'
+
+// what every layer of an array has in common
+struct TextureLayout {
+	int width, height, levels;
+	GLenum internalFormat;
+
+	bool operator<(const TextureLayout &other) const
+	{
+		return std::tie(width, height, levels, internalFormat) < std::tie(other.width, other.height, other.levels, other.internalFormat);
+	}
+	bool operator==(const TextureLayout &other) const
+	{
+		return !(*this < other) && !(other < *this);
+	}
+};
+
+// channels of an uncompressed format the layers can be read back and written with, 0 for anything else
+inline int ChannelsForTextureFormat(GLenum internalFormat)
+{
+	switch (internalFormat)
+	{
+	case GL_RED: case GL_R8:
+		return 1;
+	case GL_RG: case GL_RG8:
+		return 2;
+	case GL_RGB: case GL_RGB8: case GL_SRGB: case GL_SRGB8:
+		return 3;
+	case GL_RGBA: case GL_RGBA8: case GL_SRGB_ALPHA: case GL_SRGB8_ALPHA8:
+		return 4;
+	}
+	return 0;
+}
+
+inline GLenum TransferFormatForChannels(int channels)
+{
+	static const GLenum formats[] = { GL_RED, GL_RED, GL_RG, GL_RGB, GL_RGBA };
+	return formats[channels];
+}
+
+// reads the layout of a 2D texture, false if it can't be copied into an array (unknown format, incomplete mip chain)
+inline bool QueryTextureLayout(unsigned int texture, TextureLayout &layout)
+{
+	GLint width = 0, height = 0, internalFormat = 0, maxLevel = 0;
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+	glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+	layout.width = width;
+	layout.height = height;
+	layout.internalFormat = (GLenum)internalFormat;
+	layout.levels = 0;
+	if (width <= 0 || height <= 0 || (!IsCompressedFormat(layout.internalFormat) && ChannelsForTextureFormat(layout.internalFormat) == 0))
+		return false;
+
+	// the levels that are actually there, SpecifyTexture2D leaves GL_TEXTURE_MAX_LEVEL at 1000
+	while (layout.levels <= maxLevel)
+	{
+		GLint levelWidth = 0, levelHeight = 0;
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, layout.levels, GL_TEXTURE_WIDTH, &levelWidth);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, layout.levels, GL_TEXTURE_HEIGHT, &levelHeight);
+		if (levelWidth != std::max(width >> layout.levels, 1) || levelHeight != std::max(height >> layout.levels, 1))
+			break;
+		layout.levels++;
+		if (levelWidth == 1 && levelHeight == 1)
+			break;
+	}
+	return true;
+}
+
+// array texture names currently bound to the material array units, so meshes sharing an array don't rebind it
+inline unsigned int* BoundMaterialArrays()
+{
+	static unsigned int bound[MATERIAL_ARRAY_SLOTS] = {};
+	return bound;
+}
+
+struct TextureArray {
+	unsigned int id;
+	TextureLayout layout;
+	vector<TextureHandle> sources;	// layer -> the 2D texture it is a copy of
+	vector<bool> current;			// false while a layer's source has a layout the array can't take
+
+	TextureArray() : id(0) {}
+	~TextureArray()
+	{
+		if (!id)
+			return;
+		// a later texture may get the same name
+		for (unsigned int slot = 0; slot < MATERIAL_ARRAY_SLOTS; slot++)
+			if (BoundMaterialArrays()[slot] == id)
+				BoundMaterialArrays()[slot] = 0;
+		glDeleteTextures(1, &id);
+	}
+
+	// copies every level of a 2D texture with this array's layout into layer
+	void copyLayer(int layer, unsigned int source)
+	{
+		if (GLExt().copyImage)
+		{
+			for (int level = 0; level < layout.levels; level++)
+				GLExt().CopyImageSubData(source, GL_TEXTURE_2D, level, 0, 0, 0, id, GL_TEXTURE_2D_ARRAY, level, 0, 0, layer,
+					std::max(layout.width >> level, 1), std::max(layout.height >> level, 1), 1);
+			return;
+		}
+
+		bool compressed = IsCompressedFormat(layout.internalFormat);
+		int channels = ChannelsForTextureFormat(layout.internalFormat);
+		vector<unsigned char> pixels;
+		glBindTexture(GL_TEXTURE_2D, source);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, id);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int level = 0; level < layout.levels; level++)
+		{
+			int width = std::max(layout.width >> level, 1), height = std::max(layout.height >> level, 1);
+			if (compressed)
+			{
+				pixels.resize(CompressedLevelSize(layout.internalFormat, width, height));
+				glGetCompressedTexImage(GL_TEXTURE_2D, level, pixels.data());
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, layout.internalFormat,
+					(GLsizei)pixels.size(), pixels.data());
+			}
+			else
+			{
+				pixels.resize((size_t)width * height * channels);
+				glGetTexImage(GL_TEXTURE_2D, level, TransferFormatForChannels(channels), GL_UNSIGNED_BYTE, pixels.data());
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, TransferFormatForChannels(channels),
+					GL_UNSIGNED_BYTE, pixels.data());
+			}
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+};
+
+typedef shared_ptr<TextureArray> TextureArrayHandle;
+
+// where a packed texture went
+struct TextureArrayLayer {
+	TextureArrayHandle array;
+	int layer;
+};
+
+// the layers a mesh samples its maps from, empty for meshes binding their 2D textures
+struct MaterialLayers {
+	TextureArrayHandle arrays[MATERIAL_ARRAY_SLOTS];
+	int layers[MATERIAL_ARRAY_SLOTS];
+
+	MaterialLayers() : layers() {}
+
+	bool packed() const
+	{
+		for (unsigned int slot = 0; slot < MATERIAL_ARRAY_SLOTS; slot++)
+			if (!arrays[slot] || !arrays[slot]->current[layers[slot]])
+				return false;
+		return true;
+	}
+
+	// binds the arrays to their units, unless they already are
+	void bind() const
+	{
+		unsigned int *bound = BoundMaterialArrays();
+		for (unsigned int slot = 0; slot < MATERIAL_ARRAY_SLOTS; slot++)
+		{
+			if (bound[slot] == arrays[slot]->id)
+				continue;
+			glActiveTexture(GL_TEXTURE0 + MATERIAL_ARRAY_UNIT + slot);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[slot]->id);
+			bound[slot] = arrays[slot]->id;
+		}
+	}
+};
+
+// Process-wide list of the texture arrays, so hot reloads can find the layers of a texture. The arrays themselves
+// are owned by the meshes' MaterialLayers and go away with the last of them.
+class TextureArrays
+{
+public:
+	static TextureArrays& get()
+	{
+		static TextureArrays arrays;
+		return arrays;
+	}
+
+	// GL thread: packs every loaded texture that shares its layout with at least one other into an array, and returns
+	// where each packed texture went. Textures with a layout of their own stay 2D only.
+	unordered_map<const TextureEntry*, TextureArrayLayer> pack(const vector<TextureHandle> &textures)
+	{
+		unordered_map<const TextureEntry*, TextureArrayLayer> packed;
+		map<TextureLayout, vector<TextureHandle> > groups;
+		unordered_set<const TextureEntry*> seen;
+		glActiveTexture(GL_TEXTURE0);
+		for (const TextureHandle &texture : textures)
+		{
+			if (!texture || !texture->loaded || !seen.insert(texture.get()).second)
+				continue;
+			TextureLayout layout;
+			if (QueryTextureLayout(texture->id, layout))
+				groups[layout].push_back(texture);
+		}
+
+		GLint maxLayers = 256;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+		for (auto it = groups.begin(); it != groups.end(); ++it)
+		{
+			const vector<TextureHandle> &group = it->second;
+			for (size_t first = 0; first + 1 < group.size(); first += maxLayers)
+			{
+				size_t count = std::min(group.size() - first, (size_t)maxLayers);
+				if (count < 2)
+					break;
+				TextureArrayHandle array = create(it->first, vector<TextureHandle>(group.begin() + first, group.begin() + first + count));
+				for (size_t layer = 0; layer < count; layer++)
+					packed[array->sources[layer].get()] = TextureArrayLayer{ array, (int)layer };
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return packed;
+	}
+
+	// GL thread, after source was re-specified: copies it into its layers again, or takes them out of use while
+	// its layout doesn't fit their array anymore
+	void refresh(const TextureHandle &source)
+	{
+		glActiveTexture(GL_TEXTURE0);
+		for (auto it = arrays.begin(); it != arrays.end(); )
+		{
+			TextureArrayHandle array = it->lock();
+			if (!array)
+			{
+				it = arrays.erase(it);
+				continue;
+			}
+			++it;
+			for (unsigned int layer = 0; layer < array->sources.size(); layer++)
+			{
+				if (array->sources[layer] != source)
+					continue;
+				TextureLayout layout;
+				bool fits = QueryTextureLayout(source->id, layout) && layout == array->layout;
+				if (fits)
+					array->copyLayer(layer, source->id);
+				else if (array->current[layer])
+					std::cout << "WARNING::TEXTURE_ARRAYS:: " << source->path << " doesn't match the size or format of its texture array "
+						"anymore, the meshes using it bind it on its own" << std::endl;
+				array->current[layer] = fits;
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+private:
+	vector<weak_ptr<TextureArray> > arrays;
+
+	TextureArrays() {}
+
+	// allocates an array for layout and fills a layer from each source
+	TextureArrayHandle create(const TextureLayout &layout, const vector<TextureHandle> &sources)
+	{
+		TextureArrayHandle array = std::make_shared<TextureArray>();
+		array->layout = layout;
+		array->sources = sources;
+		array->current.assign(sources.size(), true);
+		GLsizei layers = (GLsizei)sources.size();
+		bool compressed = IsCompressedFormat(layout.internalFormat);
+		GLenum format = compressed ? GL_RGBA : TransferFormatForChannels(ChannelsForTextureFormat(layout.internalFormat));
+
+		glGenTextures(1, &array->id);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array->id);
+		for (int level = 0; level < layout.levels; level++)
+		{
+			int width = std::max(layout.width >> level, 1), height = std::max(layout.height >> level, 1);
+			if (compressed)
+				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, layout.internalFormat, width, height, layers, 0,
+					(GLsizei)(CompressedLevelSize(layout.internalFormat, width, height) * layers), nullptr);
+			else
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, level, layout.internalFormat, width, height, layers, 0, format, GL_UNSIGNED_BYTE, nullptr);
+		}
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, layout.levels - 1);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, layout.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		for (unsigned int layer = 0; layer < sources.size(); layer++)
+			array->copyLayer(layer, sources[layer]->id);
+		arrays.push_back(array);
+		return array;
+	}
+};
+#endif
@@ -0,0 +1,92 @@
+#ifndef TEXTURE_BUDGET_H
+#define TEXTURE_BUDGET_H
+
+#include "AssetArchive.h"
+#include "SceneAssets.h"
+
+#include <string>
+#include <mutex>
+#include <unordered_map>
+using namespace std;
+
+// Per-category limits on texture resolution, for GPUs with little memory. Images larger than their category allows are
+// halved on load (see DownsampleToFit) until they fit, or start further down their baked mip chain, so sharpness can be
+// traded for memory without touching the assets. Models record which category the textures they reference are in as
+// they are imported; a texture shared between categories gets the most generous limit, anything unrecorded counts as
+// TEXTURE_OTHER. Color textures are filtered in linear space, textures only ever used as normal or height maps as is.
+class TextureBudget
+{
+public:
+	static TextureBudget& get()
+	{
+		static TextureBudget budget;
+		return budget;
+	}
+
+	// largest width or height for textures of category, 0 for no limit
+	void setMaxSize(TextureCategory category, int size)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		maxSizes[category] = size;
+	}
+
+	int maxSize(TextureCategory category) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return maxSizes[category];
+	}
+
+	// records that path is used as a texture of category, as a color texture unless color is false
+	void assign(const string &path, TextureCategory category, bool color)
+	{
+		string canonical = CanonicalPath(path);
+		std::lock_guard<std::mutex> lock(mutex);
+		auto inserted = usages.insert(std::make_pair(canonical, Usage{ category, color }));
+		if (inserted.second)
+			return;
+		Usage &usage = inserted.first->second;
+		if (isLooser(category, usage.category))
+			usage.category = category;
+		usage.color = usage.color || color;
+	}
+
+	// the limit for an image file and whether it holds colors, going by the usages recorded so far
+	int maxSizeFor(const string &path, bool &color) const
+	{
+		string canonical = CanonicalPath(path);
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = usages.find(canonical);
+		TextureCategory category = it != usages.end() ? it->second.category : TEXTURE_OTHER;
+		color = it == usages.end() || it->second.color;
+		return maxSizes[category];
+	}
+
+	static const char* categoryName(TextureCategory category)
+	{
+		static const char *names[TEXTURE_CATEGORY_COUNT] = { "other", "keys", "stage", "skybox" };
+		return names[category];
+	}
+
+private:
+	struct Usage {
+		TextureCategory category;
+		bool color;
+	};
+
+	mutable std::mutex mutex;
+	int maxSizes[TEXTURE_CATEGORY_COUNT];
+	unordered_map<string, Usage> usages;	// canonical path -> how it is used
+
+	TextureBudget()
+	{
+		for (int i = 0; i < TEXTURE_CATEGORY_COUNT; i++)
+			maxSizes[i] = 0;
+	}
+
+	// called with mutex held
+	bool isLooser(TextureCategory a, TextureCategory b) const
+	{
+		return maxSizes[b] != 0 && (maxSizes[a] == 0 || maxSizes[a] > maxSizes[b]);
+	}
+};
+#endif
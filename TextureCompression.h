@@ -0,0 +1,456 @@
+#ifndef TEXTURE_COMPRESSION_H
+#define TEXTURE_COMPRESSION_H
+
+#include <glad/glad.h>
+
+#include "MipChain.h"
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+using namespace std;
+
+// GPU block compression of baked textures: every 4x4 texel block becomes 8 or 16 bytes the GPU samples directly,
+// RGB as BC1 (S3TC DXT1, 4 bits per texel), RGBA as BC3 (DXT5, 8 bits), single channel images as BC4 and two channel
+// ones as BC5 (RGTC, core since GL 3.0). The encoder runs at bake time: BC1 endpoints start from the block's
+// principal axis and are refined by least squares against the chosen indices, BC4 endpoints span the block's range.
+// DecodeTextureBlocks turns blocks back into pixels for drivers without S3TC.
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+const int TEXTURE_BLOCK_REFINEMENTS = 2;		// least squares passes over the BC1 endpoints
+const int TEXTURE_BLOCK_ROWS_PER_TASK = 4;		// block rows an encoder thread takes at a time
+
+// the compressed format a baked image with this many channels uses
+inline GLenum CompressedFormatForChannels(int channels, bool srgb)
+{
+	switch (channels)
+	{
+	case 1: return GL_COMPRESSED_RED_RGTC1;
+	case 2: return GL_COMPRESSED_RG_RGTC2;
+	case 3: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	default: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	}
+}
+
+// bytes per 4x4 block, 0 for formats that aren't block compressed by this file
+inline size_t TextureBlockBytes(GLenum internalFormat)
+{
+	switch (internalFormat)
+	{
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RED_RGTC1:
+		return 8;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+	case GL_COMPRESSED_RG_RGTC2:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+inline bool IsCompressedFormat(GLenum internalFormat)
+{
+	return TextureBlockBytes(internalFormat) != 0;
+}
+
+inline bool IsS3tcFormat(GLenum internalFormat)
+{
+	return internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT || internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT ||
+		internalFormat == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT || internalFormat == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+}
+
+inline bool IsSrgbCompressedFormat(GLenum internalFormat)
+{
+	return internalFormat == GL_COMPRESSED_SRGB_S3TC_DXT1_EXT || internalFormat == GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT;
+}
+
+// channels of the pixels a compressed format decodes to
+inline int ChannelsForCompressedFormat(GLenum internalFormat)
+{
+	switch (internalFormat)
+	{
+	case GL_COMPRESSED_RED_RGTC1: return 1;
+	case GL_COMPRESSED_RG_RGTC2: return 2;
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: return 3;
+	default: return 4;
+	}
+}
+
+inline size_t CompressedLevelSize(GLenum internalFormat, int width, int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * TextureBlockBytes(internalFormat);
+}
+
+inline uint16_t PackRgb565(const float color[3])
+{
+	int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+	int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+	int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+	r = r < 0 ? 0 : (r > 31 ? 31 : r);
+	g = g < 0 ? 0 : (g > 63 ? 63 : g);
+	b = b < 0 ? 0 : (b > 31 ? 31 : b);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void UnpackRgb565(uint16_t packed, int color[3])
+{
+	int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+// the four colors of a BC1 block in 4 color mode
+inline void Bc1Palette(uint16_t c0, uint16_t c1, int palette[4][3])
+{
+	UnpackRgb565(c0, palette[0]);
+	UnpackRgb565(c1, palette[1]);
+	for (int i = 0; i < 3; i++)
+	{
+		palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+		palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+	}
+}
+
+// picks the nearest palette entry for every texel, returns the summed squared error
+inline int Bc1Indices(const unsigned char texels[16][4], const int palette[4][3], int indices[16])
+{
+	int total = 0;
+	for (int t = 0; t < 16; t++)
+	{
+		int best = 0, bestError = INT32_MAX;
+		for (int p = 0; p < 4; p++)
+		{
+			int dr = texels[t][0] - palette[p][0], dg = texels[t][1] - palette[p][1], db = texels[t][2] - palette[p][2];
+			int error = dr * dr + dg * dg + db * db;
+			if (error < bestError)
+			{
+				bestError = error;
+				best = p;
+			}
+		}
+		indices[t] = best;
+		total += bestError;
+	}
+	return total;
+}
+
+// encodes the RGB of 16 texels (rows of 4, alpha ignored) as an 8 byte BC1 block in 4 color mode
+inline void EncodeBc1Block(const unsigned char texels[16][4], unsigned char *out)
+{
+	// principal axis of the colors by power iteration on their covariance
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int t = 0; t < 16; t++)
+		for (int i = 0; i < 3; i++)
+			mean[i] += texels[t][i] / 16.0f;
+	float covariance[6] = { 0.0f };
+	for (int t = 0; t < 16; t++)
+	{
+		float r = texels[t][0] - mean[0], g = texels[t][1] - mean[1], b = texels[t][2] - mean[2];
+		covariance[0] += r * r;
+		covariance[1] += r * g;
+		covariance[2] += r * b;
+		covariance[3] += g * g;
+		covariance[4] += g * b;
+		covariance[5] += b * b;
+	}
+	float axis[3] = { 0.577f, 0.577f, 0.577f };
+	for (int iteration = 0; iteration < 6; iteration++)
+	{
+		float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+		float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+		float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+		float length = std::sqrt(x * x + y * y + z * z);
+		if (length < 1e-6f)
+			break;
+		axis[0] = x / length;
+		axis[1] = y / length;
+		axis[2] = z / length;
+	}
+
+	// endpoints at the extremes of the projections, pulled in a little as the palette's ends are rarely all used
+	float low = 1e9f, high = -1e9f;
+	for (int t = 0; t < 16; t++)
+	{
+		float projection = (texels[t][0] - mean[0]) * axis[0] + (texels[t][1] - mean[1]) * axis[1] + (texels[t][2] - mean[2]) * axis[2];
+		low = projection < low ? projection : low;
+		high = projection > high ? projection : high;
+	}
+	float inset = (high - low) / 16.0f;
+	float end0[3], end1[3];
+	for (int i = 0; i < 3; i++)
+	{
+		end0[i] = mean[i] + axis[i] * (high - inset);
+		end1[i] = mean[i] + axis[i] * (low + inset);
+	}
+
+	uint16_t best0 = 0, best1 = 0;
+	int bestIndices[16] = { 0 }, bestError = INT32_MAX;
+	for (int pass = 0; pass <= TEXTURE_BLOCK_REFINEMENTS; pass++)
+	{
+		uint16_t c0 = PackRgb565(end0), c1 = PackRgb565(end1);
+		int palette[4][3], indices[16];
+		Bc1Palette(c0, c1, palette);
+		int error = Bc1Indices(texels, palette, indices);
+		if (error < bestError)
+		{
+			bestError = error;
+			best0 = c0;
+			best1 = c1;
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+		if (error == 0 || pass == TEXTURE_BLOCK_REFINEMENTS)
+			break;
+
+		// least squares endpoints for these indices: texel = w * end0 + (1 - w) * end1
+		static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = { 0.0f }, bx[3] = { 0.0f };
+		for (int t = 0; t < 16; t++)
+		{
+			float a = weights[indices[t]], b = 1.0f - a;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int i = 0; i < 3; i++)
+			{
+				ax[i] += a * texels[t][i];
+				bx[i] += b * texels[t][i];
+			}
+		}
+		float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+			break;
+		for (int i = 0; i < 3; i++)
+		{
+			end0[i] = (ax[i] * bb - bx[i] * ab) / determinant;
+			end1[i] = (bx[i] * aa - ax[i] * ab) / determinant;
+		}
+	}
+
+	// 4 color mode needs c0 > c1, swapping the endpoints swaps indices 0 <-> 1 and 2 <-> 3. Equal endpoints would
+	// mean 3 color mode, where index 3 is black, so every texel takes index 0.
+	if (best0 < best1)
+	{
+		std::swap(best0, best1);
+		for (int t = 0; t < 16; t++)
+			bestIndices[t] ^= 1;
+	}
+	else if (best0 == best1)
+		memset(bestIndices, 0, sizeof(bestIndices));
+	uint32_t bits = 0;
+	for (int t = 0; t < 16; t++)
+		bits |= (uint32_t)bestIndices[t] << (t * 2);
+	out[0] = (unsigned char)(best0 & 0xff);
+	out[1] = (unsigned char)(best0 >> 8);
+	out[2] = (unsigned char)(best1 & 0xff);
+	out[3] = (unsigned char)(best1 >> 8);
+	memcpy(out + 4, &bits, 4);
+}
+
+// encodes one channel of 16 texels as an 8 byte BC4 block (also BC3's alpha), in 8 value mode spanning the
+// block's range
+inline void EncodeBc4Block(const unsigned char texels[16][4], int channel, unsigned char *out)
+{
+	int low = 255, high = 0;
+	for (int t = 0; t < 16; t++)
+	{
+		low = texels[t][channel] < low ? texels[t][channel] : low;
+		high = texels[t][channel] > high ? texels[t][channel] : high;
+	}
+	out[0] = (unsigned char)high;
+	out[1] = (unsigned char)low;
+	uint64_t bits = 0;
+	if (high > low)
+	{
+		for (int t = 0; t < 16; t++)
+		{
+			// position 0 is low and 7 is high, which are indices 1 and 0, the ones between count down from 7
+			int position = ((texels[t][channel] - low) * 14 + (high - low)) / ((high - low) * 2);
+			uint64_t index = position == 7 ? 0 : (position == 0 ? 1 : 8 - position);
+			bits |= index << (t * 3);
+		}
+	}
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (unsigned char)(bits >> (i * 8));
+}
+
+// the eight values of a BC4 block
+inline void Bc4Palette(const unsigned char *block, int palette[8])
+{
+	int a0 = block[0], a1 = block[1];
+	palette[0] = a0;
+	palette[1] = a1;
+	if (a0 > a1)
+	{
+		for (int i = 2; i < 8; i++)
+			palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+	}
+	else
+	{
+		for (int i = 2; i < 6; i++)
+			palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+// the 4x4 texels of a block at (x, y), repeating the last column and row where the image ends inside the block
+inline void GatherTextureBlock(const unsigned char *pixels, int width, int height, int channels, int x, int y,
+	unsigned char texels[16][4])
+{
+	for (int row = 0; row < 4; row++)
+	{
+		int sy = y + row < height ? y + row : height - 1;
+		for (int column = 0; column < 4; column++)
+		{
+			int sx = x + column < width ? x + column : width - 1;
+			const unsigned char *pixel = pixels + ((size_t)sy * width + sx) * channels;
+			unsigned char *texel = texels[row * 4 + column];
+			texel[0] = texel[1] = texel[2] = 0;
+			texel[3] = 255;
+			memcpy(texel, pixel, channels);
+		}
+	}
+}
+
+// compresses one tightly packed level into blocks of internalFormat, spreading block rows over the cores
+inline void CompressTextureLevel(const MipLevel &level, int channels, GLenum internalFormat, vector<unsigned char> &out)
+{
+	int blocksWide = (level.width + 3) / 4, blocksHigh = (level.height + 3) / 4;
+	size_t blockBytes = TextureBlockBytes(internalFormat);
+	out.resize((size_t)blocksWide * blocksHigh * blockBytes);
+
+	std::atomic<int> nextRow(0);
+	auto encodeRows = [&]() {
+		for (;;)
+		{
+			int first = nextRow.fetch_add(TEXTURE_BLOCK_ROWS_PER_TASK);
+			if (first >= blocksHigh)
+				return;
+			int last = first + TEXTURE_BLOCK_ROWS_PER_TASK < blocksHigh ? first + TEXTURE_BLOCK_ROWS_PER_TASK : blocksHigh;
+			for (int by = first; by < last; by++)
+			{
+				for (int bx = 0; bx < blocksWide; bx++)
+				{
+					unsigned char texels[16][4];
+					GatherTextureBlock(level.pixels.data(), level.width, level.height, channels, bx * 4, by * 4, texels);
+					unsigned char *block = &out[((size_t)by * blocksWide + bx) * blockBytes];
+					if (channels == 1)
+						EncodeBc4Block(texels, 0, block);
+					else if (channels == 2)
+					{
+						EncodeBc4Block(texels, 0, block);
+						EncodeBc4Block(texels, 1, block + 8);
+					}
+					else if (channels == 3)
+						EncodeBc1Block(texels, block);
+					else
+					{
+						EncodeBc4Block(texels, 3, block);
+						EncodeBc1Block(texels, block + 8);
+					}
+				}
+			}
+		}
+	};
+
+	unsigned int threadCount = std::thread::hardware_concurrency();
+	int tasks = (blocksHigh + TEXTURE_BLOCK_ROWS_PER_TASK - 1) / TEXTURE_BLOCK_ROWS_PER_TASK;
+	if (threadCount > (unsigned int)tasks)
+		threadCount = tasks;
+	vector<std::thread> encoders;
+	for (unsigned int i = 1; i < threadCount; i++)
+		encoders.push_back(std::thread(encodeRows));
+	encodeRows();
+	for (std::thread &encoder : encoders)
+		encoder.join();
+}
+
+// decodes the blocks of one level into tightly packed pixels with ChannelsForCompressedFormat channels
+inline void DecodeTextureBlocks(const unsigned char *blocks, int width, int height, GLenum internalFormat, unsigned char *pixels)
+{
+	int channels = ChannelsForCompressedFormat(internalFormat);
+	size_t blockBytes = TextureBlockBytes(internalFormat);
+	int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+	for (int by = 0; by < blocksHigh; by++)
+	{
+		for (int bx = 0; bx < blocksWide; bx++)
+		{
+			const unsigned char *block = blocks + ((size_t)by * blocksWide + bx) * blockBytes;
+			unsigned char texels[16][4];
+			if (channels <= 2)
+			{
+				for (int channel = 0; channel < channels; channel++)
+				{
+					int palette[8];
+					const unsigned char *values = block + channel * 8;
+					Bc4Palette(values, palette);
+					uint64_t bits = 0;
+					for (int i = 0; i < 6; i++)
+						bits |= (uint64_t)values[2 + i] << (i * 8);
+					for (int t = 0; t < 16; t++)
+						texels[t][channel] = (unsigned char)palette[(bits >> (t * 3)) & 7];
+				}
+			}
+			else
+			{
+				const unsigned char *color = channels == 4 ? block + 8 : block;
+				uint16_t c0 = (uint16_t)(color[0] | (color[1] << 8)), c1 = (uint16_t)(color[2] | (color[3] << 8));
+				int palette[4][3];
+				Bc1Palette(c0, c1, palette);
+				bool threeColor = channels == 3 && c0 <= c1;
+				if (threeColor)
+				{
+					for (int i = 0; i < 3; i++)
+					{
+						palette[2][i] = (palette[0][i] + palette[1][i]) / 2;
+						palette[3][i] = 0;
+					}
+				}
+				uint32_t bits;
+				memcpy(&bits, color + 4, 4);
+				for (int t = 0; t < 16; t++)
+				{
+					int index = (bits >> (t * 2)) & 3;
+					for (int i = 0; i < 3; i++)
+						texels[t][i] = (unsigned char)palette[index][i];
+					texels[t][3] = 255;
+				}
+				if (channels == 4)
+				{
+					int alpha[8];
+					Bc4Palette(block, alpha);
+					uint64_t alphaBits = 0;
+					for (int i = 0; i < 6; i++)
+						alphaBits |= (uint64_t)block[2 + i] << (i * 8);
+					for (int t = 0; t < 16; t++)
+						texels[t][3] = (unsigned char)alpha[(alphaBits >> (t * 3)) & 7];
+				}
+			}
+
+			for (int row = 0; row < 4 && by * 4 + row < height; row++)
+				for (int column = 0; column < 4 && bx * 4 + column < width; column++)
+					memcpy(pixels + ((size_t)(by * 4 + row) * width + bx * 4 + column) * channels, texels[row * 4 + column], channels);
+		}
+	}
+}
+#endif
@@ -0,0 +1,225 @@
+#ifndef TEXTURE_CONTAINER_H
+#define TEXTURE_CONTAINER_H
+
+#include <glad/glad.h>
+
+#include "MipChain.h"
+#include "TextureCompression.h"
+
+#include <string>
+#include <fstream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <sys/stat.h>
+using namespace std;
+
+// Offline baked textures in the KTX 1.1 container format: the whole mip chain is stored already filtered,
+// together with the GL format/internal format (which carries the channel layout and the sRGB flag), so loading
+// is just a mapping and one upload per level. Baked files live next to their source as <source>.ktx.
+// Uncompressed rows are padded to 4 bytes, as KTX requires, which matches the default GL_UNPACK_ALIGNMENT.
+// Block compressed containers (see TextureCompression.h) have glType and glFormat 0 and store the blocks as they are.
+
+#ifndef GL_SRGB8
+#define GL_SRGB8 0x8C41
+#endif
+#ifndef GL_SRGB8_ALPHA8
+#define GL_SRGB8_ALPHA8 0x8C43
+#endif
+
+const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+const uint32_t KTX_ENDIANNESS = 0x04030201;
+
+struct KtxHeader {
+	uint32_t endianness;
+	uint32_t glType;
+	uint32_t glTypeSize;
+	uint32_t glFormat;
+	uint32_t glInternalFormat;
+	uint32_t glBaseInternalFormat;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t numberOfArrayElements;
+	uint32_t numberOfFaces;
+	uint32_t numberOfMipmapLevels;
+	uint32_t bytesOfKeyValueData;
+};
+
+// one mip level of a parsed container, pointing into the container's memory
+struct TextureLevelView {
+	int width;
+	int height;
+	uint32_t size;						// bytes per face
+	const unsigned char *faces[6];
+};
+
+struct TextureContainer {
+	uint32_t glType;					// 0 for compressed formats
+	uint32_t glFormat;
+	uint32_t glInternalFormat;
+	int channels;
+	bool srgb;
+	int faces;							// 1 for 2D textures, 6 for cubemaps
+	vector<TextureLevelView> levels;
+
+	bool compressed() const { return glType == 0; }
+};
+
+inline string TextureContainerPath(const string &sourcePath)
+{
+	return sourcePath + ".ktx";
+}
+
+// a baked container is used unless its source was modified after it was baked
+inline bool IsTextureContainerFresh(const string &sourcePath, const string &containerPath)
+{
+	struct stat containerStat, sourceStat;
+	if (stat(containerPath.c_str(), &containerStat) != 0)
+		return false;
+	if (stat(sourcePath.c_str(), &sourceStat) != 0)
+		return true;
+	return containerStat.st_mtime >= sourceStat.st_mtime;
+}
+
+inline int ChannelsForFormat(uint32_t format)
+{
+	switch (format)
+	{
+	case GL_RED: return 1;
+	case GL_RG: return 2;
+	case GL_RGB: return 3;
+	default: return 4;
+	}
+}
+
+// parses a KTX 1.1 file held in memory. Only 2D textures and cubemaps without array layers are accepted.
+inline bool ReadTextureContainer(const unsigned char *data, size_t size, TextureContainer &out)
+{
+	if (size < sizeof(KTX_IDENTIFIER) + sizeof(KtxHeader) || memcmp(data, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) != 0)
+		return false;
+	KtxHeader header;
+	memcpy(&header, data + sizeof(KTX_IDENTIFIER), sizeof(header));
+	if (header.endianness != KTX_ENDIANNESS || header.pixelDepth > 1 || header.numberOfArrayElements > 0 ||
+		(header.numberOfFaces != 1 && header.numberOfFaces != 6) || header.pixelWidth == 0)
+		return false;
+
+	out.glType = header.glType;
+	out.glFormat = header.glFormat;
+	out.glInternalFormat = header.glInternalFormat;
+	out.channels = ChannelsForFormat(header.glBaseInternalFormat);
+	out.srgb = header.glInternalFormat == GL_SRGB8 || header.glInternalFormat == GL_SRGB8_ALPHA8 ||
+		IsSrgbCompressedFormat(header.glInternalFormat);
+	out.faces = header.numberOfFaces;
+	out.levels.clear();
+	if (out.compressed() && !IsCompressedFormat(out.glInternalFormat))
+		return false;
+
+	size_t offset = sizeof(KTX_IDENTIFIER) + sizeof(KtxHeader) + header.bytesOfKeyValueData;
+	uint32_t levelCount = header.numberOfMipmapLevels ? header.numberOfMipmapLevels : 1;
+	int width = header.pixelWidth;
+	int height = header.pixelHeight ? header.pixelHeight : 1;
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		if (offset + 4 > size)
+			return false;
+		TextureLevelView view;
+		memcpy(&view.size, data + offset, 4);
+		offset += 4;
+		view.width = width;
+		view.height = height;
+		size_t padded = (view.size + 3) & ~(size_t)3;
+		for (int face = 0; face < out.faces; face++)
+		{
+			if (offset + padded > size)
+				return false;
+			view.faces[face] = data + offset;
+			offset += padded;
+		}
+		if (out.compressed() && view.size != CompressedLevelSize(out.glInternalFormat, width, height))
+			return false;
+		out.levels.push_back(view);
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return true;
+}
+
+// writes mip chains, one per face (1 or 6), as a KTX 1.1 file, block compressed with CompressedFormatForChannels
+// if compress is set
+inline bool WriteTextureContainer(const string &path, const vector<vector<MipLevel> > &faces, int channels, bool srgb,
+	bool compress = false)
+{
+	if (faces.empty() || faces[0].empty())
+		return false;
+	GLenum format = channels == 1 ? GL_RED : (channels == 2 ? GL_RG : (channels == 3 ? GL_RGB : GL_RGBA));
+	GLenum internalFormat = channels == 1 ? GL_R8 : (channels == 2 ? GL_RG8 : (channels == 3 ? GL_RGB8 : GL_RGBA8));
+	if (srgb && channels == 3)
+		internalFormat = GL_SRGB8;
+	else if (srgb && channels == 4)
+		internalFormat = GL_SRGB8_ALPHA8;
+
+	if (compress)
+		internalFormat = CompressedFormatForChannels(channels, srgb);
+
+	KtxHeader header;
+	header.endianness = KTX_ENDIANNESS;
+	header.glType = compress ? 0 : GL_UNSIGNED_BYTE;
+	header.glTypeSize = 1;
+	header.glFormat = compress ? 0 : format;
+	header.glInternalFormat = internalFormat;
+	header.glBaseInternalFormat = format;
+	header.pixelWidth = faces[0][0].width;
+	header.pixelHeight = faces[0][0].height;
+	header.pixelDepth = 0;
+	header.numberOfArrayElements = 0;
+	header.numberOfFaces = (uint32_t)faces.size();
+	header.numberOfMipmapLevels = (uint32_t)faces[0].size();
+	header.bytesOfKeyValueData = 0;
+
+	string tmpPath = path + ".tmp";
+	std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+	file.write((const char*)KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER));
+	file.write((const char*)&header, sizeof(header));
+
+	static const char padding[4] = { 0, 0, 0, 0 };
+	vector<unsigned char> blocks;
+	for (size_t level = 0; level < faces[0].size(); level++)
+	{
+		const MipLevel &first = faces[0][level];
+		if (compress)
+		{
+			// block sizes are multiples of 8, so the levels need no padding
+			uint32_t imageSize = (uint32_t)CompressedLevelSize(internalFormat, first.width, first.height);
+			file.write((const char*)&imageSize, 4);
+			for (size_t face = 0; face < faces.size(); face++)
+			{
+				CompressTextureLevel(faces[face][level], channels, internalFormat, blocks);
+				file.write((const char*)blocks.data(), blocks.size());
+			}
+			continue;
+		}
+		size_t rowSize = (size_t)first.width * channels;
+		size_t rowPitch = (rowSize + 3) & ~(size_t)3;
+		uint32_t imageSize = (uint32_t)(rowPitch * first.height);
+		file.write((const char*)&imageSize, 4);
+		for (size_t face = 0; face < faces.size(); face++)
+		{
+			const MipLevel &mip = faces[face][level];
+			for (int y = 0; y < mip.height; y++)
+			{
+				file.write((const char*)&mip.pixels[y * rowSize], rowSize);
+				file.write(padding, rowPitch - rowSize);
+			}
+		}
+	}
+	file.close();
+	if (!file)
+		return false;
+	std::remove(path.c_str());
+	return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+#endif
@@ -0,0 +1,380 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "AssetArchive.h"
+#include "GLExtensions.h"
+#include "ImageDownsample.h"
+#include "PngDecoder.h"
+#include "TextureBudget.h"
+#include "TextureContainer.h"
+#include "StartupTracer.h"
+
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <memory>
+#include <vector>
+#include <climits>
+#include <cstring>
+using namespace std;
+
+// Decoded images get their mip chain built on the CPU by the thread that loaded them (see GenerateImageMips) and
+// uploaded level by level, rather than left to glGenerateMipmap on the GL thread.
+const bool CPU_MIPMAPS = true;
+
+// One mip level ready for glTexImage2D. pixels may also be an offset into a bound GL_PIXEL_UNPACK_BUFFER.
+struct ImageLevel {
+	int width;
+	int height;
+	size_t size;
+	const unsigned char *pixels;
+	int alignment;	// of the rows: 4 in containers (see TextureContainer.h), 1 for decoded or CPU built levels
+
+	ImageLevel() : width(0), height(0), size(0), pixels(nullptr), alignment(1) {}
+};
+
+// Decoded pixels of one image file, or the pre-filtered mip chain of its baked texture container.
+// Loading is plain CPU work and may run on any thread, only the upload functions need the GL context.
+struct ImageData {
+	unsigned char *pixels;				// base level decoded by stb_image, null when levels come from a container
+	int width;
+	int height;
+	int channels;
+	int sourceWidth;					// size of the file's image, before TextureBudget limits applied
+	int sourceHeight;
+	GLenum format;
+	GLenum internalFormat;
+	vector<ImageLevel> levels;			// pre-baked or CPU built mip chain, empty if the driver has to build the mipmaps.
+										// Block compressed when internalFormat is (see TextureCompression.h).
+	unique_ptr<AssetFile> container;	// keeps the levels valid
+	vector<unsigned char> mipStorage;	// levels below the decoded base level
+	string path;
+
+	ImageData() : pixels(nullptr), width(0), height(0), channels(0), sourceWidth(0), sourceHeight(0), format(GL_RGBA), internalFormat(GL_RGBA) {}
+	~ImageData() { release(); }
+
+	ImageData(const ImageData&) = delete;
+	ImageData& operator=(const ImageData&) = delete;
+	ImageData(ImageData &&other) : pixels(nullptr)
+	{
+		*this = std::move(other);
+	}
+	ImageData& operator=(ImageData &&other)
+	{
+		if (this != &other)
+		{
+			release();
+			pixels = other.pixels;
+			width = other.width;
+			height = other.height;
+			channels = other.channels;
+			sourceWidth = other.sourceWidth;
+			sourceHeight = other.sourceHeight;
+			format = other.format;
+			internalFormat = other.internalFormat;
+			levels = std::move(other.levels);
+			container = std::move(other.container);
+			mipStorage = std::move(other.mipStorage);
+			path = std::move(other.path);
+			other.pixels = nullptr;
+		}
+		return *this;
+	}
+
+	bool valid() const { return pixels != nullptr || !levels.empty(); }
+	bool hasMips() const { return !levels.empty(); }
+
+	// bytes needed to upload every level this image carries
+	size_t byteSize() const
+	{
+		if (!hasMips())
+			return (size_t)width * height * channels;
+		size_t size = 0;
+		for (unsigned int i = 0; i < levels.size(); i++)
+			size += (levels[i].size + 3) & ~(size_t)3;
+		return size;
+	}
+
+	void release()
+	{
+		if (pixels)
+			stbi_image_free(pixels);
+		pixels = nullptr;
+		levels.clear();
+		container.reset();
+		mipStorage.clear();
+	}
+};
+
+inline GLenum FormatForChannels(int channels)
+{
+	if (channels == 1)
+		return GL_RED;
+	else if (channels == 3)
+		return GL_RGB;
+	return GL_RGBA;
+}
+
+// sized counterpart of FormatForChannels, as immutable storage requires
+inline GLenum SizedFormatForChannels(int channels)
+{
+	if (channels == 1)
+		return GL_R8;
+	else if (channels == 3)
+		return GL_RGB8;
+	return GL_RGBA8;
+}
+
+// whether the driver samples a block compressed format itself. RGTC is core, S3TC needs the extensions.
+inline bool CompressedFormatSupported(GLenum internalFormat)
+{
+	if (!IsS3tcFormat(internalFormat))
+		return true;
+	return IsSrgbCompressedFormat(internalFormat) ? GLExt().textureCompressionS3tcSrgb : GLExt().textureCompressionS3tc;
+}
+
+// decodes block compressed levels for drivers that can't sample their format, they go up as plain 8 bit pixels
+inline void DecompressImageLevels(ImageData &image)
+{
+	GLenum compressedFormat = image.internalFormat;
+	int channels = ChannelsForCompressedFormat(compressedFormat);
+	size_t storage = 0;
+	for (const ImageLevel &level : image.levels)
+		storage += ((size_t)level.width * level.height * channels + 3) & ~(size_t)3;
+	image.mipStorage.resize(storage);
+	size_t offset = 0;
+	for (ImageLevel &level : image.levels)
+	{
+		unsigned char *pixels = image.mipStorage.data() + offset;
+		DecodeTextureBlocks(level.pixels, level.width, level.height, compressedFormat, pixels);
+		level.size = (size_t)level.width * level.height * channels;
+		level.pixels = pixels;
+		level.alignment = 1;
+		offset += (level.size + 3) & ~(size_t)3;
+	}
+	image.container.reset();
+	image.channels = channels;
+	image.format = FormatForChannels(channels);
+	image.internalFormat = SizedFormatForChannels(channels);
+	if (IsSrgbCompressedFormat(compressedFormat))
+		image.internalFormat = channels == 3 ? GL_SRGB8 : GL_SRGB8_ALPHA8;
+}
+
+// maps a baked <path>.ktx if there is an up to date one. A container in the mounted asset archive is always
+// up to date, the archive was baked from the very files it replaces.
+// Levels larger than maxSize (unless 0) are skipped, as long as smaller ones remain. Block compressed levels stay
+// compressed if the driver has the format and are decoded otherwise.
+inline bool LoadTextureContainer(const string &path, ImageData &image, int maxSize = 0)
+{
+	string containerPath = TextureContainerPath(path);
+	AssetArchive *archive = AssetArchive::current();
+	if (!(archive && archive->contains(containerPath)) && !IsTextureContainerFresh(path, containerPath))
+		return false;
+	unique_ptr<AssetFile> file(new AssetFile());
+	TextureContainer container;
+	if (!file->open(containerPath) || !ReadTextureContainer(file->data(), file->size(), container) ||
+		container.faces != 1)
+		return false;
+
+	unsigned int first = 0;
+	while (maxSize > 0 && first + 1 < container.levels.size() &&
+		(container.levels[first].width > maxSize || container.levels[first].height > maxSize))
+		first++;
+	image.sourceWidth = container.levels[0].width;
+	image.sourceHeight = container.levels[0].height;
+	image.width = container.levels[first].width;
+	image.height = container.levels[first].height;
+	image.channels = container.channels;
+	image.format = container.glFormat;
+	image.internalFormat = container.glInternalFormat;
+	for (unsigned int i = first; i < container.levels.size(); i++)
+	{
+		ImageLevel level;
+		level.width = container.levels[i].width;
+		level.height = container.levels[i].height;
+		level.size = container.levels[i].size;
+		level.pixels = container.levels[i].faces[0];
+		level.alignment = 4;
+		image.levels.push_back(level);
+	}
+	image.container = std::move(file);
+	if (container.compressed() && !CompressedFormatSupported(image.internalFormat))
+		DecompressImageLevels(image);
+	return true;
+}
+
+// decodes an image file, taking it from the mounted asset archive if it holds it. PNGs in their own channel count go
+// through the fast decoder (see PngDecoder.h), everything else and anything it turns down through stb_image.
+inline unsigned char* DecodeImageFile(const string &path, int *width, int *height, int *channels, int desiredChannels = 0)
+{
+	AssetFile file;
+	if (!file.open(path) || file.size() > INT_MAX)
+		return nullptr;
+	if (PNG_FAST_DECODE && desiredChannels == 0)
+	{
+		unsigned char *pixels = DecodePng(file.data(), file.size(), width, height, channels);
+		if (pixels)
+			return pixels;
+	}
+	return stbi_load_from_memory(file.data(), (int)file.size(), width, height, channels, desiredChannels);
+}
+
+// halves decoded pixels until they fit into maxSize (0 for no limit), filtering color channels in linear space
+inline void FitImageToBudget(ImageData &image, int maxSize, bool color)
+{
+	image.sourceWidth = image.width;
+	image.sourceHeight = image.height;
+	if (!image.pixels)
+		return;
+	vector<unsigned char> scaled;
+	if (!DownsampleToFit(image.pixels, image.width, image.height, image.channels, color, maxSize, scaled))
+		return;
+	// stb_image's allocator, so release() can keep freeing with stbi_image_free
+	unsigned char *pixels = (unsigned char*)STBI_MALLOC(scaled.size());
+	if (!pixels)
+		throw std::bad_alloc();
+	memcpy(pixels, scaled.data(), scaled.size());
+	stbi_image_free(image.pixels);
+	image.pixels = pixels;
+}
+
+// builds the mip chain of decoded pixels with the vectorized box filter (see ImageDownsample.h), filtering color
+// channels in linear space. Level 0 stays in pixels, the others are packed into mipStorage 4-byte aligned.
+inline void GenerateImageMips(ImageData &image, bool color)
+{
+	if (!image.pixels)
+		return;
+	image.levels.clear();
+	size_t storage = 0;
+	for (int width = image.width, height = image.height; width > 1 || height > 1; )
+	{
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+		storage += ((size_t)width * height * image.channels + 3) & ~(size_t)3;
+	}
+	image.mipStorage.resize(storage);
+
+	ImageLevel level;
+	level.width = image.width;
+	level.height = image.height;
+	level.size = (size_t)image.width * image.height * image.channels;
+	level.pixels = image.pixels;
+	image.levels.push_back(level);
+	size_t offset = 0;
+	while (level.width > 1 || level.height > 1)
+	{
+		unsigned char *next = image.mipStorage.data() + offset;
+		HalveImage(level.pixels, level.width, level.height, image.channels, color, next);
+		level.width = level.width > 1 ? level.width / 2 : 1;
+		level.height = level.height > 1 ? level.height / 2 : 1;
+		level.size = (size_t)level.width * level.height * image.channels;
+		level.pixels = next;
+		image.levels.push_back(level);
+		offset += (level.size + 3) & ~(size_t)3;
+	}
+}
+
+// prints the texture memory a loaded image is going to take, including the mipmaps the driver generates for
+// decoded images unless there are none
+inline void ReportTextureMemory(const ImageData &image, bool generatedMipmaps = true)
+{
+	size_t bytes = image.hasMips() || !generatedMipmaps ? image.byteSize() : image.byteSize() * 4 / 3;
+	std::ostringstream line;	// workers report concurrently, so the line is written in one go
+	line << "TEXTURE:: " << image.path << ": " << image.width << "x" << image.height;
+	if (image.sourceWidth != image.width || image.sourceHeight != image.height)
+		line << " (downscaled from " << image.sourceWidth << "x" << image.sourceHeight << ")";
+	line << ", " << bytes / 1024 << " KiB\n";
+	std::cout << line.str() << std::flush;
+}
+
+// loads an image file, preferring its baked container, within the resolution its TextureBudget category allows.
+// Returns false (and reports it) if it can't be read.
+inline bool LoadImageData(const string &path, ImageData &image)
+{
+	TRACE_SCOPE("texture", path);
+	image.release();
+	image.path = path;
+	bool color;
+	int maxSize = TextureBudget::get().maxSizeFor(path, color);
+	if (LoadTextureContainer(path, image, maxSize))
+	{
+		ReportTextureMemory(image);
+		return true;
+	}
+
+	image.pixels = DecodeImageFile(path, &image.width, &image.height, &image.channels);
+	if (!image.pixels)
+	{
+		std::cout << "Texture failed to load at path: " << path << std::endl;
+		return false;
+	}
+	FitImageToBudget(image, maxSize, color);
+	image.format = FormatForChannels(image.channels);
+	image.internalFormat = image.format;
+	if (CPU_MIPMAPS)
+		GenerateImageMips(image, color);
+	ReportTextureMemory(image);
+	return true;
+}
+
+inline void SetTexture2DSampling()
+{
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// (re)specifies an existing texture name with the usual mipmapped/repeat sampling setup. pixels may also be an
+// offset into the currently bound GL_PIXEL_UNPACK_BUFFER.
+inline void SpecifyTexture2D(unsigned int textureID, int width, int height, int channels, const void *pixels)
+{
+	GLenum format = FormatForChannels(channels);
+
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	// decoded rows are tightly packed, which breaks the default 4 byte alignment for RGB and single channel images
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+
+	SetTexture2DSampling();
+}
+
+// (re)specifies an existing texture name from a complete pre-filtered mip chain, no mipmap generation involved.
+// Block compressed levels go up as they are.
+inline void SpecifyTexture2DLevels(unsigned int textureID, GLenum internalFormat, GLenum format, const vector<ImageLevel> &levels)
+{
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	bool compressed = IsCompressedFormat(internalFormat);
+	for (unsigned int i = 0; i < levels.size(); i++)
+	{
+		// container rows are padded, decoded and CPU built ones aren't
+		glPixelStorei(GL_UNPACK_ALIGNMENT, levels[i].alignment);
+		if (compressed)
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat, levels[i].width, levels[i].height, 0, (GLsizei)levels[i].size, levels[i].pixels);
+		else
+			glTexImage2D(GL_TEXTURE_2D, i, internalFormat, levels[i].width, levels[i].height, 0, format, GL_UNSIGNED_BYTE, levels[i].pixels);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+
+	SetTexture2DSampling();
+}
+
+// uploads an image into an existing texture name
+inline void UploadTexture2D(unsigned int textureID, const ImageData &image)
+{
+	TRACE_SCOPE("upload", image.path);
+	if (image.hasMips())
+		SpecifyTexture2DLevels(textureID, image.internalFormat, image.format, image.levels);
+	else if (image.pixels)
+		SpecifyTexture2D(textureID, image.width, image.height, image.channels, image.pixels);
+}
+#endif
@@ -0,0 +1,224 @@
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <glad/glad.h>
+
+#include "ContentHash.h"
+#include "AssetArchive.h"
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstdint>
+#include <cstdlib>
+#include <climits>
+using namespace std;
+
+class TextureRegistry;
+
+// One GL texture shared by everyone referencing the same image. The texture is deleted when the last
+// TextureHandle goes away, which has to happen on the GL thread while the context is current.
+struct TextureEntry {
+	unsigned int id;
+	string path;			// canonical absolute path it was first loaded from
+	uint64_t contentHash;	// 0 if the file couldn't be read
+	bool loaded;			// false until someone filled the texture
+
+	TextureEntry() : id(0), contentHash(0), loaded(false) {}
+	~TextureEntry();
+};
+
+typedef shared_ptr<TextureEntry> TextureHandle;
+
+// Process-wide texture table. Files are identified by their canonical absolute path first and by a hash of their
+// contents second, so the same image reached through different relative paths (every .mtl writes "../../textures/...")
+// or copied under another name is decoded and uploaded exactly once. Lookups are hashed; the table only holds weak
+// references, ownership stays with the handles.
+class TextureRegistry
+{
+public:
+	static TextureRegistry& get()
+	{
+		static TextureRegistry registry;
+		return registry;
+	}
+
+	// GL thread: returns the shared texture for path. created is set if this call generated the texture name,
+	// in which case the caller has to fill it and then call markLoaded. contentHash is the file's hashFile, taken by
+	// whichever thread read the file so the GL thread never does; 0 matches by path only.
+	TextureHandle acquire(const string &path, bool &created, uint64_t contentHash)
+	{
+		created = false;
+		string canonical = canonicalPath(path);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			TextureHandle handle = find(byPath, canonical);
+			if (handle)
+				return handle;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (contentHash != 0)
+		{
+			TextureHandle handle = find(byContent, contentHash);
+			if (handle)
+			{
+				byPath[canonical] = handle;
+				if (handle->loaded)
+					loadedPaths.insert(canonical);
+				else
+					loadedPaths.erase(canonical);
+				return handle;
+			}
+		}
+
+		TextureHandle handle = std::make_shared<TextureEntry>();
+		glGenTextures(1, &handle->id);
+		handle->path = canonical;
+		handle->contentHash = contentHash;
+		byPath[canonical] = handle;
+		loadedPaths.erase(canonical);
+		if (contentHash != 0)
+			byContent[contentHash] = handle;
+		created = true;
+		return handle;
+	}
+
+	void markLoaded(const TextureHandle &handle)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		handle->loaded = true;
+		for (auto it = byPath.begin(); it != byPath.end(); ++it)
+			if (sameTexture(it->second, handle))
+				loadedPaths.insert(it->first);
+	}
+
+	// any thread: true if path is already resident and filled, so decoding it again can be skipped. Like isRegistered
+	// this never takes a reference to the texture, so a worker can't end up releasing the last one away from the GL thread.
+	bool isLoaded(const string &path)
+	{
+		string canonical = canonicalPath(path);
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = byPath.find(canonical);
+		return it != byPath.end() && !it->second.expired() && loadedPaths.count(canonical);
+	}
+
+	// any thread: true if a live texture was loaded from path
+	bool isRegistered(const string &path)
+	{
+		string canonical = canonicalPath(path);
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = byPath.find(canonical);
+		return it != byPath.end() && !it->second.expired();
+	}
+
+	// GL thread: the live texture loaded from path, if any
+	TextureHandle lookup(const string &path)
+	{
+		string canonical = canonicalPath(path);
+		std::lock_guard<std::mutex> lock(mutex);
+		return find(byPath, canonical);
+	}
+
+	// takes a texture out of the table: its holders keep it as it is, the next acquire of its file loads a new one.
+	// For textures whose contents were given up (see PackMaterialTextures).
+	void unlist(const TextureHandle &handle)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto it = byPath.begin(); it != byPath.end(); )
+		{
+			if (sameTexture(it->second, handle))
+			{
+				loadedPaths.erase(it->first);
+				it = byPath.erase(it);
+			}
+			else
+				++it;
+		}
+		auto content = byContent.find(handle->contentHash);
+		if (content != byContent.end() && sameTexture(content->second, handle))
+			byContent.erase(content);
+	}
+
+	// number of live textures
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		size_t count = 0;
+		for (auto it = byPath.begin(); it != byPath.end(); ++it)
+			if (!it->second.expired())
+				count++;
+		return count;
+	}
+
+	static string canonicalPath(const string &path)
+	{
+		return CanonicalPath(path);
+	}
+
+	// any thread: hash of a file's contents for acquire, 0 if it can't be read
+	static uint64_t hashFile(const string &path)
+	{
+		AssetFile file;
+		if (!file.open(path))
+			return 0;
+		return HashBytes(file.data(), file.size());
+	}
+
+private:
+	friend struct TextureEntry;
+
+	std::mutex mutex;
+	unordered_map<string, weak_ptr<TextureEntry> > byPath;
+	unordered_map<uint64_t, weak_ptr<TextureEntry> > byContent;
+	unordered_set<string> loadedPaths;  // byPath keys whose texture has been filled, readable without locking the entry
+
+	TextureRegistry() {}
+
+	template <typename Key>
+	static TextureHandle find(unordered_map<Key, weak_ptr<TextureEntry> > &table, const Key &key)
+	{
+		auto it = table.find(key);
+		if (it == table.end())
+			return TextureHandle();
+		TextureHandle handle = it->second.lock();
+		if (!handle)
+			table.erase(it);
+		return handle;
+	}
+
+	// compares ownership, so an entry is never promoted (and possibly released) just to be compared
+	static bool sameTexture(const weak_ptr<TextureEntry> &entry, const TextureHandle &handle)
+	{
+		return !entry.owner_before(handle) && !handle.owner_before(entry);
+	}
+
+	// drops the table entries of a texture that is going away
+	void forget(const TextureEntry &entry)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto it = byPath.begin(); it != byPath.end(); )
+		{
+			if (it->second.expired())
+			{
+				loadedPaths.erase(it->first);
+				it = byPath.erase(it);
+			}
+			else
+				++it;
+		}
+		auto content = byContent.find(entry.contentHash);
+		if (content != byContent.end() && content->second.expired())
+			byContent.erase(content);
+	}
+};
+
+inline TextureEntry::~TextureEntry()
+{
+	TextureRegistry::get().forget(*this);
+	if (id)
+		glDeleteTextures(1, &id);
+}
+#endif
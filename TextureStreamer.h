@@ -0,0 +1,276 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+
+#include "GLExtensions.h"
+#include "TextureLoader.h"
+#include "ThreadPool.h"
+
+#include <string>
+#include <iostream>
+#include <deque>
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+using namespace std;
+
+// Streams textures in without stalling the render thread. request() hands out a texture name right away that
+// shows a neutral 1x1 placeholder; the file is decoded on background threads and update(), called once per frame,
+// copies finished images into a ring of pixel buffer objects and re-specifies the same texture name from there,
+// so whoever holds the name sees the real image from the next frame on.
+// The ring is persistently mapped when the driver has buffer storage, otherwise each region is mapped unsynchronized.
+class TextureStreamer
+{
+public:
+	TextureStreamer(unsigned int threads = 2, size_t ringSize = 64 * 1024 * 1024, size_t bytesPerFrame = 16 * 1024 * 1024)
+		: pbo(0), mapped(nullptr), capacity(ringSize), head(0), frameBudget(bytesPerFrame), placeholderPixel(0xff808080), decoding(0), pool(threads)
+	{
+		glGenBuffers(1, &pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		if (GLExt().bufferStorage)
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			GLExt().BufferStorage(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, capacity, flags);
+		}
+		else
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		current() = this;
+	}
+
+	~TextureStreamer()
+	{
+		if (current() == this)
+			current() = nullptr;
+	}
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// the streamer texture loads go through, if any
+	static TextureStreamer*& current()
+	{
+		static TextureStreamer *instance = nullptr;
+		return instance;
+	}
+
+	// returns a texture name immediately and starts decoding path in the background
+	unsigned int request(const string &path)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		stream(textureID, path);
+		return textureID;
+	}
+
+	// same as request, for a texture name that already exists
+	void stream(unsigned int textureID, const string &path)
+	{
+		SpecifyTexture2D(textureID, 1, 1, 4, &placeholderPixel);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			decoding++;
+		}
+		pool.enqueue([this, path, textureID]() {
+			Decoded item;
+			item.textureID = textureID;
+			LoadImageData(path, item.image);
+			std::lock_guard<std::mutex> lock(mutex);
+			decoded.push_back(std::move(item));
+			decoding--;
+		});
+	}
+
+	// GL thread, once per frame: uploads as many finished images as the per-frame budget and the ring allow
+	void update()
+	{
+		size_t uploaded = 0;
+		for (;;)
+		{
+			Decoded item;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (decoded.empty())
+					break;
+				size_t size = decoded.front().image.byteSize();
+				if (uploaded > 0 && uploaded + size > frameBudget)
+					break;
+				item = std::move(decoded.front());
+				decoded.pop_front();
+			}
+			if (!item.image.valid())
+				continue; // failed to decode, the placeholder stays
+			size_t size = item.image.byteSize();
+			if (!upload(item, size))
+			{
+				// ring is still busy with earlier uploads, retry next frame
+				std::lock_guard<std::mutex> lock(mutex);
+				decoded.push_front(std::move(item));
+				break;
+			}
+			uploaded += size;
+		}
+	}
+
+	// true once every requested texture was decoded and uploaded
+	bool idle()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return decoding == 0 && decoded.empty();
+	}
+
+	// frees the GL objects, must run while the context is still current
+	void release()
+	{
+		pool.wait();
+		while (!inFlight.empty())
+		{
+			glDeleteSync(inFlight.front().fence);
+			inFlight.pop_front();
+		}
+		if (pbo)
+		{
+			if (mapped)
+			{
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+			glDeleteBuffers(1, &pbo);
+		}
+		pbo = 0;
+		mapped = nullptr;
+	}
+
+private:
+	struct Decoded {
+		unsigned int textureID;
+		ImageData image;
+
+		Decoded() : textureID(0) {}
+	};
+
+	// region of the ring the GPU may still be reading from
+	struct Region {
+		size_t offset;
+		size_t size;
+		GLsync fence;
+	};
+
+	unsigned int pbo;
+	unsigned char *mapped;
+	size_t capacity;
+	size_t head;
+	size_t frameBudget;
+	deque<Region> inFlight;
+	uint32_t placeholderPixel;
+
+	std::mutex mutex;
+	deque<Decoded> decoded;
+	unsigned int decoding;
+
+	// declared last so its workers are joined before anything they touch is destroyed
+	ThreadPool pool;
+
+	bool upload(Decoded &item, size_t size)
+	{
+		// images that don't fit the ring at all go straight from client memory
+		if (((size + 15) & ~(size_t)15) > capacity)
+		{
+			UploadTexture2D(item.textureID, item.image);
+			return true;
+		}
+		size_t offset, previousHead = head;
+		if (!allocate(size, offset))
+			return false;
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		unsigned char *region = mapped ? mapped + offset :
+			(unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (!region)
+		{
+			// the region is given back and the image goes from client memory instead, so it doesn't stay a placeholder
+			std::cout << "ERROR::TEXTURE_STREAMER:: could not map the upload buffer, uploading directly" << std::endl;
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			head = previousHead;
+			UploadTexture2D(item.textureID, item.image);
+			return true;
+		}
+		const ImageData &image = item.image;
+		if (image.hasMips())
+		{
+			// levels are packed back to back, each starting 4-byte aligned
+			vector<ImageLevel> levels = image.levels;
+			size_t levelOffset = 0;
+			for (unsigned int i = 0; i < levels.size(); i++)
+			{
+				memcpy(region + levelOffset, levels[i].pixels, levels[i].size);
+				levels[i].pixels = (const unsigned char*)(uintptr_t)(offset + levelOffset);
+				levelOffset += (levels[i].size + 3) & ~(size_t)3;
+			}
+			if (!mapped)
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			SpecifyTexture2DLevels(item.textureID, image.internalFormat, image.format, levels);
+		}
+		else
+		{
+			memcpy(region, image.pixels, size);
+			if (!mapped)
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			SpecifyTexture2D(item.textureID, image.width, image.height, image.channels, (const void*)(uintptr_t)offset);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		Region used;
+		used.offset = offset;
+		used.size = size;
+		used.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		inFlight.push_back(used);
+		return true;
+	}
+
+	// finds room for size bytes between the newest and the oldest region still in use, wrapping around the end
+	bool allocate(size_t size, size_t &offset)
+	{
+		while (!inFlight.empty())
+		{
+			GLenum status = glClientWaitSync(inFlight.front().fence, 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				break;
+			glDeleteSync(inFlight.front().fence);
+			inFlight.pop_front();
+		}
+		size = (size + 15) & ~(size_t)15;
+		if (inFlight.empty())
+		{
+			head = 0;
+			if (size > capacity)
+				return false;
+			offset = 0;
+			head = size;
+			return true;
+		}
+
+		size_t tail = inFlight.front().offset;
+		// head == tail means the newest region ends right where the oldest starts, i.e. the ring is full
+		if (head > tail)
+		{
+			if (head + size <= capacity)
+				offset = head;
+			else if (size <= tail)
+				offset = 0;
+			else
+				return false;
+		}
+		else if (head < tail && head + size <= tail)
+			offset = head;
+		else
+			return false;
+		head = offset + size;
+		return true;
+	}
+};
+#endif
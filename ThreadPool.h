@@ -0,0 +1,112 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+#include "StartupTracer.h"
+
+// Fixed set of worker threads pulling jobs from a shared FIFO. Jobs must not touch the GL context,
+// anything that needs it has to be handed back to the thread that owns the context.
+class ThreadPool
+{
+public:
+	// threads == 0 picks one worker per hardware thread
+	explicit ThreadPool(unsigned int threads = 0) : stopping(false), active(0)
+	{
+		if (threads == 0)
+			threads = std::thread::hardware_concurrency();
+		if (threads == 0)
+			threads = 2;
+		for (unsigned int i = 0; i < threads; i++)
+			workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeWorkers.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void enqueue(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		wakeWorkers.notify_one();
+	}
+
+	// blocks until the queue is empty and no job is running
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this] { return jobs.empty() && active == 0; });
+	}
+
+	unsigned int size() const
+	{
+		return (unsigned int)workers.size();
+	}
+
+	// true on a worker of any pool. Work that splits itself over threads stays on the calling one there, the pool
+	// already keeps every core busy.
+	static bool onWorker()
+	{
+		return workerThread();
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wakeWorkers;
+	std::condition_variable idle;
+	bool stopping;
+	unsigned int active;
+
+	static bool& workerThread()
+	{
+		static thread_local bool worker = false;
+		return worker;
+	}
+
+	void workerLoop()
+	{
+		StartupTracer::get().nameThread("pool worker");
+		workerThread() = true;
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeWorkers.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+				active++;
+			}
+			job();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				active--;
+				if (jobs.empty() && active == 0)
+					idle.notify_all();
+			}
+		}
+	}
+};
+#endif
@@ -0,0 +1,174 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+using namespace std;
+
+struct Vertex {
+	// position
+	glm::vec3 Position;
+	// normal
+	glm::vec3 Normal;
+	// texCoords
+	glm::vec2 TexCoords;
+	// tangent
+	glm::vec3 Tangent;
+	// bitangent
+	glm::vec3 Bitangent;
+	// share of the hemisphere that isn't blocked by the model itself, 1 unless baked (see OcclusionBaker.h)
+	float Occlusion;
+};
+
+// How a mesh's vertices are laid out in its VBO.
+// VERTEX_FULL uploads struct Vertex as is (60 bytes). VERTEX_PACKED keeps the float position but stores the normal
+// as GL_INT_2_10_10_10_REV, the texture coordinates as half floats (floats if they leave [-1, 1], where half
+// precision drops below a texel of a 2k texture), the tangent only if the mesh has a normal map, again as
+// 2_10_10_10 with the bitangent's handedness in w, and the occlusion only if it was baked, as a normalized byte
+// padded to 4. That's 20 to 32 bytes per vertex. Without an occlusion array the attribute reads as 1 (see Mesh::Draw).
+// All of them are normalized/converted by the vertex fetch, so the shaders read the same vec3/vec2 inputs at the
+// same attribute locations either way.
+enum VertexFormat {
+	VERTEX_FULL,
+	VERTEX_PACKED
+};
+
+struct VertexLayout {
+	VertexFormat format;
+	bool halfTexCoords;
+	bool tangents;
+	bool occlusion;
+	unsigned int stride;
+	unsigned int normalOffset;
+	unsigned int texCoordOffset;
+	unsigned int tangentOffset;
+	unsigned int occlusionOffset;
+};
+
+// attribute location of Vertex::Occlusion
+const GLuint VERTEX_OCCLUSION_ATTRIBUTE = 5;
+
+// picks the concrete layout for a set of vertices in the requested format
+inline VertexLayout ChooseVertexLayout(VertexFormat format, const Vertex *vertices, size_t count, bool needsTangents)
+{
+	VertexLayout layout;
+	layout.format = format;
+	if (format == VERTEX_FULL)
+	{
+		layout.halfTexCoords = false;
+		layout.tangents = true;
+		layout.occlusion = true;
+		layout.stride = sizeof(Vertex);
+		layout.normalOffset = offsetof(Vertex, Normal);
+		layout.texCoordOffset = offsetof(Vertex, TexCoords);
+		layout.tangentOffset = offsetof(Vertex, Tangent);
+		layout.occlusionOffset = offsetof(Vertex, Occlusion);
+		return layout;
+	}
+
+	layout.halfTexCoords = true;
+	for (size_t i = 0; i < count && layout.halfTexCoords; i++)
+		layout.halfTexCoords = glm::abs(vertices[i].TexCoords.x) <= 1.0f && glm::abs(vertices[i].TexCoords.y) <= 1.0f;
+	layout.occlusion = false;
+	for (size_t i = 0; i < count && !layout.occlusion; i++)
+		layout.occlusion = vertices[i].Occlusion < 1.0f;
+	layout.tangents = needsTangents;
+	layout.normalOffset = 12;
+	layout.texCoordOffset = 16;
+	layout.tangentOffset = layout.texCoordOffset + (layout.halfTexCoords ? 4 : 8);
+	layout.occlusionOffset = layout.tangentOffset + (layout.tangents ? 4 : 0);
+	layout.stride = layout.occlusionOffset + (layout.occlusion ? 4 : 0);
+	return layout;
+}
+
+// converts vertices into the packed layout, out receives count * layout.stride bytes
+inline void PackVertices(const Vertex *vertices, size_t count, const VertexLayout &layout, vector<unsigned char> &out)
+{
+	out.resize(count * layout.stride);
+	for (size_t i = 0; i < count; i++)
+	{
+		const Vertex &vertex = vertices[i];
+		unsigned char *dst = &out[i * layout.stride];
+		memcpy(dst, &vertex.Position, 12);
+
+		uint32_t normal = glm::packSnorm3x10_1x2(glm::vec4(vertex.Normal, 0.0f));
+		memcpy(dst + layout.normalOffset, &normal, 4);
+
+		if (layout.halfTexCoords)
+		{
+			uint16_t uv[2] = { glm::packHalf1x16(vertex.TexCoords.x), glm::packHalf1x16(vertex.TexCoords.y) };
+			memcpy(dst + layout.texCoordOffset, uv, 4);
+		}
+		else
+			memcpy(dst + layout.texCoordOffset, &vertex.TexCoords, 8);
+
+		if (layout.tangents)
+		{
+			// the bitangent is rebuilt in the shader as cross(N, T) * w
+			float handedness = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -1.0f : 1.0f;
+			uint32_t tangent = glm::packSnorm3x10_1x2(glm::vec4(vertex.Tangent, handedness));
+			memcpy(dst + layout.tangentOffset, &tangent, 4);
+		}
+
+		if (layout.occlusion)
+		{
+			unsigned char occlusion[4] = { (unsigned char)(glm::clamp(vertex.Occlusion, 0.0f, 1.0f) * 255.0f + 0.5f), 0, 0, 0 };
+			memcpy(dst + layout.occlusionOffset, occlusion, 4);
+		}
+	}
+}
+
+// sets the attribute pointers of the bound VAO for the vertex buffer bound to GL_ARRAY_BUFFER
+inline void SetVertexAttributes(const VertexLayout &layout)
+{
+	GLsizei stride = layout.stride;
+	// vertex Positions
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+	if (layout.format == VERTEX_FULL)
+	{
+		// vertex normals
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Normal));
+		// vertex texture coords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, TexCoords));
+		// vertex tangent
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Tangent));
+		// vertex bitangent
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Bitangent));
+		// baked ambient occlusion
+		glEnableVertexAttribArray(VERTEX_OCCLUSION_ATTRIBUTE);
+		glVertexAttribPointer(VERTEX_OCCLUSION_ATTRIBUTE, 1, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, Occlusion));
+		return;
+	}
+
+	// vertex normals, w is padding
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(uintptr_t)layout.normalOffset);
+	// vertex texture coords
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 2, layout.halfTexCoords ? GL_HALF_FLOAT : GL_FLOAT, GL_FALSE, stride, (void*)(uintptr_t)layout.texCoordOffset);
+	// vertex tangent with the bitangent sign in w, no separate bitangent
+	if (layout.tangents)
+	{
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void*)(uintptr_t)layout.tangentOffset);
+	}
+	// baked ambient occlusion, if there is any
+	if (layout.occlusion)
+	{
+		glEnableVertexAttribArray(VERTEX_OCCLUSION_ATTRIBUTE);
+		glVertexAttribPointer(VERTEX_OCCLUSION_ATTRIBUTE, 1, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)(uintptr_t)layout.occlusionOffset);
+	}
+}
+#endif
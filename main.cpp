@@ -7,29 +7,60 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "AssetArchive.h"
+#include "AssetWatcher.h"
+#include "CubemapLoader.h"
+#include "SceneAssets.h"
+#include "TextureBudget.h"
 #include "Shader.h"
 #include "camera.h"
 #include "Model.h"
+#include "ModelLoader.h"
+#include "TextureStreamer.h"
+#include "GLExtensions.h"
+#include "StartupTracer.h"
 #include "Actions.h"
 
 #include <iostream>
 #include <map>
+#include <iterator>
 
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
-unsigned int loadTexture(const char *path);
+TextureHandle loadTexture(const char *path);
 unsigned int loadCubemap(vector<std::string> faces);
 void processInputPianoKeys(GLFWwindow *window, float deltaTime);
 void click_flashlight();
 void renderScene(const Shader &shader, const glm::mat4 base_pos);
 void renderLamps(const Shader &lightingShader, Shader &lampShader, const glm::mat4 projection, const glm::mat4 view, const glm::mat4 base_pos);
+void renderProxy(Shader &lampShader, unsigned int cubeVAO, const glm::mat4 projection, const glm::mat4 view, const glm::mat4 base_pos);
+float startupCoverage(const Camera &camera, const string &name, const glm::vec3 &center, float radius);
+Model* residentModel(const string &name);
+void watchSceneAssets(AssetWatcher &watcher, Shader &lightingShader, Shader &lampShader, Shader &skyboxShader, function<void()> configureShaders);
 
 // settings
 const unsigned int SCR_WIDTH = 800;
 const unsigned int SCR_HEIGHT = 600;
+// import models and decode textures on all cores, the GL thread only uploads
+const bool PARALLEL_LOADING = true;
+// with parallel loading: start rendering right away and bring models in as they become resident, the ones covering
+// most of the initial view first. Uploads take at most this much of each frame.
+const bool PROGRESSIVE_LOADING = true;
+const double PROGRESSIVE_UPLOAD_BUDGET = 0.004;
+// largest on-screen error, in pixels, a simplified mesh level may introduce
+const float LOD_PIXEL_ERROR = 1.0f;
+// pick up edits to models, textures and shaders while running (only when running from loose files)
+const bool HOT_RELOAD = true;
+// once the scene is in, pack same-sized material textures into texture arrays so meshes draw without rebinding them
+const bool TEXTURE_ARRAYS = true;
+// largest texture width/height per category, larger images are downscaled on load (0 keeps them as they are)
+const int TEXTURE_MAX_SIZE_KEYS = 1024;
+const int TEXTURE_MAX_SIZE_STAGE = 1024;
+const int TEXTURE_MAX_SIZE_SKYBOX = 1024;
+const int TEXTURE_MAX_SIZE_OTHER = 0;
 
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
@@ -59,9 +90,16 @@ glm::vec3 lampColors[] = {
 
 int main()
 {
+	// with PIANO_TRACE set the startup phases below end up in a trace file on exit
+	StartupTracer::get().nameThread("main");
+	double startupBegin = StartupTracer::get().now();
+
 	// glfw: initialize and configure
 	// ------------------------------
-	glfwInit();
+	{
+		TRACE_SCOPE("startup", "glfwInit");
+		glfwInit();
+	}
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -72,7 +110,9 @@ int main()
 
 	// glfw window creation
 	// --------------------
+	double windowBegin = StartupTracer::get().now();
 	GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+	StartupTracer::get().record("startup", "glfwCreateWindow", windowBegin, StartupTracer::get().now());
 	if (window == NULL)
 	{
 		std::cout << "Failed to create GLFW window" << std::endl;
@@ -89,11 +129,24 @@ int main()
 
 	// glad: load all OpenGL function pointers
 	// ---------------------------------------
+	double gladBegin = StartupTracer::get().now();
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
 	{
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	LoadGLExtensions((GLADloadproc)glfwGetProcAddress);
+	StartupTracer::get().record("startup", "gladLoadGLLoader", gladBegin, StartupTracer::get().now());
+
+	// with a baked scene archive in the working directory every asset below is read from it instead of loose files
+	AssetArchive assetArchive;
+	{
+		TRACE_SCOPE("startup", "mount archive");
+		assetArchive.mount(ASSET_ARCHIVE_PATH);
+	}
+
+	// textures requested after this point are decoded in the background and show a placeholder until uploaded
+	TextureStreamer textureStreamer;
 
 	// configure global opengl state
 	// -----------------------------
@@ -106,29 +159,15 @@ int main()
 	Shader lampShader("model.vs", "model.fs");
 	Shader skyboxShader("cubeMap.vs", "cubeMap.fs");
 
-	// A little bit brighter skybox ;)
-	/*vector<std::string> faces
-	{
-		"textures/skymap/right.jpg",
-		"textures/skymap/left.jpg",
-		"textures/skymap/top.jpg",
-		"textures/skymap/bottom.jpg",
-		"textures/skymap/front.jpg",
-		"textures/skymap/back.jpg"
-	};*/
-
-	vector<std::string> faces
-	{
-		"textures/skymap/purplenebulart.jpg",
-		"textures/skymap/purplenebulalf.jpg",
-		"textures/skymap/purplenebulaup.jpg",
-		"textures/skymap/purplenebuladn.jpg",
-		"textures/skymap/purplenebulaft.jpg",
-		"textures/skymap/purplenebulabk.jpg"
-	};
-
+	TextureBudget::get().setMaxSize(TEXTURE_KEYS, TEXTURE_MAX_SIZE_KEYS);
+	TextureBudget::get().setMaxSize(TEXTURE_STAGE, TEXTURE_MAX_SIZE_STAGE);
+	TextureBudget::get().setMaxSize(TEXTURE_SKYBOX, TEXTURE_MAX_SIZE_SKYBOX);
+	TextureBudget::get().setMaxSize(TEXTURE_OTHER, TEXTURE_MAX_SIZE_OTHER);
 
+	vector<std::string> faces(std::begin(SKYBOX_FACES), std::end(SKYBOX_FACES));
+	double cubemapBegin = StartupTracer::get().now();
 	unsigned int cubemapTexture = loadCubemap(faces);
+	StartupTracer::get().record("startup", "loadCubemap", cubemapBegin, StartupTracer::get().now());
 
 
 	glm::vec3 lampColors[] = {
@@ -186,7 +225,7 @@ int main()
 	unsigned int skyboxVAO, skyboxVBO;
 	glGenVertexArrays(1, &skyboxVAO);
 	glGenBuffers(1, &skyboxVBO);
-	glBindVertexArray(skyboxVAO);
+	BindVertexArray(skyboxVAO);
 	glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
 	glEnableVertexAttribArray(0);
@@ -195,50 +234,102 @@ int main()
 	// second, configure the light's VAO (VBO stays the same; the vertices are the same for the light object which is also a 3D cube)
 	unsigned int lightVAO;
 	glGenVertexArrays(1, &lightVAO);
-	glBindVertexArray(lightVAO);
+	BindVertexArray(lightVAO);
 
 	// note that we update the lamp's position attribute's stride to reflect the updated buffer data
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
 	glEnableVertexAttribArray(0);
 
-	// load textures (we now use a utility function to keep the code more organized)
-	// -----------------------------------------------------------------------------
-	unsigned int diffuseMap = loadTexture(((string)("textures/container2.png")).c_str());
-	unsigned int specularMap = loadTexture(((string)("textures/container2_specular.png")).c_str());
-
-
 	// shader configuration
 	// --------------------
-	lightingShader.use();
-	lightingShader.setInt("material.diffuse", 0);
-	lightingShader.setInt("material.specular", 1);
-
-	/*
-	Model piano(((string)"obj/Piano2/Pianotex.obj"));
-	Model key_white(((string)"obj/Piano2/white.obj"));
-	Model key_black(((string)"obj/Piano2/black.obj"));
-	Model paper(((string)"obj/Piano2/paper.obj"));
-	Model piano_flap(((string)"obj/Piano2/flap.obj"));
-	Model stick(((string)"obj/Piano2/stick.obj"));
-
-	Model stage(((string)"obj/stage/stage2.obj"));
-	Model lamp(((string)"obj/stage/lamp.obj"));
-	Model lens(((string)"obj/stage/lens.obj"));*/
-
-	modelMap.insert(std::make_pair("piano", new Model((string)"obj/Piano2/Pianotex.obj")));
-	modelMap.insert(std::make_pair("key_white", new Model((string)"obj/Piano2/white.obj")));
-	modelMap.insert(std::make_pair("key_black", new Model((string)"obj/Piano2/black.obj")));
-	modelMap.insert(std::make_pair("paper", new Model((string)"obj/Piano2/paper.obj")));
-	modelMap.insert(std::make_pair("piano_flap", new Model((string)"obj/Piano2/flap.obj")));
-	modelMap.insert(std::make_pair("stick", new Model((string)"obj/Piano2/stick.obj")));
+	auto configureShaders = [&]() {
+		lightingShader.use();
+		lightingShader.setInt("material.diffuse", 0);
+		lightingShader.setInt("material.specular", 1);
+		lightingShader.setInt("materialDiffuseArray", MATERIAL_ARRAY_UNIT);
+		lightingShader.setInt("materialSpecularArray", MATERIAL_ARRAY_UNIT + 1);
 
-	modelMap.insert(std::make_pair("stage", new Model((string)"obj/stage/stage2.obj")));
-	modelMap.insert(std::make_pair("lamp", new Model((string)"obj/stage/lamp.obj")));
-	modelMap.insert(std::make_pair("lens", new Model((string)"obj/stage/lens.obj")));
+		skyboxShader.use();
+		skyboxShader.setInt("skybox", 0);
+	};
+	configureShaders();
 
+	// load textures and models
+	// -------------------------
+	// textures are shared process-wide, the handles keep them alive until the end of main
+	std::map<std::string, TextureHandle> textureMap;
+	ModelLoader loader;
+	bool sceneResident = true;
+	double loadingBegin = StartupTracer::get().now();
+	if (PARALLEL_LOADING)
+	{
+		for (const SceneAsset &texture : SCENE_TEXTURES)
+			loader.addTexture(texture.name, texture.path, texture.textureCategory);
+		for (const SceneAsset &model : SCENE_MODELS)
+			loader.addModel(model.name, model.path, model.textureCategory, model.residency);
+		Camera startupCamera = camera;
+		loader.setPriority([startupCamera](const string &name, const glm::vec3 &center, float radius) {
+			return startupCoverage(startupCamera, name, center, radius);
+		});
+
+		if (PROGRESSIVE_LOADING)
+		{
+			loader.start();
+			sceneResident = false;
+		}
+		else
+			loader.load(modelMap, textureMap);
+	}
+	else
+	{
+		// (we now use a utility function to keep the code more organized)
+		for (const SceneAsset &texture : SCENE_TEXTURES)
+		{
+			TextureBudget::get().assign(texture.path, texture.textureCategory, true);
+			textureMap[texture.name] = loadTexture(texture.path);
+		}
+		for (const SceneAsset &model : SCENE_MODELS)
+			modelMap.insert(std::make_pair(model.name, new Model((string)model.path, false, model.textureCategory, model.residency)));
+	}
 
-	skyboxShader.use();
-	skyboxShader.setInt("skybox", 0);
+	// everything below waits for the whole scene, which with progressive loading happens some frames into the render loop
+	unsigned int diffuseMap = 0;
+	unsigned int specularMap = 0;
+	AssetWatcher assetWatcher;
+	bool hotReloading = false;
+	auto sceneLoaded = [&]() {
+		for (const SceneAsset &asset : SCENE_MODELS)
+		{
+			GeometryFootprint footprint = modelMap.at(asset.name)->footprint();
+			std::cout << "RESIDENCY:: " << asset.name << ": " << footprint.cpuBytes / 1024 << " KiB CPU, " << footprint.gpuBytes / 1024
+				<< " KiB GPU geometry" << std::endl;
+		}
+		diffuseMap = textureMap.at("diffuse")->id;
+		specularMap = textureMap.at("specular")->id;
+
+		hotReloading = HOT_RELOAD && !assetArchive.isMounted();
+		if (hotReloading)
+			watchSceneAssets(assetWatcher, lightingShader, lampShader, skyboxShader, configureShaders);
+		std::cout << "STARTUP:: scene resident after " << (int)(glfwGetTime() * 1000.0) << " ms" << std::endl;
+		StartupTracer::get().record("startup", "load scene", loadingBegin, StartupTracer::get().now());
+		StartupTracer::get().record("startup", "startup until scene resident", startupBegin, StartupTracer::get().now());
+	};
+	if (sceneResident)
+		sceneLoaded();
+	// packing copies the textures, so it waits for streamed ones to arrive too
+	bool texturesPacked = !TEXTURE_ARRAYS;
+	auto packTextures = [&]() {
+		vector<Model*> models;
+		for (auto it = modelMap.begin(); it != modelMap.end(); ++it)
+			models.push_back(it->second);
+		vector<TextureHandle> pinned;
+		for (auto it = textureMap.begin(); it != textureMap.end(); ++it)
+			pinned.push_back(it->second);
+		// hot reloads re-upload the 2D textures and copy them over again
+		PackMaterialTextures(models, hotReloading, pinned);
+		texturesPacked = true;
+	};
+	bool firstFrame = true;
 
 	// render loop
 	// -----------
@@ -249,9 +340,19 @@ int main()
 		float currentFrame = glfwGetTime();
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
+		double frameBegin = firstFrame ? StartupTracer::get().now() : 0.0;
 
 		processInput(window);
 		actions.move_the_lamps(deltaTime);
+		textureStreamer.update();
+		assetWatcher.update();
+		if (!sceneResident && loader.update(modelMap, textureMap, PROGRESSIVE_UPLOAD_BUDGET))
+		{
+			sceneResident = true;
+			sceneLoaded();
+		}
+		if (sceneResident && !texturesPacked && textureStreamer.idle())
+			packTextures();
 
 		glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -297,6 +398,7 @@ int main()
 		glm::mat4 view = camera.GetViewMatrix();
 		lightingShader.setMat4("projection", projection);
 		lightingShader.setMat4("view", view);
+		LodSettings::get().update(camera.Position, glm::radians(camera.Zoom), (float)SCR_HEIGHT, LOD_PIXEL_ERROR);
 
 		// world transformation
 		glm::mat4 model = glm::mat4(1.0f);
@@ -316,6 +418,9 @@ int main()
 
 		renderLamps(lightingShader, lampShader, projection, view, base_pos);
 
+		if (!residentModel("piano"))
+			renderProxy(lampShader, skyboxVAO, projection, view, base_pos);
+
 		// draw skybox as last
 		glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
 		skyboxShader.use();
@@ -324,16 +429,25 @@ int main()
 		skyboxShader.setMat4("projection", projection);
 
 		// skybox cube
-		glBindVertexArray(skyboxVAO);
+		BindVertexArray(skyboxVAO);
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
 		glDrawArrays(GL_TRIANGLES, 0, 36);
-		glBindVertexArray(0);
+		BindVertexArray(0);
 		glDepthFunc(GL_LESS); // set depth function back to default
 
 		// -------------------------------------------------------------------------------
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+
+		if (firstFrame)
+		{
+			// glfw's timer starts at glfwInit, right at launch
+			std::cout << "STARTUP:: first frame after " << (int)(glfwGetTime() * 1000.0) << " ms" << std::endl;
+			StartupTracer::get().record("startup", "first frame", frameBegin, StartupTracer::get().now());
+			StartupTracer::get().record("startup", "startup until first frame", startupBegin, StartupTracer::get().now());
+			firstFrame = false;
+		}
 	}
 
 	// optional: de-allocate all resources once they've outlived their purpose:
@@ -341,6 +455,11 @@ int main()
 	glDeleteVertexArrays(1, &lightVAO);
 	glDeleteVertexArrays(1, &skyboxVAO);
 	glDeleteBuffers(1, &skyboxVBO);
+	assetWatcher.stop();
+	// closed while still loading: the workers need the loader until they are done
+	loader.complete(modelMap, textureMap);
+	textureMap.clear();
+	textureStreamer.release();
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
 	glfwTerminate();
@@ -353,30 +472,31 @@ void renderScene(const Shader &shader, const glm::mat4 base_pos) {
 	glm::mat4 model = glm::scale(base_pos, glm::vec3(0.8f, 0.8f, 0.8f));	// it's a bit too big for our scene, so scale it down
 	shader.setMat4("model", model);
 	shader.setFloat("material.shininess", 128.0f);
-	Model* piano = modelMap.at("piano");
-	piano->Draw(shader);
+	Model* piano = residentModel("piano");
+	if (piano)
+		piano->Draw(shader, model);
 	//DRAW KEYS
 	glm::mat4 keys_pos = base_pos;
 	keys_pos = glm::translate(keys_pos, glm::vec3(-0.72f, 0.66f, 0.75f));
 	//whites
 	glm::mat4 key_scale = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, 1.0f, 1.0f));
-	Model* key_white = modelMap.at("key_white");
-	for (unsigned int i = 0; i < 36; i++) {
+	Model* key_white = residentModel("key_white");
+	for (unsigned int i = 0; key_white && i < 36; i++) {
 		glm::mat4 key = keys_pos;
 		key = glm::translate(key, glm::vec3(0.042f * i, 0.0f, 0.0f));
 		key = glm::rotate(key, glm::radians(actions.get_piano_key_angle(i, true)), glm::vec3(1.0f, 0.0f, 0.0f));
 		key = key_scale * key;
 		shader.setMat4("model", key);
-		key_white->Draw(shader);
+		key_white->Draw(shader, key);
 	}
 	//black
-	Model* key_black = modelMap.at("key_black");
+	Model* key_black = residentModel("key_black");
 	key_scale = glm::scale(glm::mat4(1.0f), glm::vec3(1.0f, 1.0f, 1.0f));
 	glm::mat4 keys_pos_black = glm::translate(keys_pos, glm::vec3(0.02f, 0.0f, 0.0f));
 	bool add_four = true;
 	unsigned int when_blank = 2;
 	unsigned int black_key_number = 0;
-	for (unsigned int i = 0; i < 35; i++) {
+	for (unsigned int i = 0; key_black && i < 35; i++) {
 		if (i == when_blank) {
 			if (add_four) when_blank += 4;
 			else when_blank += 3;
@@ -388,47 +508,51 @@ void renderScene(const Shader &shader, const glm::mat4 base_pos) {
 		key = glm::rotate(key, glm::radians(actions.get_piano_key_angle(black_key_number, false)), glm::vec3(1.0f, 0.0f, 0.0f));
 		key = key_scale * key;
 		shader.setMat4("model", key);
-		key_black->Draw(shader);
+		key_black->Draw(shader, key);
 		black_key_number++;
 	}
 	//PAPER
-	Model* paper = modelMap.at("paper");
+	Model* paper = residentModel("paper");
 	model = base_pos;
 	model = glm::translate(model, glm::vec3(0.00f, 1.02f, 0.64f));
 	model = glm::rotate(model, glm::radians(81.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 	model = glm::scale(model, glm::vec3(0.18f, 0.01f, 0.16f));
 	shader.setMat4("model", model);
-	paper->Draw(shader);
+	if (paper)
+		paper->Draw(shader, model);
 	//FLAP
-	Model* piano_flap = modelMap.at("piano_flap");
+	Model* piano_flap = residentModel("piano_flap");
 	model = base_pos;
 	model = glm::translate(model, glm::vec3(-0.786f, 0.91f, -0.928f));
 	model = glm::rotate(model, glm::radians(actions.get_flop_angle()), glm::vec3(0.0f, 0.0f, 1.0f));
 	model = glm::scale(model, glm::vec3(0.86f, 0.825f, 0.870f));
 	shader.setMat4("model", model);
-	piano_flap->Draw(shader);
+	if (piano_flap)
+		piano_flap->Draw(shader, model);
 	//STICK
-	Model* stick = modelMap.at("stick");
+	Model* stick = residentModel("stick");
 	model = base_pos;
 	model = glm::translate(model, glm::vec3(0.77f, 0.89f, 0.52f));
 	model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 	model = glm::rotate(model, glm::radians(actions.get_stick_angle()), glm::vec3(0.0f, 0.0f, 1.0f));
 	model = glm::scale(model, glm::vec3(0.85f, 0.7f, 0.7f));
 	shader.setMat4("model", model);
-	stick->Draw(shader);
+	if (stick)
+		stick->Draw(shader, model);
 
 	//STAGE
-	Model* stage = modelMap.at("stage");
+	Model* stage = residentModel("stage");
 	model = glm::translate(base_pos, glm::vec3(0.0f, -1.476f, 0.0f));
 	shader.setMat4("model", model);
-	stage->Draw(shader);
+	if (stage)
+		stage->Draw(shader, model);
 }
 
 void renderLamps(const Shader &lightingShader, Shader &lampShader, const glm::mat4 projection, const glm::mat4 view, const glm::mat4 base_pos) {
 	//LAMP
 	glDisable(GL_CULL_FACE);
 	glm::mat4 lamp_pos[3];
-	Model* lamp = modelMap.at("lamp");
+	Model* lamp = residentModel("lamp");
 	for (int i = 0; i < 3; i++) {
 		glm::vec3 dir_move = actions.get_light_direction_move(i);
 
@@ -438,7 +562,8 @@ void renderLamps(const Shader &lightingShader, Shader &lampShader, const glm::ma
 		//model = glm::rotate(model, glm::radians(actions.get_light_direction_angle(i)), glm::vec3(0.0f, 1.0f, 0.0f));
 		lightingShader.setMat4("model", model);
 
-		lamp->Draw(lightingShader);
+		if (lamp)
+			lamp->Draw(lightingShader);
 
 		string name = "spotLight[";
 		name.append(std::to_string(i + 1));
@@ -462,12 +587,12 @@ void renderLamps(const Shader &lightingShader, Shader &lampShader, const glm::ma
 	}
 	glEnable(GL_CULL_FACE);
 	//Lens
-	Model* lens = modelMap.at("lens");
+	Model* lens = residentModel("lens");
 	lampShader.use();
 	lampShader.setMat4("projection", projection);
 	lampShader.setMat4("view", view);
 	//glBindVertexArray(lightVAO);
-	for (unsigned int i = 0; i < 3; i++)
+	for (unsigned int i = 0; lens && i < 3; i++)
 	{
 		glm::mat4 model = lamp_pos[i];
 		model = glm::translate(model, glm::vec3(0.0f, -0.08f, -0.64f));
@@ -479,6 +604,71 @@ void renderLamps(const Shader &lightingShader, Shader &lampShader, const glm::ma
 }
 
 
+// stand-in for the piano while it is still loading: a plain box over the area the piano, its keys and lid take up
+void renderProxy(Shader &lampShader, unsigned int cubeVAO, const glm::mat4 projection, const glm::mat4 view, const glm::mat4 base_pos) {
+	glm::mat4 model = glm::translate(base_pos, glm::vec3(0.0f, 0.45f, -0.1f));
+	model = glm::scale(model, glm::vec3(0.8f, 0.45f, 0.85f));
+	lampShader.use();
+	lampShader.setMat4("projection", projection);
+	lampShader.setMat4("view", view);
+	lampShader.setMat4("model", model);
+	// the skybox cube is wound to be seen from the inside
+	glDisable(GL_CULL_FACE);
+	BindVertexArray(cubeVAO);
+	glDrawArrays(GL_TRIANGLES, 0, 36);
+	BindVertexArray(0);
+	glEnable(GL_CULL_FACE);
+}
+
+// the model loaded under name, null while it is still streaming in
+Model* residentModel(const string &name) {
+	std::map<std::string, Model*>::iterator it = modelMap.find(name);
+	return it != modelMap.end() ? it->second : nullptr;
+}
+
+// rough share of the initial view a model covers, so the loader brings in what is most visible first. Places the
+// model's bounding sphere about where renderScene and renderLamps first draw it (keys at rest, one entry per instance)
+// and sums the projected areas as seen from the starting camera. Runs on loader threads, so camera is a copy taken
+// before loading starts rather than the one input moves.
+float startupCoverage(const Camera &camera, const string &name, const glm::vec3 &center, float radius) {
+	glm::mat4 base_pos = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.2f, 0.0f));
+	vector<glm::mat4> placements;
+	if (name == "piano")
+		placements.push_back(glm::scale(base_pos, glm::vec3(0.8f, 0.8f, 0.8f)));
+	else if (name == "key_white" || name == "key_black") {
+		for (unsigned int i = 0; i < 36; i++)
+			placements.push_back(glm::translate(base_pos, glm::vec3(-0.72f + 0.042f * i, 0.66f, 0.75f)));
+	}
+	else if (name == "paper")
+		placements.push_back(glm::scale(glm::translate(base_pos, glm::vec3(0.00f, 1.02f, 0.64f)), glm::vec3(0.18f, 0.01f, 0.16f)));
+	else if (name == "piano_flap")
+		placements.push_back(glm::scale(glm::translate(base_pos, glm::vec3(-0.786f, 0.91f, -0.928f)), glm::vec3(0.86f, 0.825f, 0.870f)));
+	else if (name == "stick")
+		placements.push_back(glm::scale(glm::translate(base_pos, glm::vec3(0.77f, 0.89f, 0.52f)), glm::vec3(0.85f, 0.7f, 0.7f)));
+	else if (name == "stage")
+		placements.push_back(glm::translate(base_pos, glm::vec3(0.0f, -1.476f, 0.0f)));
+	else if (name == "lamp" || name == "lens") {
+		for (int i = 0; i < 3; i++)
+			placements.push_back(glm::scale(glm::translate(base_pos, glm::vec3(-8.0f + 6.5f*i, 9.6f, 5.47f)), glm::vec3(name == "lens" ? 0.37f : 1.0f)));
+	}
+
+	// pixels covered by one unit at distance one, as in LodSettings
+	float projectionScale = SCR_HEIGHT / (2.0f * std::tan(glm::radians(camera.Zoom) * 0.5f));
+	float coverage = 0.0f;
+	for (const glm::mat4 &placement : placements) {
+		float scale = 0.0f;
+		for (int i = 0; i < 3; i++)
+			scale = glm::max(scale, glm::length(glm::vec3(placement[i])));
+		glm::vec3 offset = glm::vec3(placement * glm::vec4(center, 1.0f)) - camera.Position;
+		float worldRadius = radius * scale;
+		float depth = glm::dot(offset, camera.Front);
+		if (depth < -worldRadius)
+			continue; // behind the camera
+		float pixels = worldRadius * projectionScale / glm::max(depth, worldRadius);
+		coverage += glm::min(3.14159265f * pixels * pixels / (SCR_WIDTH * SCR_HEIGHT), 1.0f);
+	}
+	return coverage;
+}
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 // ---------------------------------------------------------------------------------------------------------
@@ -698,72 +888,90 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 
 // utility function for loading a 2D texture from file
 // ---------------------------------------------------
-unsigned int loadTexture(char const * path)
+TextureHandle loadTexture(char const * path)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
+	return AcquireTexture(path, TextureRegistry::hashFile(path));
 }
 
 unsigned int loadCubemap(vector<std::string> faces)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+	return LoadCubemap(faces);
+}
 
-	int width, height, nrChannels;
-	for (unsigned int i = 0; i < faces.size(); i++)
+// registers the reload of every scene asset with the watcher. Models are re-imported (and their mesh cache rebuilt) on
+// a worker and swapped in whole, textures are decoded on a worker and re-uploaded into the same GL name so everything
+// using them follows, shaders are recompiled on the GL thread and keep the old program if the edit doesn't compile.
+// ---------------------------------------------------------------------------------------------------------
+void watchSceneAssets(AssetWatcher &watcher, Shader &lightingShader, Shader &lampShader, Shader &skyboxShader, function<void()> configureShaders)
+{
+	for (const SceneAsset &asset : SCENE_MODELS)
 	{
-		unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-				0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
-			);
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-			stbi_image_free(data);
-		}
-	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		string name = asset.name, path = asset.path;
+		TextureCategory category = asset.textureCategory;
+		GeometryResidency residency = asset.residency;
+		watcher.watch(MeshCache::sourceFiles(path), [name, path, category, residency](const string &) -> ApplyChange {
+			shared_ptr<ModelData> data = std::make_shared<ModelData>();
+			if (!Model::Import(path, *data))
+				return ApplyChange();
+			AssignTextureBudget(*data, category);
+			HashModelTextures(*data);
+			return [name, path, data, residency]() {
+				Model *model = new Model(*data, [data](const string &file) {
+					return TextureFromFile(file.c_str(), data->directory, false, data->textureHash(file));
+				},
+					false, residency);
+				Model *&slot = modelMap[name];
+				if (slot)
+				{
+					slot->release();
+					delete slot;
+				}
+				slot = model;
+				std::cout << "HOT_RELOAD:: model " << path << std::endl;
+			};
+		});
+	}
+
+	// any image in the directories textures are loaded from, if it is in use. Editing the source of a baked .ktx
+	// makes the container stale, so the image is decoded; re-baking the container reloads its source's texture.
+	auto reloadTexture = [](const string &changed) -> ApplyChange {
+		string path = changed;
+		string container = TextureContainerPath("");
+		if (path.size() > container.size() && path.compare(path.size() - container.size(), container.size(), container) == 0)
+			path.erase(path.size() - container.size());
+		if (!TextureRegistry::get().isRegistered(path))
+			return ApplyChange();
+		shared_ptr<ImageData> image = std::make_shared<ImageData>();
+		if (!LoadImageData(path, *image))
+			return ApplyChange();
+		return [path, image]() {
+			TextureHandle handle = TextureRegistry::get().lookup(path);
+			if (!handle)
+				return;
+			UploadTexture2D(handle->id, *image);
+			TextureArrays::get().refresh(handle);
+			std::cout << "HOT_RELOAD:: texture " << path << std::endl;
+		};
+	};
+	for (const SceneAsset &texture : SCENE_TEXTURES)
+		watcher.watchDirectory(string(texture.path).substr(0, string(texture.path).find_last_of('/')), reloadTexture);
+	for (const SceneAsset &model : SCENE_MODELS)
+		watcher.watchDirectory(string(model.path).substr(0, string(model.path).find_last_of('/')), reloadTexture);
+
+	// the handlers outlive this call, so each keeps its own copy of configureShaders
+	auto watchShader = [&watcher, &configureShaders](Shader &shader, const char *vertexPath, const char *fragmentPath) {
+		watcher.watch(vector<string>{ vertexPath, fragmentPath }, [&shader, configureShaders, vertexPath, fragmentPath](const string &) -> ApplyChange {
+			return [&shader, configureShaders, vertexPath, fragmentPath]() {
+				if (!shader.reload(vertexPath, fragmentPath))
+					return;
+				configureShaders();
+				std::cout << "HOT_RELOAD:: shader " << vertexPath << " / " << fragmentPath << std::endl;
+			};
+		});
+	};
+	watchShader(lightingShader, "shader.vs", "shader.fs");
+	watchShader(lampShader, "model.vs", "model.fs");
+	watchShader(skyboxShader, "cubeMap.vs", "cubeMap.fs");
 
-	return textureID;
+	watcher.start();
 }
-
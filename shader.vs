@@ -2,10 +2,12 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 5) in float aOcclusion;
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+out float Occlusion;
 
 uniform mat4 model;
 uniform mat4 view;
@@ -16,6 +18,7 @@ void main()
     FragPos = vec3(model * vec4(aPos, 1.0));
     Normal = mat3(transpose(inverse(model))) * aNormal;  
     TexCoords = aTexCoords;
+    Occlusion = aOcclusion;
     
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,261 @@
+// Offline asset baker. Run from the project root:
+//   bake textures [--data] [--srgb] [--uncompressed] <image>...
+//                                       writes <image>.ktx with the full pre-filtered mip chain, block compressed
+//                                       (BC1 for RGB, BC3 for RGBA, see TextureCompression.h) unless --uncompressed.
+//                                       Colors are filtered in linear space like the runtime's mips; --data filters
+//                                       the channels as they are (normal and height maps), --srgb stores an sRGB format
+//   bake cubemap <+x> <-x> <+y> <-y> <+z> <-z>
+//                                       writes <+x>.cube.ktx with the block compressed mip chains of all six faces
+//   bake archive [<output>]             packs every mesh cache, texture, the skybox and every shader main() loads
+//                                       into one archive (scene.pak by default), see AssetArchive.h
+//   bake verify-png <image>...          decodes each PNG with the fast decoder and with stb_image and compares the
+//                                       pixels, see PngDecoder.h
+// Builds like the app itself, from this file plus glad.c, linked against ASSIMP.
+#include <glad/glad.h>
+
+#include "../AssetArchive.h"
+#include "../CubemapLoader.h"
+#include "../MipChain.h"
+#include "../Model.h"
+#include "../SceneAssets.h"
+#include "../TextureContainer.h"
+#include "../TextureLoader.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <iterator>
+#include <chrono>
+using namespace std;
+
+// whether cubemaps and the archive's textures are baked block compressed
+const bool BAKE_COMPRESSED_TEXTURES = true;
+
+const char* containerFormatName(int channels, bool compress)
+{
+	if (!compress)
+		return "uncompressed";
+	static const char *const names[4] = { "BC4", "BC5", "BC1", "BC3" };
+	return names[channels - 1];
+}
+
+// decodes one image, filters its mip chain and writes the container next to it. color filters the color channels in
+// linear space, as GenerateImageMips does for color textures; srgb only picks the container's internal format.
+bool bakeTexture(const string &path, bool color, bool srgb, bool compress)
+{
+	int width, height, channels;
+	unsigned char *pixels = DecodeImageFile(path, &width, &height, &channels);
+	if (!pixels)
+	{
+		cout << "ERROR::BAKE:: could not decode " << path << endl;
+		return false;
+	}
+	vector<vector<MipLevel> > faces(1);
+	BuildMipChain(pixels, width, height, channels, color, faces[0]);
+	stbi_image_free(pixels);
+
+	string containerPath = TextureContainerPath(path);
+	if (!WriteTextureContainer(containerPath, faces, channels, srgb, compress))
+	{
+		cout << "ERROR::BAKE:: could not write " << containerPath << endl;
+		return false;
+	}
+	cout << containerPath << ": " << width << "x" << height << "x" << channels << ", " << faces[0].size() << " levels, "
+		<< containerFormatName(channels, compress) << endl;
+	return true;
+}
+
+int bakeTextures(int argc, char **argv)
+{
+	bool color = true, srgb = false, compress = BAKE_COMPRESSED_TEXTURES;
+	int failed = 0;
+	for (int i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--data") == 0)
+			color = false;
+		else if (strcmp(argv[i], "--srgb") == 0)
+			srgb = true;
+		else if (strcmp(argv[i], "--uncompressed") == 0)
+			compress = false;
+		else if (!bakeTexture(argv[i], color, srgb, compress))
+			failed++;
+	}
+	return failed ? 1 : 0;
+}
+
+// decodes the six faces of a cubemap and writes their mip chains, filtered in linear space, into one container
+bool bakeCubemap(const vector<string> &faces, bool compress)
+{
+	if (faces.size() != CUBEMAP_FACES)
+	{
+		cout << "ERROR::BAKE:: a cubemap needs " << CUBEMAP_FACES << " faces" << endl;
+		return false;
+	}
+	vector<vector<MipLevel> > levels(CUBEMAP_FACES);
+	int size = 0, channels = 0;
+	for (unsigned int face = 0; face < CUBEMAP_FACES; face++)
+	{
+		int width, height, faceChannels;
+		unsigned char *pixels = DecodeImageFile(faces[face], &width, &height, &faceChannels);
+		if (!pixels)
+		{
+			cout << "ERROR::BAKE:: could not decode " << faces[face] << endl;
+			return false;
+		}
+		if (width != height || (face > 0 && (width != size || faceChannels != channels)))
+		{
+			cout << "ERROR::BAKE:: " << faces[face] << " does not match the other faces" << endl;
+			stbi_image_free(pixels);
+			return false;
+		}
+		size = width;
+		channels = faceChannels;
+		BuildMipChain(pixels, width, height, channels, true, levels[face]);
+		stbi_image_free(pixels);
+	}
+
+	string containerPath = CubemapContainerPath(faces);
+	if (!WriteTextureContainer(containerPath, levels, channels, false, compress))
+	{
+		cout << "ERROR::BAKE:: could not write " << containerPath << endl;
+		return false;
+	}
+	cout << containerPath << ": 6x" << size << "x" << size << "x" << channels << ", " << levels[0].size() << " levels, "
+		<< containerFormatName(channels, compress) << endl;
+	return true;
+}
+
+int bakeCubemaps(int argc, char **argv)
+{
+	return bakeCubemap(vector<string>(argv, argv + argc), BAKE_COMPRESSED_TEXTURES) ? 0 : 1;
+}
+
+// bakes a texture and adds its container, which the runtime prefers over the image, to the archive. Whether it holds
+// colors goes by the usages recorded in the TextureBudget, as it does when the runtime builds the mips itself.
+bool archiveTexture(AssetArchiveWriter &archive, const string &path)
+{
+	string containerPath = TextureContainerPath(path);
+	if (archive.contains(containerPath))
+		return true;
+	bool color;
+	TextureBudget::get().maxSizeFor(path, color);
+	return bakeTexture(path, color, false, BAKE_COMPRESSED_TEXTURES) && archive.addFile(containerPath);
+}
+
+bool archiveFile(AssetArchiveWriter &archive, const string &path)
+{
+	if (archive.addFile(path))
+		return true;
+	cout << "ERROR::BAKE:: could not read " << path << endl;
+	return false;
+}
+
+int bakeArchive(int argc, char **argv)
+{
+	string output = argc > 0 ? argv[0] : ASSET_ARCHIVE_PATH;
+	AssetArchiveWriter archive;
+	int failed = 0;
+
+	// shader sources are stored as they are, the skybox as one baked cubemap
+	for (const char *path : SCENE_SHADERS)
+		if (!archiveFile(archive, path))
+			failed++;
+	vector<string> faces(std::begin(SKYBOX_FACES), std::end(SKYBOX_FACES));
+	if (!bakeCubemap(faces, BAKE_COMPRESSED_TEXTURES) || !archiveFile(archive, CubemapContainerPath(faces)))
+		failed++;
+	for (const SceneAsset &texture : SCENE_TEXTURES)
+		if (!archiveTexture(archive, texture.path))
+			failed++;
+
+	// models go in as their optimized mesh caches, which Import leaves next to the source, plus every texture they use
+	for (const SceneAsset &model : SCENE_MODELS)
+	{
+		ModelData data;
+		if (!Model::Import(model.path, data) || !archiveFile(archive, MeshCache::cachePath(model.path)))
+		{
+			cout << "ERROR::BAKE:: could not import " << model.path << endl;
+			failed++;
+			continue;
+		}
+		AssignTextureBudget(data, model.textureCategory);
+		for (const MeshData &mesh : data.meshes)
+			for (const Texture &texture : mesh.textures)
+				if (!archiveTexture(archive, data.directory + '/' + texture.path))
+					cout << "WARNING::BAKE:: " << model.path << " references missing texture " << texture.path << endl;
+	}
+
+	if (failed)
+		return 1;
+	if (!archive.write(output))
+	{
+		cout << "ERROR::BAKE:: could not write " << output << endl;
+		return 1;
+	}
+	cout << output << ": " << archive.entryCount() << " entries, " << archive.rawBytes / 1024 << " KiB packed into "
+		<< archive.storedBytes / 1024 << " KiB" << endl;
+	return 0;
+}
+
+// decodes each PNG with DecodePng and stb_image, which must agree byte for byte where DecodePng takes the file
+int verifyPngs(int argc, char **argv)
+{
+	int failed = 0;
+	double fastTime = 0.0, stbTime = 0.0;
+	for (int i = 0; i < argc; i++)
+	{
+		AssetFile file;
+		if (!file.open(argv[i]) || file.size() > INT_MAX)
+		{
+			cout << "ERROR::BAKE:: could not read " << argv[i] << endl;
+			failed++;
+			continue;
+		}
+		int width = 0, height = 0, channels = 0, stbWidth = 0, stbHeight = 0, stbChannels = 0;
+		auto begin = std::chrono::steady_clock::now();
+		unsigned char *fast = DecodePng(file.data(), file.size(), &width, &height, &channels);
+		auto middle = std::chrono::steady_clock::now();
+		unsigned char *reference = stbi_load_from_memory(file.data(), (int)file.size(), &stbWidth, &stbHeight, &stbChannels, 0);
+		auto end = std::chrono::steady_clock::now();
+		double fastMs = std::chrono::duration<double, std::milli>(middle - begin).count();
+		double stbMs = std::chrono::duration<double, std::milli>(end - middle).count();
+
+		if (!fast)
+			cout << argv[i] << ": not handled by the fast decoder, stb_image decodes it" << endl;
+		else if (!reference || width != stbWidth || height != stbHeight || channels != stbChannels ||
+			memcmp(fast, reference, (size_t)width * height * channels) != 0)
+		{
+			cout << "ERROR::BAKE:: " << argv[i] << " decodes differently from stb_image" << endl;
+			failed++;
+		}
+		else
+		{
+			fastTime += fastMs;
+			stbTime += stbMs;
+			cout << argv[i] << ": " << width << "x" << height << "x" << channels << " identical, " << fastMs << " ms against "
+				<< stbMs << " ms" << endl;
+		}
+		free(fast);
+		stbi_image_free(reference);
+	}
+	cout << argc - failed << " of " << argc << " files match, " << fastTime << " ms against " << stbTime << " ms" << endl;
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc >= 2 && strcmp(argv[1], "textures") == 0)
+		return bakeTextures(argc - 2, argv + 2);
+	if (argc >= 2 && strcmp(argv[1], "cubemap") == 0)
+		return bakeCubemaps(argc - 2, argv + 2);
+	if (argc >= 2 && strcmp(argv[1], "archive") == 0)
+		return bakeArchive(argc - 2, argv + 2);
+	if (argc >= 2 && strcmp(argv[1], "verify-png") == 0)
+		return verifyPngs(argc - 2, argv + 2);
+
+	cout << "usage: bake textures [--data] [--srgb] [--uncompressed] <image>..." << endl;
+	cout << "       bake cubemap <+x> <-x> <+y> <-y> <+z> <-z>" << endl;
+	cout << "       bake archive [<output>]" << endl;
+	cout << "       bake verify-png <image>..." << endl;
+	return 1;
+}